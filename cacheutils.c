@@ -15,11 +15,20 @@
  * GNU General Public License for more details.
  */
 
+#define _GNU_SOURCE
 #include "defs.h"
+#include <pthread.h>
+#include <elf.h>
+#include <sys/sendfile.h>
+#include <sys/file.h>
+#include <regex.h>
+#include <fnmatch.h>
 
 #define CU_VALID_MEMBER(X)	(cu_offset_table.X >= 0)
 #define CU_INVALID_MEMBER(X)	(cu_offset_table.X == INVALID_OFFSET)
 #define CU_OFFSET_INIT(X, Y, Z)	(cu_offset_table.X = MEMBER_OFFSET(Y, Z))
+#define CU_ANON_OFFSET_INIT(X, Y, Z) \
+	(cu_offset_table.X = ANON_MEMBER_OFFSET(Y, Z))
 #define CU_OFFSET(X)	(OFFSET_verify(cu_offset_table.X, \
 			(char *)__FUNCTION__, __FILE__, __LINE__, #X))
 
@@ -36,16 +45,63 @@ struct cu_offset_table {
 	long hlist_bl_node_pprev;
 	long dentry_d_sib;	/* 6.8 and later */
 	long dentry_d_children;	/* 6.8 and later */
+	long page_compound_head;	/* 4.4 and later */
+	long page_compound_order;
+	long folio_folio_order;
+	long folio_flags_1;	/* 6.6 and later for order */
+	long xarray_xa_head;	/* or radix_tree_root.rnode */
+	long xa_node_shift;	/* or radix_tree_node.shift, 4.7 and later */
+	long xa_node_slots;
+	long qstr_hash;
+	long inode_i_data;
+	long dentry_d_flags;
+	long dentry_d_mounted;	/* 2.6.37 and older */
+	long dentry_d_alias;
+	long inode_i_dentry;
+	long inode_i_sb_list;
+	long super_block_s_list;
+	long super_block_s_inodes;
+	long super_block_s_id;
+	long super_block_s_type;
+	long file_system_type_name;
+	long external_name_name;
 };
 static struct cu_offset_table cu_offset_table;
 
+/*
+ * The field plan, set up at init for the running kernel: the byte spans
+ * of a dentry and an inode that are decoded, so that only the spans are
+ * read, and how to decode i_mode and i_mtime.  When the i_mapping of an
+ * inode is its own i_data, nrpages is taken from the same span.
+ */
+#define MTIME_SEC_NSEC		(0)	/* i_mtime_sec and i_mtime_nsec */
+#define MTIME_TIMESPEC64	(1)
+#define MTIME_TIMESPEC		(2)
+
+static struct {
+	long dentry_start, dentry_end;
+	long inode_start, inode_end;
+	long i_data_nrpages;	/* in the inode, or -1 */
+	int mtime;
+	int umode_32bit;
+} plan;
+
 static void cacheutils_init(void);
 static void cacheutils_fini(void);
 static void cmd_ccat(void);
 static void cmd_cls(void);
 static void cmd_cfind(void);
-
-static ulong get_mntpoint_dentry(char *path, char **remaining_path);
+static void cmd_cstore(void);
+static void cmd_cdiff(void);
+static void cmd_cgrep(void);
+static void cmd_ccache(void);
+static void cmd_cindex(void);
+static void cmd_cinodes(void);
+static void cmd_cdu(void);
+static void cmd_cdstat(void);
+
+static ulong follow_mount(ulong *mnt, ulong dentry);
+static int mount_lookup(ulong mnt, ulong dentry);
 
 /* for flags */
 #define DUMP_FILE		(0x0001)
@@ -59,8 +115,23 @@ static ulong get_mntpoint_dentry(char *path, char **remaining_path);
 #define SHOW_INFO_LONG		(0x0100)
 #define SHOW_INFO_RECURSIVE	(0x0200)
 #define SHOW_INFO_SORT_MTIME	(0x0400)
+#define DUMP_ASYNC		(0x0800)
 #define FIND_FILES		(0x1000)
 #define FIND_COUNT_DENTRY	(0x2000)
+#define DUMP_DIRECT_IO		(0x4000)
+#define DUMP_SORT_PHYS		(0x8000)
+#define DUMP_ARCHIVE		(0x10000)
+#define DUMP_ZSTD		(0x20000)
+#define DUMP_STORE		(0x40000)
+#define DUMP_MANIFEST		(0x80000)
+#define DUMP_RESUME		(0x100000)
+#define DUMP_RANGE		(0x200000)
+#define GREP_CONTENTS		(0x400000)
+#define ALL_MNT_NS		(0x800000)
+#define SHOW_DU			(0x1000000)
+#define SHOW_DSTAT		(0x2000000)
+
+#define MODE_RWX (S_IRWXU|S_IRWXG|S_IRWXO)
 
 /* for env_flags */
 #define XARRAY			(0x0001)
@@ -81,1041 +152,8612 @@ static char *count_dentry_fmt = "%7d %6d %6d %s\n";
 static int flags;
 static int env_flags;
 static FILE *outfp;
-static ulong nr_written, nr_excluded;
-static ulonglong out_size;
+static int out_fd;
+static int out_direct;		/* out_fd is opened with O_DIRECT */
+static char *out_src;
+static ulong nr_written, nr_excluded, nr_extents;
+static ulonglong out_size, out_cursor;
 static struct task_context *tc;
 static int total_dentry, total_negdent;
-static ulong total_pages;
+static ulong total_pages, total_extents;
+static char *storedir;
+static long pg_head_bit = -1;
+static ulong folio_next;	/* the index after the last folio */
+static ulong nr_cached;		/* pages in the folios of a file */
+static ulonglong out_base;	/* file offset written at offset 0 */
+static ulonglong range_offset, range_length;
+static ulong tail_pages, tail_lines;
 
 /* Per-command caches and buffers */
+typedef struct {
+	ulong mnt;		/* (vfs)mount */
+	ulong parent;
+	ulong mountpoint;	/* dentry */
+	ulong root;		/* dentry */
+} mount_info_t;
+
 static int mount_count;
-static char *mount_data;
-static char **mount_path;
+static mount_info_t *mount_info;
+static int *mount_hash;		/* indexes in mount_info, or -1 */
+static ulong mount_hash_mask;
+static ulong dcache_mounted = 0x10000;	/* DCACHE_MOUNTED */
 
 static char *dentry_data;
+
+/*
+ * Contiguous pages are gathered in pgbuf and written with one call.
+ * extent_pos is the file offset of pgbuf, extent_len the bytes in it.
+ */
+#define EXTENT_MAX_PAGES	(512)
+#define EXTENT_BUFSIZE		(PAGESIZE() * EXTENT_MAX_PAGES)
+
 static char *pgbuf;
+static ulonglong extent_pos;
+static ulong extent_len, extent_pages;
+static long long extent_src;	/* dumpfile offset if zero-copy, or -1 */
+
+static ulonglong
+byte_to_page(ulonglong i_size)
+{
+	return (i_size / PAGESIZE()) + ((i_size % PAGESIZE()) ? 1 : 0);
+}
 
+/*
+ * Get the physical address, page index and number of pages of a page cache
+ * entry, which can be a large folio.  A large folio is stored with sibling
+ * entries and passed once, but older kernels stored the head page (4.20 and
+ * later) or the tail pages (4.19 and older) of a THP at each index, so *nr
+ * is set to 0 for an entry covered by the last folio.  Entries are passed
+ * in index order, and folio_next must be reset for each file.
+ */
 static int
-dump_slot(ulong slot)
+get_folio(ulong slot, physaddr_t *phys, ulong *index, ulong *nr)
 {
-	physaddr_t phys;
-	ulong index, pos, size;
+	ulong head, page_flags;
+	unsigned char order = 0;
 
-	if (!is_page_ptr(slot, &phys))
+	if (!is_page_ptr(slot, phys))
 		return FALSE;
 
-	if (!readmem(slot + OFFSET(page_index), KVADDR, &index,
+	head = slot;
+	if (CU_VALID_MEMBER(page_compound_head)) {
+		if (!readmem(slot + CU_OFFSET(page_compound_head), KVADDR,
+		    &head, sizeof(ulong), "page.compound_head",
+		    RETURN_ON_ERROR))
+			return FALSE;
+		head = (head & 1) ? head - 1 : slot;
+	}
+
+	if (!readmem(head + OFFSET(page_index), KVADDR, index,
 	    sizeof(ulong), "page.index", RETURN_ON_ERROR))
 		return FALSE;
 
-	/*
-	 * If the page content was excluded by makedumpfile,
-	 * skip it quietly.
-	 */
-	if (!readmem(phys, PHYSADDR, pgbuf,
-	    PAGESIZE(), "page content", RETURN_ON_ERROR|QUIET)) {
-		nr_excluded++;
+	if (head != slot) {
+		*index += (slot - head) / SIZE(page);
+		*nr = 1;
+	} else {
+		if (pg_head_bit >= 0 && readmem(head + OFFSET(page_flags),
+		    KVADDR, &page_flags, sizeof(ulong), "page.flags",
+		    RETURN_ON_ERROR) && (page_flags & (1UL << pg_head_bit))) {
+			/* The order is in the lowest byte of each. */
+			if (CU_VALID_MEMBER(folio_folio_order))
+				readmem(head + CU_OFFSET(folio_folio_order),
+					KVADDR, &order, 1, "folio._folio_order",
+					RETURN_ON_ERROR);
+			else if (CU_VALID_MEMBER(page_compound_order))
+				readmem(head + SIZE(page) +
+					CU_OFFSET(page_compound_order), KVADDR,
+					&order, 1, "page.compound_order",
+					RETURN_ON_ERROR);
+			else if (CU_VALID_MEMBER(folio_flags_1))
+				readmem(head + CU_OFFSET(folio_flags_1),
+					KVADDR, &order, 1, "folio._flags_1",
+					RETURN_ON_ERROR);
+			if (order >= BITS_PER_LONG - PAGESHIFT())
+				order = 0;
+		}
+		*nr = 1UL << order;
+	}
+
+	if (*index < folio_next) {
+		*nr = 0;
 		return TRUE;
 	}
+	folio_next = *index + *nr;
+	nr_cached += *nr;
 
-	pos = index * PAGESIZE();
-	size = (pos + PAGESIZE()) > out_size ? out_size - pos : PAGESIZE();
+	return TRUE;
+}
+
+/*
+ * Call func for each page of a page cache entry below out_size.
+ */
+static int
+for_each_folio_page(ulong slot, int (*func)(physaddr_t, ulong))
+{
+	physaddr_t phys;
+	ulong index, nr, i;
 
-	if (!(flags & DUMP_DONT_SEEK))
-		fseek(outfp, pos, SEEK_SET);
+	if (!get_folio(slot, &phys, &index, &nr))
+		return FALSE;
 
-	if (fwrite(pgbuf, sizeof(char), size, outfp) == size)
-		nr_written++;
-	else if (errno != EPIPE || CRASHDEBUG(1))
-		error(INFO, "%lx: write error: %s\n", slot, strerror(errno));
+	for (i = 0; i < nr; i++) {
+		if ((ulonglong)(index + i) * PAGESIZE() >= out_size)
+			break;
+		func(phys + (physaddr_t)i * PAGESIZE(), index + i);
+	}
 
 	return TRUE;
 }
 
-static void
-set_mtime(char *dst, struct timespec i_mtime)
-{
-	struct timespec ts[2];
+/*
+ * Range-limited walk of the page cache tree for ccat -o/-l/-T/-t: only the
+ * nodes covering the index range are read, in ascending or descending
+ * order.  The xa_node and radix_tree_node (4.7 and later) have the same
+ * layout, and older radix trees are walked with crash's functions.  func
+ * can set walk.stop to end the walk.
+ */
+#define WALK_SKIP	(0)
+#define WALK_PAGE	(1)
+#define WALK_NODE	(2)
+
+#define RADIX_TREE_RETRY_ENTRY	(1)	/* an internal entry without node */
+
+static struct {
+	long node_size;
+	ulong nr_slots;
+	ulong first, last;
+	int reverse, stop;
+	int (*func)(ulong);
+	ulong count;
+	ulong *list;		/* for a reverse walk by crash */
+	ulong nr_list, max_list;
+} walk;
 
-	ts[0].tv_nsec = UTIME_OMIT; /* do not set atime */
-	ts[1] = i_mtime;
+/*
+ * Returns the type of a slot entry in the node at node_addr, and the
+ * address of the child node or the canonical entry of a sibling.
+ */
+static int
+walk_entry_type(ulong entry, ulong node_addr, char *node_buf, ulong *ret)
+{
+	ulong slots = node_addr + CU_OFFSET(xa_node_slots);
+
+	if (env_flags & XARRAY) {
+		if ((entry & 3) != 2)
+			return (entry & 1) ? WALK_SKIP : WALK_PAGE; /* value */
+		if (entry > 4096) {
+			*ret = entry - 2;
+			return WALK_NODE;
+		}
+		if ((entry >> 2) >= walk.nr_slots || !node_buf)
+			return WALK_SKIP;	/* retry or zero entry */
+		entry = ULONG(node_buf + CU_OFFSET(xa_node_slots) +
+			sizeof(ulong) * (entry >> 2));
+	} else {
+		if ((entry & 2) || entry == RADIX_TREE_RETRY_ENTRY)
+			return WALK_SKIP;	/* exceptional or retry */
+		if (!(entry & 1))
+			return WALK_PAGE;
+		if (!node_buf || entry - 1 < slots ||
+		    entry - 1 >= slots + sizeof(ulong) * walk.nr_slots) {
+			*ret = entry - 1;
+			return WALK_NODE;
+		}
+		entry = ULONG(node_buf + CU_OFFSET(xa_node_slots) +
+			(entry - 1 - slots));
+	}
 
-	if (CRASHDEBUG(1))
-		fprintf(fp, "set mtime %s\n", dst);
+	/* a sibling: the canonical entry has the folio */
+	if (!entry || (entry & 3))
+		return WALK_SKIP;
+	*ret = entry;
 
-	if (utimensat(AT_FDCWD, dst, ts, 0) < 0)
-		error(INFO, "%s: cannot set mtime: %s\n", dst, strerror(errno));
+	return WALK_PAGE;
 }
 
 static void
-dump_file(char *src, char *dst, ulong i_mapping, ulonglong i_size,
-	struct timespec i_mtime)
+walk_node(ulong node_addr, ulong base)
 {
-	struct list_pair lp;
-	ulong root, count;
+	char *node_buf;
+	ulong shift, entry, child, start, end, i, n;
+	int type;
+
+	node_buf = GETBUF(walk.node_size);
+	if (!readmem(node_addr, KVADDR, node_buf, walk.node_size,
+	    "xa_node", RETURN_ON_ERROR))
+		goto out;
+
+	shift = UCHAR(node_buf + CU_OFFSET(xa_node_shift));
+
+	for (n = 0; n < walk.nr_slots && !walk.stop; n++) {
+		i = walk.reverse ? walk.nr_slots - 1 - n : n;
+		start = base + (i << shift);
+		end = start + (1UL << shift) - 1;
+		if (end < walk.first || start > walk.last)
+			continue;
 
-	if (dst) {
-		if ((outfp = fopen(dst, "w")) == NULL) {
-			error(INFO, "%s: cannot open: %s\n",
-				dst, strerror(errno));
-			return;
-		}
-		set_tmpfile2(outfp);
-	} else
-		outfp = fp;
+		entry = ULONG(node_buf + CU_OFFSET(xa_node_slots) +
+			sizeof(ulong) * i);
+		if (!entry)
+			continue;
 
-	root = i_mapping + OFFSET(address_space_page_tree);
-	lp.value = dump_slot;
-	out_size = i_size;
-	nr_written = nr_excluded = 0;
+		type = walk_entry_type(entry, node_addr, node_buf, &child);
+		if (type == WALK_NODE)
+			walk_node(child, start);
+		else if (type == WALK_PAGE) {
+			walk.count++;
+			walk.func((entry & 3) ? child : entry);
+		}
+	}
+out:
+	FREEBUF(node_buf);
+}
 
-	if (env_flags & XARRAY)
-		count = do_xarray(root, XARRAY_DUMP_CB, &lp);
-	else
-		count = do_radix_tree(root, RADIX_TREE_DUMP_CB, &lp);
+/*
+ * crash's walk cannot be stopped, so the rest of the entries are ignored.
+ */
+static int
+walk_call(ulong entry)
+{
+	if (!walk.stop)
+		walk.func(entry);
 
-	if (!(flags & DUMP_DONT_SEEK))
-		ftruncate(fileno(outfp), i_size);
+	return TRUE;
+}
 
-	if (outfp != fp) {
-		close_tmpfile2();
-		set_mtime(dst, i_mtime);
+static int
+walk_collect(ulong entry)
+{
+	if (walk.nr_list == walk.max_list) {
+		walk.max_list = walk.max_list ? walk.max_list * 2 : 1024;
+		walk.list = realloc(walk.list, sizeof(ulong) * walk.max_list);
+		if (!walk.list)
+			error(FATAL, "cannot allocate entry list\n");
 	}
+	walk.list[walk.nr_list++] = entry;
 
-	if (nr_excluded)
-		error(INFO, "%s: %lu/%lu pages excluded\n",
-			src, nr_excluded, count);
-	if (CRASHDEBUG(1))
-		error(INFO, "%s: %lu/%lu pages written\n",
-			src, nr_written, count);
+	return TRUE;
 }
 
 /*
- * NOTE: If alloc is 0, do not strdup() and no need to free(), but
- * need to copy the name if we want to get another dentry's name with
- * this function before consuming the former one.
+ * Call func for the page cache entries which can have the pages of the
+ * index range from first to last.  Entries are passed in ascending order,
+ * or descending order if reverse is set.
  */
-static char *
-get_dentry_name(ulong dentry, char *dentry_buf, int alloc)
+static ulong
+walk_page_cache(ulong i_mapping, ulong first, ulong last, int reverse,
+	int (*func)(ulong))
 {
-	ulong d_name_name, d_name_len, d_iname;
-	static char name[NAME_MAX+1];
-	static char unknown[] = "(unknown)";
-	char *name_addr;
-
-	BZERO(name, sizeof(name));
+	struct list_pair lp;
+	ulong root, entry, node, i;
 
-	d_name_name = ULONG(dentry_buf + OFFSET(dentry_d_name)
-					+ OFFSET(qstr_name));
-	d_name_len = UINT(dentry_buf + OFFSET(dentry_d_name)
-					+ OFFSET(qstr_len));
-	d_iname = dentry + OFFSET(dentry_d_iname);
+	root = i_mapping + OFFSET(address_space_page_tree);
+	walk.first = first;
+	walk.last = last;
+	walk.reverse = reverse;
+	walk.func = func;
+	walk.stop = FALSE;
+	walk.count = 0;
+
+	if (!walk.node_size) {
+		/* crash's walk of all entries */
+		lp.value = reverse ? walk_collect : walk_call;
+		walk.nr_list = 0;
+		if (env_flags & XARRAY)
+			walk.count = do_xarray(root, XARRAY_DUMP_CB, &lp);
+		else
+			walk.count = do_radix_tree(root, RADIX_TREE_DUMP_CB, &lp);
+
+		for (i = walk.nr_list; i > 0 && !walk.stop; i--)
+			func(walk.list[i-1]);
+		free(walk.list);
+		walk.list = NULL;
+		walk.max_list = 0;
+		return walk.count;
+	}
 
-	/*
-	 * d_name.name and d_iname are guaranteed NUL-terminated.
-	 * See d_alloc() in the kernel.
-	 */
-	if (d_name_name == d_iname)
-		name_addr = dentry_buf + OFFSET(dentry_d_iname);
-	else if (readmem(d_name_name, KVADDR, name, d_name_len + 1,
-			"dentry.d_name.name", RETURN_ON_ERROR))
-		name_addr = name;
-	else
-		name_addr = unknown;
+	if (!readmem(root + CU_OFFSET(xarray_xa_head), KVADDR, &entry,
+	    sizeof(ulong), "xa_head", RETURN_ON_ERROR) || !entry)
+		return 0;
 
-	/*
-	 * the number of malloc() via GETBUF() is limited to
-	 * MAX_MALLOC_BUFS(2000), so require strdup() here.
-	 */
-	if (alloc)
-		name_addr = strdup(name_addr);
+	switch (walk_entry_type(entry, 0, NULL, &node))
+	{
+	case WALK_NODE:
+		walk_node(node, 0);
+		break;
+	case WALK_PAGE:
+		if (first == 0) {
+			walk.count++;
+			func(entry);
+		}
+		break;
+	}
 
-	return name_addr;
+	return walk.count;
 }
 
 static int
-get_inode_info(ulong inode, uint *i_mode, ulong *i_mapping,
-		ulonglong *i_size, ulong *nrpages, struct timespec *i_mtime)
+write_extent(int fd, char *buf, ulong len, ulonglong pos)
 {
-	char inode_buf[SIZE(inode)];
+	ssize_t ret;
 
-	if (!readmem(inode, KVADDR, inode_buf, SIZE(inode),
-	    "inode buffer", RETURN_ON_ERROR))
-		return FALSE;
-
-	if (i_mode) {
-		if (SIZE(umode_t) == SIZEOF_32BIT)
-			*i_mode = UINT(inode_buf + OFFSET(inode_i_mode));
-		else
-			*i_mode = USHORT(inode_buf + OFFSET(inode_i_mode));
-	}
-	if (i_mapping)
-		*i_mapping = ULONG(inode_buf + OFFSET(inode_i_mapping));
-	if (i_size)
-		*i_size = ULONGLONG(inode_buf + CU_OFFSET(inode_i_size));
-	if (nrpages) {
-		if (!readmem(*i_mapping + OFFSET(address_space_nrpages),
-		    KVADDR, nrpages, sizeof(ulong), "i_mapping.nrpages",
-		    RETURN_ON_ERROR))
+	while (len) {
+		ret = pwrite(fd, buf, len, pos);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
 			return FALSE;
-	}
-	if (i_mtime) {
-		/*
-		 * There are some dirty assumptions and kludges here
-		 * for some reason I can't explain :)
-		 */
-		if (CU_VALID_MEMBER(inode_i_mtime_sec)) {
-			/* time64_t: long long */
-			i_mtime->tv_sec = (long long)ULONGLONG(inode_buf + CU_OFFSET(inode_i_mtime_sec));
-			/* u32: unsigned int */
-			i_mtime->tv_nsec = (long)UINT(inode_buf + CU_OFFSET(inode_i_mtime_nsec));
-		} else if (env_flags & TIMESPEC64) {
-			i_mtime->tv_sec = (long)ULONGLONG(inode_buf
-						+ CU_OFFSET(inode_i_mtime));
-			i_mtime->tv_nsec = LONG(inode_buf
-						+ CU_OFFSET(inode_i_mtime)
-						+ sizeof(long long));
-		} else {
-			i_mtime->tv_sec = LONG(inode_buf
-						+ CU_OFFSET(inode_i_mtime));
-			i_mtime->tv_nsec = LONG(inode_buf
-						+ CU_OFFSET(inode_i_mtime)
-						+ sizeof(long));
 		}
+		buf += ret;
+		len -= ret;
+		pos += ret;
 	}
 
 	return TRUE;
 }
 
-static ulong *
-get_subdirs_list(int *cntptr, ulong dentry)
-{
-	struct list_data list_data, *ld;
-	ulong d_subdirs, child;
-
-	d_subdirs = dentry + (CU_INVALID_MEMBER(dentry_d_subdirs) ?
-			CU_OFFSET(dentry_d_children) : CU_OFFSET(dentry_d_subdirs));
-
-	if (!readmem(d_subdirs, KVADDR, &child, sizeof(ulong),
-	    "dentry.d_subdirs", RETURN_ON_ERROR))
-		return NULL;
+/*
+ * Journal for ccat -d -r: the files completely written and checkpoints of
+ * the file being written are appended to "<outdir>.ccat-journal", so that
+ * an interrupted extraction can be resumed without reading the pages that
+ * were already written.  Pages are written in index order, so a checkpoint
+ * is the index below which all pages were written.
+ *
+ *   cacheutils-journal 1 <abspath>
+ *   F <size> <mtime> <path>    completed file
+ *   C <index> <path>           pages below index written
+ *
+ * The journal is removed when the extraction completes.
+ */
+#define JOURNAL_MAGIC		"cacheutils-journal 1"
+#define JOURNAL_SUFFIX		".ccat-journal"
+#define JOURNAL_CKPT_PAGES	(32768)
 
-	if (!child || d_subdirs == child)
-		return NULL;
+typedef struct {
+	char *path;
+	int done;
+	ulonglong size;
+	struct timespec mtime;
+	ulong index;
+} journal_ent_t;
+
+static struct {
+	FILE *ofp;
+	char path[PATH_MAX];
+	journal_ent_t *table;
+	ulong nr_ents, size;
+	char *cur;		/* the file being written */
+	ulong start;		/* the index to resume cur from */
+	ulong nr_pages;		/* since the last checkpoint */
+	int failed;		/* a write to cur failed */
+	ulong nr_failed, nr_skipped;
+} journal;
+
+static void hash128(void *data, ulong len, ulonglong *out);
+
+static journal_ent_t *
+journal_lookup(char *path)
+{
+	ulonglong hash[2];
+	ulong i;
+	journal_ent_t *e;
+
+	hash128(path, strlen(path), hash);
+	for (i = hash[0] & (journal.size - 1); ;
+	     i = (i + 1) & (journal.size - 1)) {
+		e = &journal.table[i];
+		if (!e->path || STREQ(e->path, path))
+			return e;
+	}
+}
 
-	ld = &list_data;
-	BZERO(ld, sizeof(struct list_data));
-	ld->flags |= (LIST_ALLOCATE|RETURN_ON_LIST_ERROR);
-	ld->start = child;
-	ld->end = d_subdirs;
-	ld->list_head_offset = CU_INVALID_MEMBER(dentry_d_child) ?
-			CU_OFFSET(dentry_d_sib) : CU_OFFSET(dentry_d_child);
+static journal_ent_t *
+journal_insert(char *path)
+{
+	journal_ent_t *old, *e;
+	ulong i, old_size;
+
+	if ((journal.nr_ents + 1) * 2 > journal.size) {
+		old = journal.table;
+		old_size = journal.size;
+		journal.size = journal.size ? journal.size * 2 : 1024;
+		if (!(journal.table = calloc(journal.size, sizeof(journal_ent_t))))
+			error(FATAL, "cannot allocate journal table\n");
+		for (i = 0; i < old_size; i++) {
+			if (old[i].path)
+				*journal_lookup(old[i].path) = old[i];
+		}
+		free(old);
+	}
 
-	if (CRASHDEBUG(3))
-		ld->flags |= VERBOSE;
+	e = journal_lookup(path);
+	if (!e->path) {
+		e->path = strdup(path);
+		journal.nr_ents++;
+	}
 
-	if ((*cntptr = do_list(ld)) == -1)
-		return NULL;
+	return e;
+}
 
-	return ld->list_ptr;
+static void
+journal_close(void)
+{
+	ulong i;
+
+	if (journal.ofp)
+		fclose(journal.ofp);
+	for (i = 0; i < journal.size; i++)
+		free(journal.table[i].path);
+	free(journal.table);
+	BZERO(&journal, sizeof(journal));
 }
 
-static char *
-get_type_indicator(uint i_mode, ulong inode)
+static int
+journal_load(char *src)
 {
-	static char c[2] = {'\0', '\0'};
-	static char link[PATH_MAX] = {' ', '-', '>', ' '};
+	FILE *in;
+	char *line = NULL, *p;
+	size_t linesz = 0;
+	ssize_t len;
+	int n, ret = FALSE;
+	ulonglong size;
+	ulong index;
+	struct timespec mtime;
+	journal_ent_t *e;
+
+	if ((in = fopen(journal.path, "r")) == NULL) {
+		if (errno == ENOENT)
+			return TRUE;
+		error(INFO, "%s: cannot open: %s\n", journal.path,
+			strerror(errno));
+		return FALSE;
+	}
 
-	if (S_ISREG(i_mode)) {
-		if (i_mode & (S_IXUSR|S_IXGRP|S_IXOTH))
-			*c = '*';
-		else
-			*c = '\0';
-	} else if (S_ISDIR(i_mode))
-		*c = '/';
-	else if (S_ISLNK(i_mode)) {
-		ulong i_link;
-		if ((flags & SHOW_INFO_LONG) && CU_VALID_MEMBER(inode_i_link) &&
-		    readmem(inode + CU_OFFSET(inode_i_link), KVADDR, &i_link,
-				sizeof(ulong), "inode.i_link", RETURN_ON_ERROR) &&
-		    i_link && read_string(i_link, link+4, PATH_MAX-4))
-			return link;
-		*c = '@';
-	} else if (S_ISFIFO(i_mode))
-		*c = '|';
-	else if (S_ISSOCK(i_mode))
-		*c = '=';
-	else
-		*c = '\0';
+	if ((len = getline(&line, &linesz, in)) <= 0 ||
+	    !STRNEQ(line, JOURNAL_MAGIC " ")) {
+		error(INFO, "%s: not a journal\n", journal.path);
+		goto out;
+	}
+	if (line[len-1] == '\n')
+		line[len-1] = '\0';
+	p = line + strlen(JOURNAL_MAGIC " ");
+	if (!STREQ(p, src)) {
+		error(INFO, "%s: journal of %s, not %s\n", journal.path, p, src);
+		goto out;
+	}
 
-	return c;
+	/* A partial line at the end is ignored. */
+	while ((len = getline(&line, &linesz, in)) > 0) {
+		if (line[len-1] != '\n')
+			break;
+		line[len-1] = '\0';
+
+		if (sscanf(line, "F %llu %ld.%ld %n", &size, &mtime.tv_sec,
+		    &mtime.tv_nsec, &n) == 3) {
+			e = journal_insert(line + n);
+			e->done = TRUE;
+			e->size = size;
+			e->mtime = mtime;
+		} else if (sscanf(line, "C %lu %n", &index, &n) == 1) {
+			e = journal_insert(line + n);
+			e->index = index;
+		}
+	}
+	ret = TRUE;
+out:
+	free(line);
+	fclose(in);
+
+	return ret;
 }
 
-#define TIME_LEN	30
-static char *
-get_strtime(struct timespec *ts)
+static int
+journal_open(char *src, char *dst)
 {
-	static char buf[TIME_LEN];
-	static char na[2] = {'-', '\0'};
-	size_t ret;
+	snprintf(journal.path, PATH_MAX, "%s%s", dst, JOURNAL_SUFFIX);
 
-	ret = strftime(buf, TIME_LEN, "%F.%T", localtime(&ts->tv_sec));
-	if (!ret)
-		return na;
+	if (!journal_load(src))
+		return FALSE;
 
-	ret = snprintf(buf + ret, TIME_LEN - ret, ".%09ld", ts->tv_nsec);
-	if (ret < 0)
-		return na;
+	if ((journal.ofp = fopen(journal.path, "a")) == NULL) {
+		error(INFO, "%s: cannot open: %s\n", journal.path,
+			strerror(errno));
+		return FALSE;
+	}
+	if (ftell(journal.ofp) == 0)
+		fprintf(journal.ofp, "%s %s\n", JOURNAL_MAGIC, src);
+	fflush(journal.ofp);
 
-	return buf;
+	return TRUE;
 }
 
-static ulonglong
-byte_to_page(ulonglong i_size)
+/*
+ * Returns TRUE if the file was completed, otherwise sets the index to
+ * resume it from.
+ */
+static int
+journal_check(char *dst, ulonglong i_size, struct timespec i_mtime)
 {
-	return (i_size / PAGESIZE()) + ((i_size % PAGESIZE()) ? 1 : 0);
-}
+	journal_ent_t *e;
 
-static int
-calc_cached_percent(ulong nrpages, ulonglong i_size)
-{
-	if (!i_size)
-		return 0;
+	journal.cur = dst;
+	journal.start = journal.nr_pages = 0;
+	journal.failed = FALSE;
 
-	return (nrpages * 100) / byte_to_page(i_size);
-}
+	if (!journal.nr_ents)
+		return FALSE;
 
-typedef struct {
-	ulong dentry;
-	char *name;
-	ulong inode;
-	ulong i_mapping;
-	ulonglong i_size;
-	ulong nrpages;
-	uint i_mode;
-	int d_unhashed;
-	struct timespec i_mtime;
-} inode_info_t;
+	e = journal_lookup(dst);
+	if (!e->path)
+		return FALSE;
 
-static int
-sort_by_name(const void *arg1, const void *arg2)
-{
-	inode_info_t *p = (inode_info_t *)arg1;
-	inode_info_t *q = (inode_info_t *)arg2;
+	if (e->done && e->size == i_size &&
+	    e->mtime.tv_sec == i_mtime.tv_sec &&
+	    e->mtime.tv_nsec == i_mtime.tv_nsec) {
+		journal.nr_skipped++;
+		return TRUE;
+	}
+	journal.start = e->index;
 
-	/*
-	 * NOTE: To sort files like ls command, strcoll(3) should be used,
-	 * but since the crash utility doesn't call setlocale(LC_ALL, ""),
-	 * it doesn't work according to the environment variables.
-	 */
-	return strcmp(p->name, q->name);
+	return FALSE;
 }
 
-static int
-sort_by_mtime(const void *arg1, const void *arg2)
+/* called by the writer thread as well */
+static void
+journal_done(char *dst, ulonglong i_size, struct timespec i_mtime)
 {
-	struct timespec *p = &((inode_info_t *)arg1)->i_mtime;
-	struct timespec *q = &((inode_info_t *)arg2)->i_mtime;
+	fprintf(journal.ofp, "F %llu %ld.%09ld %s\n", i_size,
+		i_mtime.tv_sec, i_mtime.tv_nsec, dst);
+	fflush(journal.ofp);
+}
 
-	/* newest first */
-	if (p->tv_sec == q->tv_sec)
-		return q->tv_nsec - p->tv_nsec;
+/*
+ * Asynchronous writer for ccat -w: filled extent buffers are queued to a
+ * bounded ring and written by a writer thread, so that reading the vmcore
+ * and writing the output overlap.  The writer thread never calls crash's
+ * functions, errors are recorded and reported by writer_stop().  The pages
+ * are counted when their writes complete, see writer_written().
+ */
+#define WRITER_RING_SIZE	(8)
 
-	return q->tv_sec - p->tv_sec;
-}
+#define WJ_WRITE	(1)
+#define WJ_CLOSE	(2)
+#define WJ_COPY		(3)	/* zero-copy from the dumpfile */
+
+typedef struct {
+	int type;
+	int fd;
+	char *buf;
+	ulong len;
+	ulonglong pos;		/* WJ_WRITE, WJ_COPY: offset, WJ_CLOSE: size */
+	long long src;		/* WJ_COPY: offset in the dumpfile */
+	ulong pages;		/* WJ_WRITE, WJ_COPY: pages in the extent */
+	struct timespec mtime;
+	char *path;
+	ulonglong size;		/* WJ_CLOSE: to be journaled, or -1 */
+} writer_job_t;
+
+static struct writer {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t queued, done;
+	writer_job_t ring[WRITER_RING_SIZE];
+	int head, count;
+	char *bufs[WRITER_RING_SIZE+1];
+	char *free_bufs[WRITER_RING_SIZE+1];
+	int nr_free;
+	char *copy_buf;		/* for WJ_COPY without zero-copy */
+	int running, stop;
+	int open_fd;		/* opened, but WJ_CLOSE not queued yet */
+	int file_failed;	/* a write to the open file failed */
+	ulong nr_written, nr_failed;	/* pages */
+	ulong nr_errors;
+	int first_errno, error_fd;
+	char first_error[PATH_MAX];
+} writer = { .open_fd = -1 };
 
 static void
-show_subdirs_info(ulong dentry, char *src)
+writer_error(writer_job_t *job, int err)
 {
-	ulong *list;
-	int i, count;
-	ulong d, inode, i_mapping, nrpages;
-	uint i_mode;
-	ulonglong i_size;
-	inode_info_t *inode_list, *p;
-	struct timespec i_mtime;
-
-	if (!(list = get_subdirs_list(&count, dentry)))
-		return;
+	/* called with writer.lock held */
+	if (err && !writer.nr_errors++) {
+		writer.first_errno = err;
+		writer.error_fd = job->fd;
+	}
+	/* The path of a write job is known when its file is closed. */
+	if (job->path && job->fd == writer.error_fd && !writer.first_error[0])
+		snprintf(writer.first_error, PATH_MAX, "%s", job->path);
+}
 
-	inode_list = (inode_info_t *)GETBUF(sizeof(inode_info_t) * count);
-	BZERO(inode_list, sizeof(inode_info_t) * count);
+static int copy_extent(int fd, long long src, ulong len, ulonglong pos,
+	char *buf);
 
-	for (i = 0, p = inode_list; i < count; i++) {
-		d = list[i];
-		if (!readmem(d, KVADDR, dentry_data, SIZE(dentry),
-		    "dentry buffer", RETURN_ON_ERROR))
-			continue;
+static void *
+writer_main(void *arg)
+{
+	writer_job_t job;
+	struct timespec ts[2];
+	int err;
 
-		inode = ULONG(dentry_data + OFFSET(dentry_d_inode));
-		if (inode && get_inode_info(inode, &i_mode, &i_mapping,
-					&i_size, &nrpages, &i_mtime)) {
-			p->inode = inode;
-			p->i_mapping = i_mapping;
-			p->i_size = i_size;
-			p->nrpages = nrpages;
-			p->i_mode = i_mode;
-			p->i_mtime = i_mtime;
-		} else {
-			p->i_mapping = 0;
-			if (!(flags & SHOW_INFO_NEG_DENTS))
-				continue;
+	while (TRUE) {
+		pthread_mutex_lock(&writer.lock);
+		while (!writer.count && !writer.stop)
+			pthread_cond_wait(&writer.queued, &writer.lock);
+		if (!writer.count) {
+			pthread_mutex_unlock(&writer.lock);
+			break;
 		}
-		p->dentry = d;
-		p->name = get_dentry_name(d, dentry_data, 1);
-		/* unfinished dentry */
-		p->d_unhashed = !ULONG(dentry_data + CU_OFFSET(dentry_d_hash) +
-					CU_OFFSET(hlist_bl_node_pprev));
-		p++;
-	}
-	count = p - inode_list;
-
-	if (!(flags & SHOW_INFO_DONT_SORT))
-		qsort(inode_list, count, sizeof(inode_info_t),
-			(flags & SHOW_INFO_SORT_MTIME) ?
-				sort_by_mtime : sort_by_name);
-
-	for (i = 0, p = inode_list; i < count; i++, p++) {
-		if (p->i_mapping) {
-			int pct = calc_cached_percent(p->nrpages, p->i_size);
-
-			if (flags & SHOW_INFO_LONG) {
-				fprintf(fp, dentry_lfmt, p->dentry, p->inode,
-					p->nrpages, pct, p->i_mode, p->i_size,
-					get_strtime(&p->i_mtime), p->name,
-					get_type_indicator(p->i_mode, p->inode));
-				if (CRASHDEBUG(1))
-					fprintf(fp,
-				    "  i_mapping:%-16lx i_mtime:%ld.%09ld\n",
-						p->i_mapping, p->i_mtime.tv_sec,
-						p->i_mtime.tv_nsec);
-			} else {
-				fprintf(fp, dentry_fmt, p->dentry, p->inode,
-					p->nrpages, pct, p->name,
-					get_type_indicator(p->i_mode, p->inode));
-				if (CRASHDEBUG(1))
-					fprintf(fp, "  i_mapping:%-16lx\n",
-						p->i_mapping);
+		job = writer.ring[writer.head];
+		pthread_mutex_unlock(&writer.lock);
+
+		err = 0;
+		if (job.type == WJ_WRITE) {
+			if (!write_extent(job.fd, job.buf, job.len, job.pos)) {
+				err = errno;
+				writer.file_failed = TRUE;
 			}
+		} else if (job.type == WJ_COPY) {
+			if (!copy_extent(job.fd, job.src, job.len, job.pos,
+			    writer.copy_buf)) {
+				err = errno;
+				writer.file_failed = TRUE;
+			}
+		} else {
+			if (job.pos != (ulonglong)-1 &&
+			    ftruncate(job.fd, job.pos) < 0)
+				err = errno;
+			if (close(job.fd) < 0 && !err)
+				err = errno;
+			ts[0].tv_nsec = UTIME_OMIT;
+			ts[1] = job.mtime;
+			if (job.path &&
+			    utimensat(AT_FDCWD, job.path, ts, 0) < 0 && !err)
+				err = errno;
+			if (job.size != (ulonglong)-1 && !err &&
+			    !writer.file_failed)
+				journal_done(job.path, job.size, job.mtime);
+			writer.file_failed = FALSE;
+		}
 
-		} else if (flags & SHOW_INFO_NEG_DENTS) {
-			char buf[NAME_MAX+3]; /* brackets and null byte */
-			char *name;
-			if (p->d_unhashed) {
-				snprintf(buf, sizeof(buf), "(%s)", p->name);
-				name = buf;
-			} else
-				name = p->name;
-
-			if (flags & SHOW_INFO_LONG)
-				fprintf(fp, negdent_lfmt, p->dentry, "-",
-					"-", "-", "-", "-", "-", name);
+		pthread_mutex_lock(&writer.lock);
+		if (err || job.fd == writer.error_fd)
+			writer_error(&job, err);
+		if (job.type != WJ_CLOSE) {
+			if (err)
+				writer.nr_failed += job.pages;
 			else
-				fprintf(fp, negdent_fmt, p->dentry, "-",
-					"-", "-", name);
+				writer.nr_written += job.pages;
 		}
-
-		if (!(flags & SHOW_INFO_RECURSIVE))
-			free(p->name);	/* still needed below */
+		if (job.buf)
+			writer.free_bufs[writer.nr_free++] = job.buf;
+		writer.head = (writer.head + 1) % WRITER_RING_SIZE;
+		writer.count--;
+		pthread_cond_signal(&writer.done);
+		pthread_mutex_unlock(&writer.lock);
+
+		free(job.path);
 	}
 
-	if (flags & SHOW_INFO_RECURSIVE) {
-		char path[PATH_MAX];
-		char *slash = (src[1] == '\0') ? "" : "/";
+	return NULL;
+}
+
+static void
+writer_submit(writer_job_t *job)
+{
+	pthread_mutex_lock(&writer.lock);
+	while (writer.count == WRITER_RING_SIZE)
+		pthread_cond_wait(&writer.done, &writer.lock);
+	writer.ring[(writer.head + writer.count) % WRITER_RING_SIZE] = *job;
+	writer.count++;
+	pthread_cond_signal(&writer.queued);
+	pthread_mutex_unlock(&writer.lock);
+}
 
-		for (i = 0, p = inode_list; i < count; i++, p++) {
-			if (S_ISDIR(p->i_mode)) {
-				snprintf(path, PATH_MAX, "%s%s%s",
-					src, slash, p->name);
-				fprintf(fp, "\n%s:\n", path);
+static char *
+writer_get_buf(void)
+{
+	char *buf;
 
-				d = get_mntpoint_dentry(path, NULL);
-				if (!d)
-					d = p->dentry;
+	pthread_mutex_lock(&writer.lock);
+	while (!writer.nr_free)
+		pthread_cond_wait(&writer.done, &writer.lock);
+	buf = writer.free_bufs[--writer.nr_free];
+	pthread_mutex_unlock(&writer.lock);
 
-				show_subdirs_info(d, path);
-			}
+	return buf;
+}
 
-			free(p->name);
-		}
-	}
+static void
+writer_drain(void)
+{
+	if (!writer.running)
+		return;
 
-	FREEBUF(inode_list);
-	FREEBUF(list);
+	pthread_mutex_lock(&writer.lock);
+	while (writer.count)
+		pthread_cond_wait(&writer.done, &writer.lock);
+	pthread_mutex_unlock(&writer.lock);
 }
 
 /*
- * If remaining_path is NULL, search for a mount point that matches exactly
- * with the path.
+ * The pages written by the writer thread so far, after the queued jobs
+ * complete.  The pages whose writes failed are reported.
  */
 static ulong
-get_mntpoint_dentry(char *path, char **remaining_path)
+writer_written(void)
 {
-	ulong *mount_list;
-	int i;
-	size_t len;
-	char *mount_buf, *path_buf, *path_start, *slash_pos;
-	char buf[PATH_MAX], *bufp = buf;
-	ulong root, parent, mountp;
-	long size;
+	ulong nr_failed;
 
-	size = VALID_STRUCT(mount) ? SIZE(mount) : SIZE(vfsmount);
-	if (!mount_data) {
-		mount_list = get_mount_list(&mount_count, tc);
-		mount_data = GETBUF(size * mount_count);
-		mount_path = (char **)GETBUF(sizeof(char *) * mount_count);
-
-		for (i = 0; i < mount_count; i++) {
-			if (!readmem(mount_list[i], KVADDR, mount_data +
-			    (size * i), size, "(vfs)mount buffer",
-			    RETURN_ON_ERROR)) {
-				FREEBUF(mount_list);
-				goto bail_out;
-			}
+	writer_drain();
 
-			mount_buf = mount_data + (size * i);
+	pthread_mutex_lock(&writer.lock);
+	nr_failed = writer.nr_failed;
+	writer.nr_failed = 0;
+	pthread_mutex_unlock(&writer.lock);
 
-			if (VALID_STRUCT(mount)) {
-				parent = ULONG(mount_buf +
-					OFFSET(mount_mnt_parent));
-				mountp = ULONG(mount_buf +
-					OFFSET(mount_mnt_mountpoint));
-				get_pathname(mountp, bufp, PATH_MAX, 1,
-					parent + OFFSET(mount_mnt));
-			} else {
-				parent = ULONG(mount_buf +
-					OFFSET(vfsmount_mnt_parent));
-				mountp = ULONG(mount_buf +
-					OFFSET(vfsmount_mnt_mountpoint));
-				get_pathname(mountp, bufp, PATH_MAX, 1,
-					parent);
-			}
+	if (nr_failed)
+		error(INFO, "%lu pages not written\n", nr_failed);
 
-			len = strnlen(bufp, PATH_MAX);
-			mount_path[i] = GETBUF(len + 1);
-			memcpy(mount_path[i], bufp, len + 1);
-		}
-		FREEBUF(mount_list);
-	}
+	return writer.nr_written;
+}
 
-	len = strlen(path);
-	path_buf = GETBUF(len + 1);
-	memcpy(path_buf, path, len + 1);
+static void
+writer_start(void)
+{
+	int i;
 
-	path_start = path + len;
+	/* O_DIRECT requires aligned buffers, so don't use GETBUF(). */
+	for (i = 0; i < WRITER_RING_SIZE+1; i++) {
+		if (posix_memalign((void **)&writer.bufs[i], PAGESIZE(),
+		    EXTENT_BUFSIZE))
+			error(FATAL, "cannot allocate writer buffers\n");
+		writer.free_bufs[i] = writer.bufs[i];
+	}
+	if (posix_memalign((void **)&writer.copy_buf, PAGESIZE(),
+	    EXTENT_BUFSIZE))
+		error(FATAL, "cannot allocate writer buffers\n");
+	writer.nr_free = WRITER_RING_SIZE+1;
+	writer.head = writer.count = writer.stop = 0;
+	writer.nr_written = writer.nr_failed = 0;
+	writer.nr_errors = 0;
+	writer.error_fd = -1;
+	writer.first_error[0] = '\0';
+	writer.open_fd = -1;
+	writer.file_failed = FALSE;
+
+	pthread_mutex_init(&writer.lock, NULL);
+	pthread_cond_init(&writer.queued, NULL);
+	pthread_cond_init(&writer.done, NULL);
+
+	if (pthread_create(&writer.thread, NULL, writer_main, NULL))
+		error(FATAL, "cannot create writer thread\n");
+	writer.running = TRUE;
+
+	pgbuf = writer_get_buf();
+}
 
-	root = 0;
-	while (TRUE) {
-		for (i = 0; i < mount_count; i++) {
-			mount_buf = mount_data + (size * i);
-			bufp = mount_path[i];
+static void
+writer_stop(void)
+{
+	int i;
 
-			if (CRASHDEBUG(2))
-				error(INFO, "path:%s PATHEQ:%d mntp:%s\n",
-					path_buf, PATHEQ(path_buf, bufp), bufp);
-
-			if (PATHEQ(path_buf, bufp)) {
-				if (VALID_STRUCT(mount))
-					root = ULONG(mount_buf +
-						OFFSET(mount_mnt) +
-						CU_OFFSET(vfsmount_mnt_root));
-				else
-					root = ULONG(mount_buf +
-						CU_OFFSET(vfsmount_mnt_root));
-				/*
-				 * Probably the last one will be what we want,
-				 * so don't break here.
-				 */
-			}
-		}
-		if (root)
-			break;
+	if (!writer.running)
+		return;
 
-		if (!remaining_path) /* exact match for cfind */
-			break;
+	/* The queued jobs are completed before the thread exits. */
+	pthread_mutex_lock(&writer.lock);
+	writer.stop = TRUE;
+	pthread_cond_signal(&writer.queued);
+	pthread_mutex_unlock(&writer.lock);
+	pthread_join(writer.thread, NULL);
+	writer.running = FALSE;
+
+	if (writer.open_fd >= 0) {
+		close(writer.open_fd);
+		writer.open_fd = -1;
+	}
 
-		if ((slash_pos = strrchr(path_buf, '/')) == NULL)
-			break;
+	for (i = 0; i < WRITER_RING_SIZE+1; i++)
+		free(writer.bufs[i]);
+	free(writer.copy_buf);
+	writer.copy_buf = NULL;
+	pgbuf = NULL;
 
-		path_start = path + (slash_pos - path_buf) + 1;
+	if (writer.nr_errors)
+		error(INFO, "%lu write errors, the first one: %s: %s\n",
+			writer.nr_errors, writer.first_error,
+			strerror(writer.first_errno));
+}
 
-		if (slash_pos != path_buf)
-			*slash_pos = '\0';
-		else if (slash_pos == path_buf && *(slash_pos+1) != '\0')
-			*(slash_pos+1) = '\0';
-		else
-			break;
+static int
+writer_open(char *dst, int trunc)
+{
+	int fd, oflags = O_WRONLY|O_CREAT|(trunc ? O_TRUNC : 0);
+
+	if (flags & DUMP_DIRECT_IO)
+		oflags |= O_DIRECT;
+
+	fd = open(dst, oflags, 0666);
+	if (fd < 0 && errno == EINVAL && (oflags & O_DIRECT)) {
+		error(INFO, "%s: O_DIRECT not supported, "
+			"falling back to buffered writes\n", dst);
+		flags &= ~DUMP_DIRECT_IO;
+		oflags &= ~O_DIRECT;
+		fd = open(dst, oflags, 0666);
 	}
-	if (CRASHDEBUG(2))
-		error(INFO, "root_dentry:%lx path_start:%s\n",
-			root, path_start);
+	writer.open_fd = fd;
+	out_direct = (oflags & O_DIRECT) != 0;
 
-	if (root && remaining_path)
-		*remaining_path = path_start;
+	return fd;
+}
 
-	FREEBUF(path_buf);
-bail_out:
-	return root;
+static void
+writer_close(int fd, char *dst, ulonglong size, struct timespec mtime)
+{
+	writer_job_t job;
+
+	BZERO(&job, sizeof(job));
+	job.type = WJ_CLOSE;
+	job.fd = fd;
+	/* O_DIRECT writes whole pages, so trim it to the real size. */
+	job.pos = out_direct ? size : (ulonglong)-1;
+	job.mtime = mtime;
+	job.path = strdup(dst);
+	job.size = ((flags & DUMP_RESUME) && !journal.failed) ?
+		size : (ulonglong)-1;
+
+	writer.open_fd = -1;
+	writer_submit(&job);
 }
 
-static ulong
-path_to_dentry(char *path, ulong *inode)
+/*
+ * Zero-copy transfer from an uncompressed ELF dumpfile: the file offset of
+ * a page is looked up in the PT_LOAD segments, and runs of pages are copied
+ * from the dumpfile to the output file without reading them into pgbuf.
+ */
+typedef struct {
+	ulonglong paddr;
+	ulonglong filesz;
+	ulonglong offset;
+} elf_seg_t;
+
+#define COPY_NONE		(0)
+#define COPY_FILE_RANGE		(1)
+#define COPY_SENDFILE		(2)
+#define COPY_PREAD		(3)
+
+static struct {
+	int initialized;
+	int method;
+	int fd;
+	int nr_segs;
+	elf_seg_t *segs;
+} vmcore = { .fd = -1 };
+
+static int
+sort_by_paddr(const void *arg1, const void *arg2)
 {
-	int i, count;
-	ulong *subdirs_list, root, d, dentry;
-	char *path_buf, *dentry_buf, *slash_pos, *path_start, *name;
-	size_t len;
+	elf_seg_t *p = (elf_seg_t *)arg1;
+	elf_seg_t *q = (elf_seg_t *)arg2;
 
-	root = get_mntpoint_dentry(path, &path_start);
-	if (!root) {
-		error(INFO, "%s: mount point not found\n", path);
+	if (p->paddr == q->paddr)
 		return 0;
-	}
-
-	len = strlen(path_start);
-	path_buf = GETBUF(len + 1);
-	memcpy(path_buf, path_start, len + 1);
-	path_start = path_buf;
 
-	dentry = 0;
-	dentry_buf = GETBUF(SIZE(dentry));
-	d = root;
+	return p->paddr < q->paddr ? -1 : 1;
+}
 
-	while (strlen(path_start)) {
-		if ((slash_pos = strchr(path_start, '/')))
-			*slash_pos = '\0';
+static int
+read_elf_segments(int fd)
+{
+	union {
+		unsigned char ident[EI_NIDENT];
+		Elf64_Ehdr e64;
+		Elf32_Ehdr e32;
+	} ehdr;
+	Elf64_Phdr p64;
+	Elf32_Phdr p32;
+	ulonglong phoff;
+	int i, phnum, phentsize, is64;
+	elf_seg_t *seg;
+
+	if (pread(fd, &ehdr, sizeof(ehdr), 0) != sizeof(ehdr) ||
+	    memcmp(ehdr.ident, ELFMAG, SELFMAG) != 0)
+		return FALSE;
 
-		if (!(subdirs_list = get_subdirs_list(&count, d)))
-			goto not_found;
+	/* The headers are read as they are. */
+	if ((ehdr.ident[EI_CLASS] != ELFCLASS64 &&
+	     ehdr.ident[EI_CLASS] != ELFCLASS32) ||
+	    ehdr.ident[EI_DATA] != (__BYTE_ORDER == __LITTLE_ENDIAN ?
+	    ELFDATA2LSB : ELFDATA2MSB)) {
+		error(INFO, "%s: unsupported ELF class %d or data encoding %d, "
+			"using readmem()\n", pc->dumpfile,
+			ehdr.ident[EI_CLASS], ehdr.ident[EI_DATA]);
+		return FALSE;
+	}
 
-		for (i = 0; i < count; i++) {
-			d = subdirs_list[i];
-			if (!readmem(d, KVADDR, dentry_buf, SIZE(dentry),
-			    "dentry buffer", RETURN_ON_ERROR))
-				continue;
+	is64 = (ehdr.ident[EI_CLASS] == ELFCLASS64);
+	phoff = is64 ? ehdr.e64.e_phoff : ehdr.e32.e_phoff;
+	phnum = is64 ? ehdr.e64.e_phnum : ehdr.e32.e_phnum;
+	phentsize = is64 ? sizeof(Elf64_Phdr) : sizeof(Elf32_Phdr);
 
-			/* no alloc */
-			name = get_dentry_name(d, dentry_buf, 0);
+	if ((is64 ? ehdr.e64.e_phentsize : ehdr.e32.e_phentsize) !=
+	    phentsize) {
+		error(INFO, "%s: unsupported ELF program header size, "
+			"using readmem()\n", pc->dumpfile);
+		return FALSE;
+	}
 
-			if (CRASHDEBUG(2))
-				error(INFO, "q:%s %3d: d:%lx name:%s\n",
-					path_start, i, d, name);
+	if (!(vmcore.segs = malloc(sizeof(elf_seg_t) * phnum)))
+		return FALSE;
 
-			if (STREQ(path_start, name)) {
-				if (slash_pos)
-					break;
-				else {
-					FREEBUF(subdirs_list);
-					goto found;
-				}
-			}
+	for (i = 0; i < phnum; i++) {
+		seg = &vmcore.segs[vmcore.nr_segs];
+		if (is64) {
+			if (pread(fd, &p64, phentsize, phoff + i * phentsize)
+			    != phentsize)
+				return FALSE;
+			if (p64.p_type != PT_LOAD || !p64.p_filesz)
+				continue;
+			seg->paddr = p64.p_paddr;
+			seg->filesz = p64.p_filesz;
+			seg->offset = p64.p_offset;
+		} else {
+			if (pread(fd, &p32, phentsize, phoff + i * phentsize)
+			    != phentsize)
+				return FALSE;
+			if (p32.p_type != PT_LOAD || !p32.p_filesz)
+				continue;
+			seg->paddr = p32.p_paddr;
+			seg->filesz = p32.p_filesz;
+			seg->offset = p32.p_offset;
 		}
-		FREEBUF(subdirs_list);
-
-		/* no such dentry */
-		if (i == count)
-			goto not_found;
-
-		if (slash_pos)
-			path_start = slash_pos + 1;
+		vmcore.nr_segs++;
 	}
-	/* the path ends with '/' */
-	if (!readmem(d, KVADDR, dentry_buf, SIZE(dentry),
-	    "dentry buffer", RETURN_ON_ERROR))
-		goto not_found;
-
-found:
-	dentry = d;
-	if (inode)
-		*inode = ULONG(dentry_buf + OFFSET(dentry_d_inode));
 
-not_found:
-	FREEBUF(dentry_buf);
-	FREEBUF(path_buf);
+	qsort(vmcore.segs, vmcore.nr_segs, sizeof(elf_seg_t), sort_by_paddr);
 
-	return dentry;
+	return vmcore.nr_segs > 0;
 }
 
-typedef struct {
-	ulong dentry;
-	char *name;
-	ulong inode;
-	uint i_mode;
-} dentry_info_t;
-
+/*
+ * Only plain ELF dumpfiles whose physical addresses are what readmem()
+ * reads are supported, others use readmem() as before.
+ */
 static void
-recursive_list_dir(char *arg, ulong pdentry, ulong pinode, uint pi_mode)
+vmcore_init(void)
 {
-	ulong *list;
-	int i, count, nr_negdents = 0;
-	char *slash;
-	ulong d, inode;
-	uint i_mode;
-	dentry_info_t *dentry_list, *p;
-
-	if (!(flags & FIND_COUNT_DENTRY))
-		fprintf(fp, "%16lx %16lx %s\n", pdentry, pinode, arg);
+	int fd;
 
-	if (!S_ISDIR(pi_mode))
+	if (vmcore.initialized)
 		return;
+	vmcore.initialized = TRUE;
 
-	if (!(list = get_subdirs_list(&count, pdentry))) {
-		if (flags & FIND_COUNT_DENTRY)
-			fprintf(fp, count_dentry_fmt, 0, 0, 0, arg);
+	if (ACTIVE() || XEN() || !pc->dumpfile ||
+	    !(KDUMP_DUMPFILE() || NETDUMP_DUMPFILE()))
 		return;
-	}
 
-	slash = (arg[1] == '\0') ? "" : "/";
-	dentry_list = (dentry_info_t *)GETBUF(sizeof(dentry_info_t) * count);
-
-	for (i = 0, p = dentry_list; i < count; i++) {
-		d = list[i];
-		readmem(d, KVADDR, dentry_data, SIZE(dentry),
-			"dentry", FAULT_ON_ERROR);
+	if ((fd = open(pc->dumpfile, O_RDONLY)) < 0)
+		return;
 
-		p->inode = ULONG(dentry_data + OFFSET(dentry_d_inode));
-		if (p->inode && get_inode_info(p->inode, &i_mode, NULL, NULL, NULL, NULL))
-			p->i_mode = i_mode;
-		else {
-			if (flags & FIND_COUNT_DENTRY) {
-				nr_negdents++;
-				continue;
-			}
-			if (!(flags & SHOW_INFO_NEG_DENTS))
-				continue;
-		}
-		p->dentry = d;
-		p->name = get_dentry_name(d, dentry_data, 1);
-		p++;
+	if (!read_elf_segments(fd)) {
+		free(vmcore.segs);
+		vmcore.segs = NULL;
+		vmcore.nr_segs = 0;
+		close(fd);
+		return;
 	}
 
-	if (flags & FIND_COUNT_DENTRY) {
-		fprintf(fp, count_dentry_fmt,
-			count, count - nr_negdents, nr_negdents, arg);
-		total_dentry += count;
-		total_negdent += nr_negdents;
-	}
+	vmcore.fd = fd;
+	vmcore.method = COPY_FILE_RANGE;
 
-	count = p - dentry_list;
+	if (CRASHDEBUG(1))
+		error(INFO, "zero-copy from %s: %d PT_LOAD segments\n",
+			pc->dumpfile, vmcore.nr_segs);
+}
 
-	for (i = 0, p = dentry_list; i < count; i++, p++) {
-		if (S_ISDIR(p->i_mode)) {
-			char path[PATH_MAX];
-			snprintf(path, PATH_MAX, "%s%s%s", arg, slash, p->name);
+static long long
+vmcore_offset(physaddr_t phys, ulong len)
+{
+	int lo, hi, mid;
+	elf_seg_t *seg;
+
+	if (vmcore.method == COPY_NONE)
+		return -1;
+
+	lo = 0;
+	hi = vmcore.nr_segs - 1;
+	while (lo <= hi) {
+		mid = (lo + hi) / 2;
+		seg = &vmcore.segs[mid];
+		if (phys < seg->paddr)
+			hi = mid - 1;
+		else if (phys >= seg->paddr + seg->filesz)
+			lo = mid + 1;
+		else if (phys + len <= seg->paddr + seg->filesz)
+			return seg->offset + (phys - seg->paddr);
+		else
+			break;
+	}
 
-			d = get_mntpoint_dentry(path, NULL);
-			if (d) {
-				readmem(d, KVADDR, dentry_data, SIZE(dentry),
-					"dentry", FAULT_ON_ERROR);
+	return -1;
+}
 
-				inode = ULONG(dentry_data +
-						OFFSET(dentry_d_inode));
-				if (inode && get_inode_info(inode, &i_mode,
-						NULL, NULL, NULL, NULL))
-					recursive_list_dir(path, d, inode, i_mode);
-				else
-					error(INFO, "%s: invalid inode\n", path);
-			} else /* normal directory */
-				recursive_list_dir(path, p->dentry, p->inode, p->i_mode);
+/*
+ * buf is for COPY_PREAD.  This is also called by the writer thread, which
+ * must not call crash's functions.
+ */
+static int
+copy_extent(int fd, long long src, ulong len, ulonglong pos, char *buf)
+{
+	loff_t in, out;
+	ssize_t ret;
+	ulong size;
+
+	while (len) {
+		in = src;
+		out = pos;
+		switch (vmcore.method)
+		{
+		case COPY_FILE_RANGE:
+			ret = copy_file_range(vmcore.fd, &in, fd, &out, len, 0);
+			break;
+		case COPY_SENDFILE:
+			if (lseek(fd, pos, SEEK_SET) < 0)
+				return FALSE;
+			ret = sendfile(fd, vmcore.fd, &in, len);
+			break;
+		default:
+			size = MIN(len, EXTENT_BUFSIZE);
+			ret = pread(vmcore.fd, buf, size, src);
+			if (ret > 0 && !write_extent(fd, buf, ret, pos))
+				return FALSE;
+			break;
+		}
 
-		} else if (!(flags & FIND_COUNT_DENTRY))
-			fprintf(fp, "%16lx %16lx %s%s%s\n",
-				p->dentry, p->inode, arg, slash, p->name);
+		if (ret < 0 && vmcore.method != COPY_PREAD &&
+		    (errno == EXDEV || errno == EINVAL || errno == ENOSYS ||
+		     errno == EOPNOTSUPP)) {
+			if (CRASHDEBUG(1) && buf == pgbuf)
+				error(INFO, "zero-copy method %d failed: %s\n",
+					vmcore.method, strerror(errno));
+			vmcore.method++;
+			continue;
+		} else if (ret < 0 && errno == EINTR)
+			continue;
+		else if (ret <= 0)
+			return FALSE;
 
-		free(p->name);
+		src += ret;
+		pos += ret;
+		len -= ret;
 	}
 
-	FREEBUF(dentry_list);
-	FREEBUF(list);
+	return TRUE;
 }
 
-#define MODE_RWX (S_IRWXU|S_IRWXG|S_IRWXO)
-
 static void
-recursive_dump_dir(char *src, char *dst, ulong pdentry, struct timespec pmtime)
+flush_extent(void)
 {
-	ulong *list;
-	int i, count;
-	char *slash, *name;
-	ulong d, dentry, inode, i_mapping, nrpages;
-	ulonglong i_size;
-	uint i_mode;
-	char srcpath[PATH_MAX], dstpath[PATH_MAX];
-	struct timespec i_mtime;
+	int ret;
+	ulonglong pos;
+	writer_job_t job;
 
-	if (!(flags & DUMP_COUNT_ONLY)) {
-		if (CRASHDEBUG(1))
-			fprintf(fp, "create dir  %s\n", dst);
+	if (!extent_len)
+		return;
 
-		if (mkdir(dst, MODE_RWX) < 0) {
-			error(INFO, "%s: cannot create directory: %s\n",
-				dst, strerror(errno));
-			return;
-		}
+	if (extent_src >= 0) {
+		pos = (flags & DUMP_DONT_SEEK) ? out_cursor : extent_pos;
+		out_cursor += extent_len;
+
+		if (flags & DUMP_ASYNC) {
+			BZERO(&job, sizeof(job));
+			job.type = WJ_COPY;
+			job.fd = out_fd;
+			job.src = extent_src;
+			job.pos = pos;
+			job.len = extent_len;
+			job.pages = extent_pages;
+			writer_submit(&job);
+			ret = TRUE;
+		} else	/* pgbuf is not used by a zero-copy extent */
+			ret = copy_extent(out_fd, extent_src, extent_len,
+				pos, pgbuf);
+	} else if (out_fd < 0) {
+		/* crash's output may be a pipe, so keep using stdio. */
+		if (!(flags & DUMP_DONT_SEEK))
+			fseek(outfp, extent_pos, SEEK_SET);
+		ret = (fwrite(pgbuf, sizeof(char), extent_len, outfp)
+			== extent_len);
+	} else {
+		pos = (flags & DUMP_DONT_SEEK) ? out_cursor : extent_pos;
+		out_cursor += extent_len;
+
+		if (flags & DUMP_ASYNC) {
+			BZERO(&job, sizeof(job));
+			job.type = WJ_WRITE;
+			job.fd = out_fd;
+			job.buf = pgbuf;
+			job.pos = pos;
+			job.len = out_direct ?
+				roundup(extent_len, PAGESIZE()) : extent_len;
+			job.pages = extent_pages;
+			writer_submit(&job);
+			pgbuf = writer_get_buf();
+			ret = TRUE;
+		} else
+			ret = write_extent(out_fd, pgbuf, extent_len, pos);
 	}
 
-	if (!(list = get_subdirs_list(&count, pdentry)))
-		goto no_subdirs;
-
-	slash = (src[1] == '\0') ? "" : "/";
-
-	for (i = 0; i < count; i++) {
-		d = dentry = list[i];
-		readmem(d, KVADDR, dentry_data, SIZE(dentry), "dentry",
-			FAULT_ON_ERROR);
-
-		name = get_dentry_name(d, dentry_data, 0); /* no alloc */
-		inode = ULONG(dentry_data + OFFSET(dentry_d_inode));
-
-		if (!inode || !get_inode_info(inode, &i_mode, &i_mapping,
-					&i_size, &nrpages, &i_mtime))
-			continue;
-
-		snprintf(srcpath, PATH_MAX, "%s%s%s", src, slash, name);
-		snprintf(dstpath, PATH_MAX, "%s/%s", dst, name);
-
-		if (S_ISDIR(i_mode)) {
-			d = get_mntpoint_dentry(srcpath, NULL);
-			if (d) {
-				readmem(d, KVADDR, dentry_data, SIZE(dentry),
-					"dentry", FAULT_ON_ERROR);
-
-				inode = ULONG(dentry_data +
-						OFFSET(dentry_d_inode));
-				if (!inode || !get_inode_info(inode, &i_mode,
-						NULL, NULL, NULL, NULL)) {
-					error(INFO, "%s: invalid inode\n",
-						srcpath);
-					continue;
-				}
-				dentry = d;
-			}
-			recursive_dump_dir(srcpath, dstpath, dentry, i_mtime);
-
-		} else if (S_ISREG(i_mode)) {
-			if (!nrpages) {
-				if (CRASHDEBUG(1))
-					fprintf(fp, "%s: no cached pages\n",
-						srcpath);
-				continue;
-			} else if (flags & DUMP_COUNT_ONLY) {
-				total_pages += nrpages;
-				continue;
-			}
-
-			if (CRASHDEBUG(1))
-				fprintf(fp, "create file %s\n", dstpath);
-
-			dump_file(srcpath, dstpath, i_mapping, i_size, i_mtime);
-			total_pages += nr_written;
+	if (ret) {
+		/* counted by the writer thread when written */
+		if (!(flags & DUMP_ASYNC) || out_fd < 0)
+			nr_written += extent_pages;
+		nr_extents++;
+	} else {
+		if (!journal.failed) {
+			journal.failed = TRUE;
+			journal.nr_failed++;
 		}
+		if (errno != EPIPE || CRASHDEBUG(1))
+			error(INFO, "%s: write error at offset %llu: %s\n",
+				out_src, extent_pos, strerror(errno));
 	}
 
-	FREEBUF(list);
+	if (CRASHDEBUG(2))
+		fprintf(fp, "extent pos:%llu len:%lu pages:%lu src:%lld\n",
+			extent_pos, extent_len, extent_pages, extent_src);
 
-no_subdirs:
-	if (!(flags & DUMP_COUNT_ONLY)) {
-		set_mtime(dst, pmtime);
-	}
+	extent_len = extent_pages = 0;
 }
 
 /*
- * Currently just squeeze a series of slashes into a slash,
- * and remove the last slash.
+ * Add size bytes from skip bytes into physically contiguous pages (up to
+ * EXTENT_MAX_PAGES) to the current extent, or write out the extent and start
+ * a new one if they do not follow it.  With DUMP_DONT_SEEK, pages are packed
+ * without holes anyway.  Returns FALSE if any of the pages is excluded.
  */
-static void
-normalize_path(char *path)
+static int
+add_page(physaddr_t phys, ulong skip, ulonglong pos, ulong size)
 {
-	char *s, *d;
-
-	if (!path || *path == '\0')
+	long long src;
+	ulong nr = (skip + size + PAGESIZE() - 1) / PAGESIZE();
+
+	src = (out_fd >= 0) ? vmcore_offset(phys, nr * PAGESIZE()) : -1;
+	if (src >= 0)
+		src += skip;
+
+	if (extent_len &&
+	    ((!(flags & DUMP_DONT_SEEK) && pos != extent_pos + extent_len) ||
+	     (src < 0) != (extent_src < 0) ||
+	     (src >= 0 && src != extent_src + extent_len) ||
+	     (src < 0 && extent_len + nr * PAGESIZE() > EXTENT_BUFSIZE)))
+		flush_extent();
+
+	if (src < 0) {
+		if (!readmem(phys, PHYSADDR, pgbuf + extent_len,
+		    nr * PAGESIZE(), "page content", RETURN_ON_ERROR|QUIET))
+			return FALSE;
+		if (skip)
+			memmove(pgbuf + extent_len, pgbuf + extent_len + skip,
+				size);
+	}
+
+	if (!extent_len) {
+		extent_pos = pos;
+		extent_src = src;
+	}
+	extent_len += size;
+	extent_pages += nr;
+
+	return TRUE;
+}
+
+/*
+ * Make sure that the pages below index have been written, and record it.
+ */
+static void
+journal_checkpoint(ulong index)
+{
+	flush_extent();
+	writer_drain();
+	if (journal.failed || writer.file_failed)
 		return;
 
-	s = d = path;
-	while (*s) {
-		if (*s == '/' && *(s+1) == '/') {
-			s++;
+	fprintf(journal.ofp, "C %lu %s\n", index, journal.cur);
+	fflush(journal.ofp);
+	journal.nr_pages = 0;
+}
+
+/*
+ * Remove the journal unless some files failed, which a rerun can retry.
+ */
+static void
+journal_finish(void)
+{
+	ulong nr_skipped = journal.nr_skipped;
+
+	writer_drain();
+	if (journal.nr_failed || writer.nr_errors)
+		error(INFO, "%s: kept for the failed files\n", journal.path);
+	else if (unlink(journal.path) < 0)
+		error(INFO, "%s: cannot remove: %s\n", journal.path,
+			strerror(errno));
+	journal_close();
+
+	if (nr_skipped)
+		fprintf(fp, "Skipped %lu files completed before\n", nr_skipped);
+}
+
+static int
+dump_slot(ulong slot)
+{
+	physaddr_t phys;
+	ulong index, nr, i, j, n, size, skip, sk;
+	ulonglong pos, off, from;
+
+	if (!get_folio(slot, &phys, &index, &nr))
+		return FALSE;
+
+	pos = (ulonglong)index * PAGESIZE();
+	if (pos >= out_size)	/* truncated after being cached */
+		return TRUE;
+	nr = MIN(nr, byte_to_page(out_size - pos));
+
+	/* written before being interrupted, or before the range */
+	from = MAX((ulonglong)journal.start * PAGESIZE(), out_base);
+	if (pos + (ulonglong)nr * PAGESIZE() <= from)
+		return TRUE;
+	skip = 0;
+	if (pos < from) {
+		n = (from - pos) / PAGESIZE();
+		index += n;
+		nr -= n;
+		phys += (physaddr_t)n * PAGESIZE();
+		pos += (ulonglong)n * PAGESIZE();
+		skip = from - pos;
+	}
+
+	/*
+	 * A large folio is physically contiguous, so read it at once.  If
+	 * some pages of it were excluded by makedumpfile, read it page by
+	 * page and skip them quietly.
+	 */
+	for (i = 0; i < nr; i += n) {
+		n = MIN(nr - i, EXTENT_MAX_PAGES);
+		off = (ulonglong)i * PAGESIZE();
+		sk = i ? 0 : skip;
+		size = MIN((ulonglong)n * PAGESIZE(), out_size - pos - off) - sk;
+		if (add_page(phys + off, sk, pos + off + sk - out_base, size))
 			continue;
+
+		for (j = i; j < i + n; j++) {
+			off = (ulonglong)j * PAGESIZE();
+			sk = j ? 0 : skip;
+			size = MIN(PAGESIZE(), out_size - pos - off) - sk;
+			if (!add_page(phys + off, sk, pos + off + sk - out_base,
+			    size))
+				nr_excluded++;
 		}
-		*d++ = *s++;
 	}
-	*d = '\0';
 
-	d--;
-	if (d != path && *d == '/')
-		*d = '\0';
+	journal.nr_pages += nr;
+	if ((flags & DUMP_RESUME) && journal.nr_pages >= JOURNAL_CKPT_PAGES)
+		journal_checkpoint(index + nr);
+
+	return TRUE;
 }
 
 static void
-do_command(char *src, char *dst)
+set_mtime(char *dst, struct timespec i_mtime)
 {
-	ulong inode, i_mapping, dentry, nrpages;
-	ulonglong i_size;
-	uint i_mode;
-	struct timespec i_mtime;
+	struct timespec ts[2];
 
-	inode = dentry = 0;
-	if (flags & DUMP_FILE)
-		inode = htol(src, RETURN_ON_ERROR|QUIET, NULL);
+	ts[0].tv_nsec = UTIME_OMIT; /* do not set atime */
+	ts[1] = i_mtime;
 
-	if (inode == 0 || inode == BADADDR) {
-		if (src[0] != '/')
-			cmd_usage(pc->curcmd, SYNOPSIS);
+	if (CRASHDEBUG(1))
+		fprintf(fp, "set mtime %s\n", dst);
 
-		normalize_path(src);
+	if (utimensat(AT_FDCWD, dst, ts, 0) < 0)
+		error(INFO, "%s: cannot set mtime: %s\n", dst, strerror(errno));
+}
 
-		dentry = path_to_dentry(src, &inode);
-		if (!dentry) {
-			error(INFO, "%s: not found in dentry cache\n", src);
+/*
+ * For ccat -t: find the offset of the last tail_lines lines like "tail -n",
+ * by reading the cached pages from the end of the file.
+ */
+static struct {
+	ulonglong i_size, offset;
+	ulong lines;
+	ulong last;		/* the last entry, passed again for siblings */
+	char *buf;
+} tail;
+
+static int
+tail_slot(ulong slot)
+{
+	physaddr_t phys;
+	ulong index, nr;
+	ulonglong pos;
+	long i, b, len;
+
+	folio_next = 0;
+	if (!get_folio(slot, &phys, &index, &nr))
+		return FALSE;
+	if (!nr || slot == tail.last)
+		return TRUE;
+	tail.last = slot;
+
+	for (i = nr - 1; i >= 0 && !walk.stop; i--) {
+		pos = (ulonglong)(index + i) * PAGESIZE();
+		if (pos >= tail.i_size)
+			continue;
+		if (!readmem(phys + (physaddr_t)i * PAGESIZE(), PHYSADDR,
+		    tail.buf, PAGESIZE(), "page content", RETURN_ON_ERROR|QUIET))
+			continue;
+
+		len = MIN(PAGESIZE(), tail.i_size - pos);
+		for (b = len - 1; b >= 0; b--) {
+			/* The newline at the end terminates the last line. */
+			if (tail.buf[b] != '\n' || pos + b == tail.i_size - 1)
+				continue;
+			if (++tail.lines == tail_lines) {
+				tail.offset = pos + b + 1;
+				walk.stop = TRUE;
+				break;
+			}
+		}
+	}
+
+	return TRUE;
+}
+
+static ulonglong
+tail_lines_offset(ulong i_mapping, ulonglong i_size)
+{
+	tail.i_size = i_size;
+	tail.offset = tail.lines = tail.last = 0;
+	tail.buf = GETBUF(PAGESIZE());
+
+	if (i_size)
+		walk_page_cache(i_mapping, 0, (i_size - 1) / PAGESIZE(), TRUE,
+			tail_slot);
+
+	FREEBUF(tail.buf);
+	folio_next = nr_cached = 0;
+
+	if (CRASHDEBUG(1))
+		error(INFO, "%lu lines from offset %llu\n", tail.lines,
+			tail.offset);
+
+	return tail.offset;
+}
+
+/*
+ * Set out_base and out_size to the byte range of a file to be dumped.
+ */
+static void
+set_dump_range(ulong i_mapping, ulonglong i_size)
+{
+	ulong nr;
+
+	out_size = i_size;
+	out_base = 0;
+	folio_next = nr_cached = 0;
+	if (flags & DUMP_RANGE) {
+		nr = byte_to_page(i_size);
+		if (tail_lines)
+			out_base = tail_lines_offset(i_mapping, i_size);
+		else if (tail_pages)
+			out_base = (nr > tail_pages) ?
+				(ulonglong)(nr - tail_pages) * PAGESIZE() : 0;
+		else
+			out_base = MIN(range_offset, i_size);
+		if (range_length && range_length < out_size - out_base)
+			out_size = out_base + range_length;
+	}
+}
+
+static ulong range_pages;
+
+static int
+count_range_slot(ulong slot)
+{
+	physaddr_t phys;
+	ulong index, nr, i;
+
+	if (!get_folio(slot, &phys, &index, &nr))
+		return FALSE;
+
+	for (i = 0; i < nr; i++) {
+		if ((ulonglong)(index + i + 1) * PAGESIZE() > out_base &&
+		    (ulonglong)(index + i) * PAGESIZE() < out_size)
+			range_pages++;
+	}
+
+	return TRUE;
+}
+
+/*
+ * For ccat -c with a range: the cached pages in the range.
+ */
+static ulong
+count_range_pages(ulong i_mapping, ulonglong i_size)
+{
+	set_dump_range(i_mapping, i_size);
+
+	range_pages = 0;
+	if (out_size > out_base)
+		walk_page_cache(i_mapping, out_base / PAGESIZE(),
+			(out_size - 1) / PAGESIZE(), FALSE, count_range_slot);
+	folio_next = nr_cached = 0;
+
+	return range_pages;
+}
+
+static void
+dump_file(char *src, char *dst, ulong i_mapping, ulonglong i_size,
+	struct timespec i_mtime)
+{
+	struct list_pair lp;
+	ulong root;
+	ulonglong size;
+
+	set_dump_range(i_mapping, i_size);
+	size = out_size - out_base;
+
+	if (dst && (flags & DUMP_ASYNC)) {
+		if ((out_fd = writer_open(dst, !journal.start)) < 0) {
+			error(INFO, "%s: cannot open: %s\n",
+				dst, strerror(errno));
 			return;
-		} else if (!inode) {
-			error(INFO, "%s: negative dentry\n", src);
+		}
+		outfp = NULL;
+	} else if (dst) {
+		/* Keep the pages written before being interrupted. */
+		if (journal.start && (outfp = fopen(dst, "r+")) == NULL)
+			journal.start = 0;
+		if (!journal.start && (outfp = fopen(dst, "w")) == NULL) {
+			error(INFO, "%s: cannot open: %s\n",
+				dst, strerror(errno));
 			return;
 		}
+		set_tmpfile2(outfp);
+		out_fd = fileno(outfp);
+		out_direct = FALSE;
+	} else {
+		outfp = fp;
+		out_fd = -1;
+		out_direct = FALSE;
 	}
 
-	if (!get_inode_info(inode, &i_mode, &i_mapping, &i_size, &nrpages,
-				&i_mtime))
+	/* Set the size once, holes are left by skipping. */
+	if (dst && !(flags & DUMP_DONT_SEEK) && ftruncate(out_fd, size) < 0)
+		error(INFO, "%s: cannot set size: %s\n", dst, strerror(errno));
+
+	root = i_mapping + OFFSET(address_space_page_tree);
+	lp.value = dump_slot;
+	out_src = src;
+	out_cursor = 0;
+	nr_written = nr_excluded = nr_extents = 0;
+	extent_len = extent_pages = 0;
+
+	if (flags & DUMP_RANGE) {
+		/* only the nodes covering the range */
+		if (size)
+			walk_page_cache(i_mapping, out_base / PAGESIZE(),
+				(out_size - 1) / PAGESIZE(), FALSE, dump_slot);
+	} else if (env_flags & XARRAY)
+		do_xarray(root, XARRAY_DUMP_CB, &lp);
+	else
+		do_radix_tree(root, RADIX_TREE_DUMP_CB, &lp);
+
+	flush_extent();
+
+	if (dst && (flags & DUMP_ASYNC))
+		writer_close(out_fd, dst, (flags & DUMP_DONT_SEEK) ?
+			out_cursor : size, i_mtime);
+	else if (dst) {
+		close_tmpfile2();
+		set_mtime(dst, i_mtime);
+		if ((flags & DUMP_RESUME) && !journal.failed)
+			journal_done(dst, i_size, i_mtime);
+	} else if (!(flags & DUMP_DONT_SEEK))
+		ftruncate(fileno(outfp), size);
+
+	if (nr_excluded)
+		error(INFO, "%s: %lu/%lu pages excluded\n",
+			src, nr_excluded, nr_cached);
+	if (CRASHDEBUG(1))
+		error(INFO, "%s: %lu/%lu pages %s in %lu extents\n",
+			src, nr_written, nr_cached, (flags & DUMP_ASYNC) ?
+			"queued" : "written", nr_extents);
+}
+
+/*
+ * Physical-address-ordered extraction for ccat -d -p: the cached pages of
+ * the files are collected first, and then read in the order of physical
+ * address, which is also the order of the pages in the dumpfile, and
+ * scattered to the files.  Up to SCHED_MAX_PAGES pages are sorted at a
+ * time to bound the memory usage.
+ */
+typedef struct {
+	char *src;
+	char *dst;
+	ulonglong i_size;
+	struct timespec i_mtime;
+	ulong nr_pages, nr_excluded;
+	int failed;
+	int direct;		/* written with O_DIRECT */
+} sched_file_t;
+
+typedef struct {
+	physaddr_t phys;
+	ulong index;
+	uint file;
+} sched_page_t;
+
+#define SCHED_MAX_PAGES	(1UL << 22)
+#define SCHED_NR_FDS	(64)
+
+static struct {
+	sched_file_t *files;
+	uint nr_files, max_files;
+	sched_page_t *pages;
+	ulong nr_pages, max_pages;
+	int fds[SCHED_NR_FDS];
+	uint fd_file[SCHED_NR_FDS];
+	int fd_direct[SCHED_NR_FDS];
+} sched;
+
+static void sched_read_pages(void);
+
+static int
+collect_page(physaddr_t phys, ulong index)
+{
+	sched_page_t *p;
+
+	if (sched.nr_pages == SCHED_MAX_PAGES)
+		sched_read_pages();
+
+	if (sched.nr_pages == sched.max_pages) {
+		sched.max_pages = sched.max_pages ?
+			sched.max_pages * 2 : 4096;
+		sched.pages = realloc(sched.pages,
+			sizeof(sched_page_t) * sched.max_pages);
+		if (!sched.pages)
+			error(FATAL, "cannot allocate page list\n");
+	}
+
+	p = &sched.pages[sched.nr_pages++];
+	p->phys = phys;
+	p->index = index;
+	p->file = sched.nr_files - 1;
+	sched.files[p->file].nr_pages++;
+
+	return TRUE;
+}
+
+static int
+collect_slot(ulong slot)
+{
+	return for_each_folio_page(slot, collect_page);
+}
+
+/*
+ * Create the file with its size and collect its cached pages.
+ */
+static void
+sched_file(char *src, char *dst, ulong i_mapping, ulonglong i_size,
+	struct timespec i_mtime)
+{
+	struct list_pair lp;
+	ulong root;
+	sched_file_t *f;
+	int fd;
+
+	if ((fd = open(dst, O_WRONLY|O_CREAT|O_TRUNC, 0666)) < 0) {
+		error(INFO, "%s: cannot open: %s\n", dst, strerror(errno));
 		return;
+	}
+	if (ftruncate(fd, i_size) < 0)
+		error(INFO, "%s: cannot set size: %s\n", dst, strerror(errno));
+	close(fd);
+
+	if (sched.nr_files == sched.max_files) {
+		sched.max_files = sched.max_files ?
+			sched.max_files * 2 : 1024;
+		sched.files = realloc(sched.files,
+			sizeof(sched_file_t) * sched.max_files);
+		if (!sched.files)
+			error(FATAL, "cannot allocate file list\n");
+	}
 
-	if (flags & DUMP_FILE) {
-		if (!S_ISREG(i_mode)) {
-			error(INFO, "%s: not regular file\n", src);
-			return;
-		} else if (!nrpages) {
-			error(INFO, "%s: no cached pages\n", src);
-			return;
-		} else if (flags & DUMP_COUNT_ONLY) {
-			fprintf(fp, "Estimated %lu pages (%lu KiB)\n",
-				nrpages, PAGESIZE() * nrpages >> 10);
-			return;
+	f = &sched.files[sched.nr_files++];
+	BZERO(f, sizeof(sched_file_t));
+	f->src = strdup(src);
+	f->dst = strdup(dst);
+	f->i_size = i_size;
+	f->i_mtime = i_mtime;
+
+	root = i_mapping + OFFSET(address_space_page_tree);
+	lp.value = collect_slot;
+	out_size = i_size;
+	folio_next = nr_cached = 0;
+
+	if (env_flags & XARRAY)
+		do_xarray(root, XARRAY_DUMP_CB, &lp);
+	else
+		do_radix_tree(root, RADIX_TREE_DUMP_CB, &lp);
+}
+
+static void
+sched_close_fd(int slot)
+{
+	writer_job_t job;
+
+	if (sched.fds[slot] < 0)
+		return;
+
+	if (flags & DUMP_ASYNC) {
+		/* just close it after the queued writes */
+		BZERO(&job, sizeof(job));
+		job.type = WJ_CLOSE;
+		job.fd = sched.fds[slot];
+		job.pos = job.size = (ulonglong)-1;
+		writer_submit(&job);
+	} else
+		close(sched.fds[slot]);
+
+	sched.fds[slot] = -1;
+}
+
+static int
+sched_get_fd(uint file)
+{
+	int slot = file % SCHED_NR_FDS;
+	sched_file_t *f = &sched.files[file];
+	int fd, direct = (flags & DUMP_DIRECT_IO) != 0;
+
+	if (sched.fds[slot] >= 0 && sched.fd_file[slot] == file) {
+		out_direct = sched.fd_direct[slot];
+		return sched.fds[slot];
+	}
+
+	sched_close_fd(slot);
+
+	fd = open(f->dst, O_WRONLY|(direct ? O_DIRECT : 0));
+	if (fd < 0 && errno == EINVAL && direct) {
+		error(INFO, "%s: O_DIRECT not supported, "
+			"falling back to buffered writes\n", f->dst);
+		flags &= ~DUMP_DIRECT_IO;
+		direct = FALSE;
+		fd = open(f->dst, O_WRONLY);
+	}
+	if (fd < 0) {
+		error(INFO, "%s: cannot open: %s\n", f->dst, strerror(errno));
+		f->failed = TRUE;
+		return -1;
+	}
+
+	sched.fds[slot] = fd;
+	sched.fd_file[slot] = file;
+	sched.fd_direct[slot] = out_direct = direct;
+	/* reopened without it after a fallback, it still has whole pages */
+	f->direct |= direct;
+
+	return fd;
+}
+
+static int
+sort_by_phys(const void *arg1, const void *arg2)
+{
+	sched_page_t *p = (sched_page_t *)arg1;
+	sched_page_t *q = (sched_page_t *)arg2;
+
+	if (p->phys == q->phys)
+		return 0;
+
+	return p->phys < q->phys ? -1 : 1;
+}
+
+static void
+sched_read_pages(void)
+{
+	sched_page_t *p;
+	sched_file_t *f;
+	ulong i, size;
+	ulonglong pos;
+	uint cur = (uint)-1;
+
+	if (!sched.nr_pages)
+		return;
+
+	if (CRASHDEBUG(1))
+		fprintf(fp, "reading %lu pages in physical address order\n",
+			sched.nr_pages);
+
+	qsort(sched.pages, sched.nr_pages, sizeof(sched_page_t), sort_by_phys);
+
+	extent_len = extent_pages = 0;
+
+	for (i = 0, p = sched.pages; i < sched.nr_pages; i++, p++) {
+		f = &sched.files[p->file];
+		if (f->failed)
+			continue;
+
+		pos = (ulonglong)p->index * PAGESIZE();
+		size = (pos + PAGESIZE()) > f->i_size ?
+			f->i_size - pos : PAGESIZE();
+
+		if (p->file != cur) {
+			flush_extent();
+			if ((out_fd = sched_get_fd(p->file)) < 0) {
+				cur = (uint)-1;
+				continue;
+			}
+			cur = p->file;
+			out_src = f->src;
 		}
 
-		dump_file(src, dst, i_mapping, i_size, i_mtime);
+		if (!add_page(p->phys, 0, pos, size))
+			f->nr_excluded++;
+	}
+	flush_extent();
+
+	sched.nr_pages = 0;
+}
+
+static void
+sched_reset(void)
+{
+	uint i;
+
+	for (i = 0; i < SCHED_NR_FDS; i++) {
+		if (sched.files && sched.fds[i] >= 0)
+			close(sched.fds[i]);
+		sched.fds[i] = -1;
+	}
+	for (i = 0; i < sched.nr_files; i++) {
+		free(sched.files[i].src);
+		free(sched.files[i].dst);
+	}
+	free(sched.files);
+	free(sched.pages);
+	BZERO(&sched, offsetof(typeof(sched), fds));
+}
+
+/*
+ * Write the remaining pages, and then set the mtimes of the files after
+ * all of their pages are written.
+ */
+static void
+sched_finish(void)
+{
+	sched_file_t *f;
+	uint i;
+
+	sched_read_pages();
+
+	for (i = 0; i < SCHED_NR_FDS; i++)
+		sched_close_fd(i);
+	writer_drain();
+
+	for (i = 0, f = sched.files; i < sched.nr_files; i++, f++) {
+		if (f->failed)
+			continue;
+		/* O_DIRECT writes whole pages, so trim it to the real size. */
+		if (f->direct && truncate(f->dst, f->i_size) < 0)
+			error(INFO, "%s: cannot set size: %s\n",
+				f->dst, strerror(errno));
+		set_mtime(f->dst, f->i_mtime);
+
+		if (f->nr_excluded)
+			error(INFO, "%s: %lu/%lu pages excluded\n",
+				f->src, f->nr_excluded, f->nr_pages);
+	}
+
+	sched_reset();
+}
+
+/*
+ * Streaming tar output for ccat -d -a: the directory tree is written as a
+ * POSIX pax archive to a file or a zstd process, so that no files are
+ * created.  Not to crash's output, where the messages would be mixed in.  Files with holes are stored in the GNU sparse
+ * format 1.0, whose sparse map is made from the indexes of cached pages
+ * collected before the data.  Excluded pages are stored as zeros.
+ */
+#define TAR_BLOCKSIZE	(512)
+
+struct tar_header {
+	char name[100];
+	char mode[8];
+	char uid[8];
+	char gid[8];
+	char size[12];
+	char mtime[12];
+	char chksum[8];
+	char typeflag;
+	char linkname[100];
+	char magic[6];
+	char version[2];
+	char uname[32];
+	char gname[32];
+	char devmajor[8];
+	char devminor[8];
+	char prefix[155];
+	char pad[12];
+};
+
+typedef struct {
+	ulong index;
+	physaddr_t phys;
+} tar_page_t;
+
+static struct {
+	FILE *ofp;
+	int piped;
+	ulonglong offset;
+	tar_page_t *pages;
+	ulong nr_pages, max_pages;
+	char *pax;
+	int pax_len, pax_max;
+} tar;
+
+static void
+tar_write(void *buf, ulong len)
+{
+	if (fwrite(buf, sizeof(char), len, tar.ofp) != len &&
+	    (errno != EPIPE || CRASHDEBUG(1)))
+		error(FATAL, "archive write error: %s\n", strerror(errno));
+	tar.offset += len;
+}
+
+static void
+tar_pad(void)
+{
+	static char zero[TAR_BLOCKSIZE];
+	ulong len = tar.offset % TAR_BLOCKSIZE;
+
+	if (len)
+		tar_write(zero, TAR_BLOCKSIZE - len);
+}
+
+static void
+tar_number(char *field, int len, long long val)
+{
+	int i;
+
+	if (val >= 0 && val < (1LL << (3 * (len - 1)))) {
+		snprintf(field, len, "%0*llo", len - 1, val);
+		return;
+	}
+
+	/*
+	 * GNU base-256 encoding for large and negative values, in two's
+	 * complement with the sign extended to the first byte
+	 */
+	for (i = len - 1; i > 0; i--, val >>= 8)
+		field[i] = val & 0xff;
+	field[0] = (val < 0) ? 0xff : 0x80;
+}
+
+/*
+ * A pax record is "<len> <key>=<value>\n", where len includes itself.
+ */
+static void
+tar_pax_record(char *key, char *fmt, ...)
+{
+	char value[PATH_MAX+32];
+	va_list ap;
+	int len, digits, n;
+
+	va_start(ap, fmt);
+	vsnprintf(value, sizeof(value), fmt, ap);
+	va_end(ap);
+
+	len = strlen(key) + strlen(value) + 3;
+	for (digits = 1, n = 10; len + digits >= n; n *= 10)
+		digits++;
+	len += digits;
+
+	if (tar.pax_len + len + 1 > tar.pax_max) {
+		tar.pax_max = MAX(tar.pax_max * 2, tar.pax_len + len + 1);
+		if (!(tar.pax = realloc(tar.pax, tar.pax_max)))
+			error(FATAL, "cannot allocate pax header\n");
+	}
+	tar.pax_len += snprintf(tar.pax + tar.pax_len, len + 1, "%d %s=%s\n",
+		len, key, value);
+}
+
+static void
+tar_header(char *name, char typeflag, uint mode, ulonglong size,
+	struct timespec *mtime)
+{
+	struct tar_header h;
+	unsigned char *p;
+	uint sum;
+	int i;
+
+	BZERO(&h, sizeof(h));
+	strncpy(h.name, name, sizeof(h.name));
+	tar_number(h.mode, sizeof(h.mode), mode & 07777);
+	tar_number(h.uid, sizeof(h.uid), 0);
+	tar_number(h.gid, sizeof(h.gid), 0);
+	tar_number(h.size, sizeof(h.size), size);
+	tar_number(h.mtime, sizeof(h.mtime), mtime->tv_sec);
+	h.typeflag = typeflag;
+	memcpy(h.magic, "ustar", 6);
+	memcpy(h.version, "00", 2);
+
+	memset(h.chksum, ' ', sizeof(h.chksum));
+	for (i = 0, sum = 0, p = (unsigned char *)&h; i < sizeof(h); i++)
+		sum += p[i];
+	snprintf(h.chksum, sizeof(h.chksum) - 1, "%06o", sum);
+
+	tar_write(&h, sizeof(h));
+}
+
+/*
+ * Write the pax extended header if any, and then the ustar header.
+ */
+static void
+tar_entry(char *name, char typeflag, uint mode, ulonglong size,
+	struct timespec *mtime)
+{
+	char pax_name[100];
+
+	if (strlen(name) >= sizeof(((struct tar_header *)0)->name))
+		tar_pax_record("path", "%s", name);
+	if (mtime->tv_nsec && mtime->tv_sec < 0)
+		tar_pax_record("mtime", "-%ld.%09ld",
+			-(mtime->tv_sec + 1), 1000000000L - mtime->tv_nsec);
+	else if (mtime->tv_nsec)
+		tar_pax_record("mtime", "%ld.%09ld",
+			mtime->tv_sec, mtime->tv_nsec);
+	if (size >= (1ULL << 33))
+		tar_pax_record("size", "%llu", size);
+
+	if (tar.pax_len) {
+		snprintf(pax_name, sizeof(pax_name), "PaxHeaders/%s",
+			strrchr(name, '/') ? strrchr(name, '/') + 1 : name);
+		tar_header(pax_name, 'x', 0644, tar.pax_len, mtime);
+		tar_write(tar.pax, tar.pax_len);
+		tar_pad();
+		tar.pax_len = 0;
+	}
+
+	tar_header(name, typeflag, mode, size, mtime);
+}
+
+static int
+tar_open(char *dst)
+{
+	char cmd[PATH_MAX+32];
+
+	tar.offset = 0;
+
+	if (flags & DUMP_ZSTD) {
+		if (strchr(dst, '\'')) {
+			error(INFO, "%s: invalid archive name\n", dst);
+			return FALSE;
+		}
+		snprintf(cmd, sizeof(cmd), "zstd -q -c > '%s'", dst);
+		tar.ofp = popen(cmd, "w");
+		tar.piped = TRUE;
+	} else
+		tar.ofp = fopen(dst, "w");
+
+	if (!tar.ofp) {
+		error(INFO, "%s: cannot open: %s\n", dst, strerror(errno));
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static void
+tar_close(void)
+{
+	if (!tar.ofp)
+		return;
+
+	if (tar.piped)
+		pclose(tar.ofp);
+	else
+		fclose(tar.ofp);
+
+	free(tar.pages);
+	free(tar.pax);
+	BZERO(&tar, sizeof(tar));
+}
+
+static void
+tar_finish(void)
+{
+	static char zero[TAR_BLOCKSIZE * 2];
+
+	tar_write(zero, sizeof(zero));
+	fflush(tar.ofp);
+	tar_close();
+}
+
+static void
+tar_dir(char *dst, uint i_mode, struct timespec *i_mtime)
+{
+	char name[PATH_MAX+1];
+
+	snprintf(name, sizeof(name), "%s/", dst);
+	tar_entry(name, '5', i_mode, 0, i_mtime);
+}
+
+static int
+tar_add_page(physaddr_t phys, ulong index)
+{
+	if (tar.nr_pages == tar.max_pages) {
+		tar.max_pages = tar.max_pages ? tar.max_pages * 2 : 1024;
+		tar.pages = realloc(tar.pages,
+			sizeof(tar_page_t) * tar.max_pages);
+		if (!tar.pages)
+			error(FATAL, "cannot allocate page list\n");
+	}
+
+	tar.pages[tar.nr_pages].index = index;
+	tar.pages[tar.nr_pages].phys = phys;
+	tar.nr_pages++;
+
+	return TRUE;
+}
+
+static int
+tar_slot(ulong slot)
+{
+	return for_each_folio_page(slot, tar_add_page);
+}
+
+/*
+ * Call func for each run of contiguous pages in tar.pages.
+ */
+static void
+tar_for_each_region(void (*func)(ulonglong, ulonglong, void *), void *arg)
+{
+	ulong i, start;
+	ulonglong pos, end;
+
+	for (i = start = 0; i < tar.nr_pages; i++) {
+		if (i + 1 < tar.nr_pages &&
+		    tar.pages[i+1].index == tar.pages[i].index + 1)
+			continue;
+
+		pos = (ulonglong)tar.pages[start].index * PAGESIZE();
+		end = MIN((ulonglong)(tar.pages[i].index + 1) * PAGESIZE(),
+			out_size);
+		func(pos, end - pos, arg);
+		start = i + 1;
+	}
+}
+
+static void
+tar_count_region(ulonglong pos, ulonglong len, void *arg)
+{
+	ulonglong *counts = (ulonglong *)arg;
+
+	counts[0]++;
+	counts[1] += len;
+}
+
+static void
+tar_map_region(ulonglong pos, ulonglong len, void *arg)
+{
+	char buf[64];
+	int n;
+
+	n = snprintf(buf, sizeof(buf), "%llu\n%llu\n", pos, len);
+	if (arg)	/* just count the length */
+		*(ulonglong *)arg += n;
+	else
+		tar_write(buf, n);
+}
+
+static void
+tar_file(char *src, char *dst, ulong i_mapping, ulonglong i_size,
+	struct timespec i_mtime, uint i_mode)
+{
+	struct list_pair lp;
+	ulong root, i, size;
+	ulonglong counts[2] = { 0, 0 }, pos, end, map_size, nr_regions;
+	char buf[64], *slash;
+
+	root = i_mapping + OFFSET(address_space_page_tree);
+	lp.value = tar_slot;
+	out_size = i_size;
+	folio_next = nr_cached = 0;
+	tar.nr_pages = 0;
+	nr_written = nr_excluded = 0;
+
+	if (env_flags & XARRAY)
+		do_xarray(root, XARRAY_DUMP_CB, &lp);
+	else
+		do_radix_tree(root, RADIX_TREE_DUMP_CB, &lp);
+
+	tar_for_each_region(tar_count_region, counts);
+
+	if (counts[1] != i_size) {
+		/* A trailing hole is expressed with an empty region. */
+		end = tar.nr_pages ?
+			MIN((ulonglong)(tar.pages[tar.nr_pages-1].index + 1) *
+				PAGESIZE(), i_size) : 0;
+		nr_regions = counts[0] + (end < i_size);
+
+		map_size = snprintf(buf, sizeof(buf), "%llu\n", nr_regions);
+		tar_for_each_region(tar_map_region, &map_size);
+		if (end < i_size)
+			tar_map_region(i_size, 0, &map_size);
+		map_size = roundup(map_size, TAR_BLOCKSIZE);
+
+		slash = strrchr(dst, '/');
+		snprintf(buf, sizeof(buf), "GNUSparseFile.0/%.40s",
+			slash ? slash + 1 : dst);
+		tar_pax_record("GNU.sparse.major", "1");
+		tar_pax_record("GNU.sparse.minor", "0");
+		tar_pax_record("GNU.sparse.name", "%s", dst);
+		tar_pax_record("GNU.sparse.realsize", "%llu", i_size);
+		tar_entry(buf, '0', i_mode, map_size + counts[1], &i_mtime);
+
+		tar_write(buf, snprintf(buf, sizeof(buf), "%llu\n",
+			nr_regions));
+		tar_for_each_region(tar_map_region, NULL);
+		if (end < i_size)
+			tar_map_region(i_size, 0, NULL);
+		tar_pad();
+	} else
+		tar_entry(dst, '0', i_mode, i_size, &i_mtime);
+
+	for (i = 0; i < tar.nr_pages; i++) {
+		pos = (ulonglong)tar.pages[i].index * PAGESIZE();
+		size = (pos + PAGESIZE()) > i_size ? i_size - pos : PAGESIZE();
+		if (!readmem(tar.pages[i].phys, PHYSADDR, pgbuf, PAGESIZE(),
+		    "page content", RETURN_ON_ERROR|QUIET)) {
+			/* already in the map, so fill it with zeros */
+			BZERO(pgbuf, size);
+			nr_excluded++;
+		} else
+			nr_written++;
+		tar_write(pgbuf, size);
+	}
+	tar_pad();
+
+	if (nr_excluded)
+		error(INFO, "%s: %lu/%lu pages excluded\n",
+			src, nr_excluded, tar.nr_pages);
+}
+
+/*
+ * 128-bit MurmurHash3 (x64 variant) for identifying page contents.
+ */
+#define ROTL64(x, r)	(((x) << (r)) | ((x) >> (64 - (r))))
+
+static ulonglong
+fmix64(ulonglong k)
+{
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdULL;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ULL;
+	k ^= k >> 33;
+
+	return k;
+}
+
+static void
+hash128(void *data, ulong len, ulonglong *out)
+{
+	const ulonglong c1 = 0x87c37b91114253d5ULL;
+	const ulonglong c2 = 0x4cf5ad432745937fULL;
+	unsigned char *tail;
+	ulonglong h1 = 0, h2 = 0, k1, k2;
+	ulong i, nblocks = len / 16;
+
+	for (i = 0; i < nblocks; i++) {
+		memcpy(&k1, (char *)data + i * 16, sizeof(k1));
+		memcpy(&k2, (char *)data + i * 16 + 8, sizeof(k2));
+
+		k1 *= c1; k1 = ROTL64(k1, 31); k1 *= c2; h1 ^= k1;
+		h1 = ROTL64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+		k2 *= c2; k2 = ROTL64(k2, 33); k2 *= c1; h2 ^= k2;
+		h2 = ROTL64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+	}
+
+	tail = (unsigned char *)data + nblocks * 16;
+	k1 = k2 = 0;
+	switch (len & 15)
+	{
+	case 15: k2 ^= (ulonglong)tail[14] << 48;
+	case 14: k2 ^= (ulonglong)tail[13] << 40;
+	case 13: k2 ^= (ulonglong)tail[12] << 32;
+	case 12: k2 ^= (ulonglong)tail[11] << 24;
+	case 11: k2 ^= (ulonglong)tail[10] << 16;
+	case 10: k2 ^= (ulonglong)tail[9] << 8;
+	case  9: k2 ^= (ulonglong)tail[8];
+		 k2 *= c2; k2 = ROTL64(k2, 33); k2 *= c1; h2 ^= k2;
+	case  8: k1 ^= (ulonglong)tail[7] << 56;
+	case  7: k1 ^= (ulonglong)tail[6] << 48;
+	case  6: k1 ^= (ulonglong)tail[5] << 40;
+	case  5: k1 ^= (ulonglong)tail[4] << 32;
+	case  4: k1 ^= (ulonglong)tail[3] << 24;
+	case  3: k1 ^= (ulonglong)tail[2] << 16;
+	case  2: k1 ^= (ulonglong)tail[1] << 8;
+	case  1: k1 ^= (ulonglong)tail[0];
+		 k1 *= c1; k1 = ROTL64(k1, 31); k1 *= c2; h1 ^= k1;
+	}
+
+	h1 ^= len;
+	h2 ^= len;
+	h1 += h2;
+	h2 += h1;
+	h1 = fmix64(h1);
+	h2 = fmix64(h2);
+	h1 += h2;
+	h2 += h1;
+
+	out[0] = h1;
+	out[1] = h2;
+}
+
+/*
+ * Content-addressed page store for ccat -s: each cached page is hashed and
+ * stored only once in the pack file of a store directory, which can be
+ * shared by the extractions from many dumpfiles.  The extracted files are
+ * recorded in an index file as lists of page hashes, from which the cstore
+ * command reconstructs them.  The store files are named with the page size:
+ *
+ *   pages.<pagesize>.pack  the unique pages
+ *   pages.<pagesize>.idx   records of hash and offset in the pack file
+ *
+ * and the index file has these lines:
+ *
+ *   cacheutils-store 1 <pagesize> <dumpfile>
+ *   D <mode> <mtime> <path>
+ *   F <mode> <size> <mtime> <path>
+ *   P <index> <hash>           (pages of the preceding F line)
+ *
+ * The hash is not cryptographic, so a page is compared with the stored one
+ * of the same hash before it is deduplicated, and a page that collides is
+ * not stored.
+ */
+#define STORE_MAGIC	"cacheutils-store 1"
+#define MAX_STORE_PAGESIZE	(1UL << 20)
+
+typedef struct {
+	ulonglong hash[2];
+	ulonglong offset;	/* in the pack file, plus one; 0 means empty */
+} store_ent_t;
+
+static struct {
+	int idx_fd, pack_fd;
+	FILE *idx, *pack, *index;
+	ulong pagesize;
+	ulonglong pack_size;
+	ulonglong pack_flushed;	/* bytes readable from pack_fd */
+	char *cmp_buf;
+	store_ent_t *table;
+	ulong nr_ents, size;
+	ulong nr_new, nr_collisions;
+} store = { .idx_fd = -1, .pack_fd = -1 };
+
+/* A line of the index file */
+static void
+store_printf(char *fmt, ...)
+{
+	va_list ap;
+	int ret;
+
+	va_start(ap, fmt);
+	ret = vfprintf(store.index, fmt, ap);
+	va_end(ap);
+
+	if (ret < 0)
+		error(FATAL, "index write error: %s\n", strerror(errno));
+}
+
+static store_ent_t *
+store_lookup(ulonglong *hash)
+{
+	ulong i;
+	store_ent_t *e;
+
+	for (i = hash[0] & (store.size - 1); ; i = (i + 1) & (store.size - 1)) {
+		e = &store.table[i];
+		if (!e->offset ||
+		    (e->hash[0] == hash[0] && e->hash[1] == hash[1]))
+			return e;
+	}
+}
+
+static void
+store_insert(ulonglong *hash, ulonglong offset)
+{
+	store_ent_t *old, *e;
+	ulong i, old_size;
+
+	if ((store.nr_ents + 1) * 2 > store.size) {
+		old = store.table;
+		old_size = store.size;
+		store.size *= 2;
+		if (!(store.table = calloc(store.size, sizeof(store_ent_t))))
+			error(FATAL, "cannot allocate store table\n");
+		for (i = 0; i < old_size; i++) {
+			if (old[i].offset)
+				*store_lookup(old[i].hash) = old[i];
+		}
+		free(old);
+	}
+
+	e = store_lookup(hash);
+	if (!e->offset) {
+		e->hash[0] = hash[0];
+		e->hash[1] = hash[1];
+		e->offset = offset + 1;
+		store.nr_ents++;
+	}
+}
+
+/*
+ * Open the pack and idx files of pagesize in storedir and load the idx
+ * file.  The idx file is locked while it is open.
+ */
+static int
+store_load(char *storedir, int writable, ulong pagesize)
+{
+	char path[PATH_MAX];
+	store_ent_t rec;
+	struct stat st;
+	int oflags = writable ? (O_RDWR|O_CREAT|O_APPEND) : O_RDONLY;
+
+	store.pagesize = pagesize;
+	store.size = 65536;
+	if (!(store.table = calloc(store.size, sizeof(store_ent_t))))
+		error(FATAL, "cannot allocate store table\n");
+	if (writable && !(store.cmp_buf = malloc(store.pagesize)))
+		error(FATAL, "cannot allocate store buffer\n");
+
+	snprintf(path, PATH_MAX, "%s/pages.%lu.idx", storedir, store.pagesize);
+	if ((store.idx_fd = open(path, oflags, 0666)) < 0) {
+		error(INFO, "%s: cannot open: %s\n", path, strerror(errno));
+		return FALSE;
+	}
+	if (flock(store.idx_fd, (writable ? LOCK_EX : LOCK_SH)|LOCK_NB) < 0) {
+		error(INFO, "%s: cannot lock: %s\n", path, strerror(errno));
+		return FALSE;
+	}
+
+	snprintf(path, PATH_MAX, "%s/pages.%lu.pack", storedir, store.pagesize);
+	if ((store.pack_fd = open(path, oflags, 0666)) < 0 ||
+	    fstat(store.pack_fd, &st) < 0) {
+		error(INFO, "%s: cannot open: %s\n", path, strerror(errno));
+		return FALSE;
+	}
+	store.pack_size = store.pack_flushed = st.st_size;
+
+	store.idx = fdopen(store.idx_fd, writable ? "a+" : "r");
+	if (writable)
+		store.pack = fdopen(store.pack_fd, "a");
+	if (!store.idx || (writable && !store.pack)) {
+		error(INFO, "%s: cannot open: %s\n", storedir, strerror(errno));
+		return FALSE;
+	}
+
+	/* Ignore records whose pages were not written completely. */
+	rewind(store.idx);
+	while (fread(&rec, sizeof(rec), 1, store.idx) == 1) {
+		if (rec.offset + store.pagesize <= store.pack_size)
+			store_insert(rec.hash, rec.offset);
+	}
+
+	if (CRASHDEBUG(1))
+		error(INFO, "%s: %lu pages in store\n", storedir, store.nr_ents);
+
+	return TRUE;
+}
+
+static void
+store_close(void)
+{
+	if (store.index)
+		fclose(store.index);
+	/* the pages first, and then the records */
+	if (store.pack)
+		fclose(store.pack);
+	else if (store.pack_fd >= 0)
+		close(store.pack_fd);
+	if (store.idx)
+		fclose(store.idx);	/* also unlocks it */
+	else if (store.idx_fd >= 0)
+		close(store.idx_fd);
+
+	free(store.table);
+	free(store.cmp_buf);
+	BZERO(&store, sizeof(store));
+	store.idx_fd = store.pack_fd = -1;
+}
+
+static int
+store_open(char *storedir, char *index)
+{
+	if (mkdir(storedir, MODE_RWX) < 0 && errno != EEXIST) {
+		error(INFO, "%s: cannot create directory: %s\n",
+			storedir, strerror(errno));
+		return FALSE;
+	}
+
+	if (!store_load(storedir, TRUE, PAGESIZE())) {
+		store_close();
+		return FALSE;
+	}
+
+	if ((store.index = fopen(index, "w")) == NULL) {
+		error(INFO, "%s: cannot open: %s\n", index, strerror(errno));
+		store_close();
+		return FALSE;
+	}
+	store_printf("%s %lu %s\n", STORE_MAGIC, store.pagesize,
+		pc->dumpfile ? pc->dumpfile : "-");
+	store.nr_new = 0;
+
+	return TRUE;
+}
+
+/* Whether the page in the pack file at offset has the same content. */
+static int
+store_same(char *buf, ulonglong offset)
+{
+	if (offset + store.pagesize > store.pack_flushed) {
+		if (fflush(store.pack))
+			error(FATAL, "pack write error: %s\n",
+				strerror(errno));
+		store.pack_flushed = store.pack_size;
+	}
+
+	return pread(store.pack_fd, store.cmp_buf, store.pagesize,
+		offset) == store.pagesize &&
+		memcmp(buf, store.cmp_buf, store.pagesize) == 0;
+}
+
+/*
+ * Store the page unless it is there already, and return FALSE if another
+ * page with the same hash is there.
+ */
+static int
+store_page(char *buf, ulonglong *hash)
+{
+	store_ent_t rec, *e;
+
+	hash128(buf, store.pagesize, hash);
+	if ((e = store_lookup(hash))->offset)
+		return store_same(buf, e->offset - 1);
+
+	if (fwrite(buf, store.pagesize, 1, store.pack) != 1)
+		error(FATAL, "pack write error: %s\n", strerror(errno));
+
+	BZERO(&rec, sizeof(rec));
+	rec.hash[0] = hash[0];
+	rec.hash[1] = hash[1];
+	rec.offset = store.pack_size;
+	if (fwrite(&rec, sizeof(rec), 1, store.idx) != 1)
+		error(FATAL, "idx write error: %s\n", strerror(errno));
+
+	store_insert(hash, store.pack_size);
+	store.pack_size += store.pagesize;
+	store.nr_new++;
+
+	return TRUE;
+}
+
+static int
+store_add_page(physaddr_t phys, ulong index)
+{
+	ulonglong hash[2];
+
+	if (!readmem(phys, PHYSADDR, pgbuf, PAGESIZE(), "page content",
+	    RETURN_ON_ERROR|QUIET)) {
+		nr_excluded++;
+		return TRUE;
+	}
+
+	if (!store_page(pgbuf, hash)) {
+		store.nr_collisions++;
+		return TRUE;
+	}
+	store_printf("P %lu %016llx%016llx\n", index, hash[0], hash[1]);
+	nr_written++;
+
+	return TRUE;
+}
+
+static int
+store_slot(ulong slot)
+{
+	return for_each_folio_page(slot, store_add_page);
+}
+
+static void
+store_dir(char *dst, uint i_mode, struct timespec *i_mtime)
+{
+	store_printf("D %o %ld.%09ld %s\n", i_mode,
+		i_mtime->tv_sec, i_mtime->tv_nsec, dst);
+}
+
+static void
+store_file(char *src, char *dst, ulong i_mapping, ulonglong i_size,
+	struct timespec i_mtime, uint i_mode)
+{
+	struct list_pair lp;
+	ulong root;
+
+	if (strchr(dst, '\n')) {
+		error(INFO, "%s: cannot store a name with newline\n", src);
+		return;
+	}
+
+	store_printf("F %o %llu %ld.%09ld %s\n", i_mode, i_size,
+		i_mtime.tv_sec, i_mtime.tv_nsec, dst);
+
+	root = i_mapping + OFFSET(address_space_page_tree);
+	lp.value = store_slot;
+	out_size = i_size;
+	folio_next = nr_cached = 0;
+	nr_written = nr_excluded = 0;
+	store.nr_collisions = 0;
+
+	if (env_flags & XARRAY)
+		do_xarray(root, XARRAY_DUMP_CB, &lp);
+	else
+		do_radix_tree(root, RADIX_TREE_DUMP_CB, &lp);
+
+	if (nr_excluded)
+		error(INFO, "%s: %lu/%lu pages excluded\n",
+			src, nr_excluded, nr_cached);
+	if (store.nr_collisions)
+		error(INFO, "%s: %lu pages not stored: the hash collides with "
+			"another page\n", src, store.nr_collisions);
+}
+
+static void
+store_finish(void)
+{
+	ulong nr_new = store.nr_new, nr_ents = store.nr_ents;
+	int ret;
+
+	ret = fclose(store.index);
+	store.index = NULL;
+	if (ret != 0)
+		error(INFO, "index write error: %s\n", strerror(errno));
+	store_close();
+	if (ret != 0)
+		return;
+
+	fprintf(fp, "%lu new pages (%lu KiB) stored, %lu pages in store\n",
+		nr_new, PAGESIZE() * nr_new >> 10, nr_ents);
+}
+
+/*
+ * Manifest for ccat -m: the files and directories with the hashes of their
+ * cached pages, without the data.  The cdiff command compares two of them.
+ *
+ *   cacheutils-manifest 1 <pagesize> <dumpfile>
+ *   D <mode> <mtime> <path>
+ *   F <inode> <mode> <size> <mtime> <cached pages> <file hash> <path>
+ *   P <index> <hash>           (cached pages of the preceding F line)
+ *
+ * The file hash is of the index and hash pairs of the cached pages, so
+ * files are equal if they have the same file hash and size.
+ */
+#define MANIFEST_MAGIC	"cacheutils-manifest 1"
+
+typedef struct {
+	ulonglong index;
+	ulonglong hash[2];
+} manifest_page_t;
+
+static struct {
+	FILE *ofp;
+	manifest_page_t *pages;
+	ulong nr_pages, size;
+	ulong nr_files;
+} manifest;
+
+static void
+manifest_close(void)
+{
+	if (manifest.ofp)
+		fclose(manifest.ofp);
+	free(manifest.pages);
+	BZERO(&manifest, sizeof(manifest));
+}
+
+static int
+manifest_open(char *dst)
+{
+	if ((manifest.ofp = fopen(dst, "w")) == NULL) {
+		error(INFO, "%s: cannot open: %s\n", dst, strerror(errno));
+		return FALSE;
+	}
+	fprintf(manifest.ofp, "%s %lu %s\n", MANIFEST_MAGIC,
+		(ulong)PAGESIZE(), pc->dumpfile ? pc->dumpfile : "-");
+
+	return TRUE;
+}
+
+static int
+manifest_add_page(physaddr_t phys, ulong index)
+{
+	ulonglong pos;
+	manifest_page_t *mp;
+
+	pos = (ulonglong)index * PAGESIZE();
+
+	if (!readmem(phys, PHYSADDR, pgbuf, PAGESIZE(), "page content",
+	    RETURN_ON_ERROR|QUIET)) {
+		nr_excluded++;
+		return TRUE;
+	}
+
+	if (manifest.nr_pages == manifest.size) {
+		manifest.size = manifest.size ? manifest.size * 2 : 1024;
+		manifest.pages = realloc(manifest.pages,
+				sizeof(manifest_page_t) * manifest.size);
+		if (!manifest.pages)
+			error(FATAL, "cannot allocate manifest pages\n");
+	}
+
+	/* Not the bytes beyond EOF in the last page */
+	mp = &manifest.pages[manifest.nr_pages++];
+	mp->index = index;
+	hash128(pgbuf, MIN(out_size - pos, PAGESIZE()), mp->hash);
+	nr_written++;
+
+	return TRUE;
+}
+
+static int
+manifest_slot(ulong slot)
+{
+	return for_each_folio_page(slot, manifest_add_page);
+}
+
+static void
+manifest_dir(char *dst, uint i_mode, struct timespec *i_mtime)
+{
+	fprintf(manifest.ofp, "D %o %ld.%09ld %s\n", i_mode,
+		i_mtime->tv_sec, i_mtime->tv_nsec, dst);
+}
+
+static void
+manifest_file(char *src, char *dst, ulong inode, ulong i_mapping,
+	ulonglong i_size, struct timespec i_mtime, uint i_mode, ulong nrpages)
+{
+	struct list_pair lp;
+	ulong root, i;
+	ulonglong hash[2];
+
+	if (strchr(dst, '\n')) {
+		error(INFO, "%s: cannot record a name with newline\n", src);
+		return;
+	}
+
+	out_size = i_size;
+	folio_next = nr_cached = 0;
+	nr_written = nr_excluded = 0;
+	manifest.nr_pages = 0;
+
+	if (nrpages) {
+		root = i_mapping + OFFSET(address_space_page_tree);
+		lp.value = manifest_slot;
+
+		if (env_flags & XARRAY)
+			do_xarray(root, XARRAY_DUMP_CB, &lp);
+		else
+			do_radix_tree(root, RADIX_TREE_DUMP_CB, &lp);
+	}
+
+	if (nr_excluded)
+		error(INFO, "%s: %lu/%lu pages excluded\n",
+			src, nr_excluded, nr_cached);
+
+	hash128(manifest.pages, sizeof(manifest_page_t) * manifest.nr_pages,
+		hash);
+
+	fprintf(manifest.ofp, "F %lx %o %llu %ld.%09ld %lu %016llx%016llx %s\n",
+		inode, i_mode, i_size, i_mtime.tv_sec, i_mtime.tv_nsec,
+		manifest.nr_pages, hash[0], hash[1], dst);
+
+	for (i = 0; i < manifest.nr_pages; i++)
+		fprintf(manifest.ofp, "P %llu %016llx%016llx\n",
+			manifest.pages[i].index, manifest.pages[i].hash[0],
+			manifest.pages[i].hash[1]);
+
+	manifest.nr_files++;
+}
+
+static void
+manifest_finish(void)
+{
+	ulong nr_files = manifest.nr_files;
+
+	if (fflush(manifest.ofp) != 0)
+		error(INFO, "manifest write error: %s\n", strerror(errno));
+	manifest_close();
+
+	fprintf(fp, "%lu files recorded\n", nr_files);
+}
+
+/*
+ * Session cache of the dentries, names, inodes, child lists and mount
+ * lists read by the commands.  It is kept across commands until "ccache
+ * -c" and the least recently used entries are dropped beyond cc.limit
+ * bytes.  The mount lists are keyed by the mount namespace of the task
+ * context, and nothing is cached on a live system.
+ */
+#define CC_DENTRY	(0)
+#define CC_NAME		(1)
+#define CC_INODE	(2)
+#define CC_SUBDIRS	(3)
+#define CC_MOUNTS	(4)
+#define NR_CC_TYPES	(5)
+
+#define CC_DEFAULT_LIMIT	(64UL << 20)
+
+typedef struct cc_ent {
+	ulong key;
+	int type;
+	ulong size;
+	struct cc_ent *hnext;		/* in a hash chain */
+	struct cc_ent *prev, *next;	/* in the LRU list, newest first */
+	char data[];
+} cc_ent_t;
+
+static char *cc_type_names[NR_CC_TYPES] = {
+	"dentry", "name", "inode", "subdirs", "mounts"
+};
+
+static struct {
+	cc_ent_t **table;
+	ulong nr_buckets, nr_ents;
+	cc_ent_t *head, *tail;
+	ulong bytes, limit;
+	ulong ents[NR_CC_TYPES], hits[NR_CC_TYPES], misses[NR_CC_TYPES];
+} cc = { .limit = CC_DEFAULT_LIMIT };
+
+static ulong
+cc_bucket(int type, ulong key, ulong nr_buckets)
+{
+	ulonglong h = ((ulonglong)key ^ type) * 0x9E3779B97F4A7C15ULL;
+
+	return (h >> 32) & (nr_buckets - 1);
+}
+
+static void
+cc_unlink(cc_ent_t *e)
+{
+	if (e->prev)
+		e->prev->next = e->next;
+	else
+		cc.head = e->next;
+	if (e->next)
+		e->next->prev = e->prev;
+	else
+		cc.tail = e->prev;
+}
+
+static void
+cc_remove(cc_ent_t *e)
+{
+	cc_ent_t **pp;
+
+	pp = &cc.table[cc_bucket(e->type, e->key, cc.nr_buckets)];
+	while (*pp != e)
+		pp = &(*pp)->hnext;
+	*pp = e->hnext;
+	cc_unlink(e);
+
+	cc.bytes -= sizeof(cc_ent_t) + e->size;
+	cc.ents[e->type]--;
+	cc.nr_ents--;
+	free(e);
+}
+
+static void
+cc_clear(void)
+{
+	while (cc.tail)
+		cc_remove(cc.tail);
+	free(cc.table);
+	cc.table = NULL;
+	cc.nr_buckets = 0;
+}
+
+/*
+ * Returns the cached data, which is valid until the next cc_insert().
+ */
+static char *
+cc_lookup(int type, ulong key, ulong *size)
+{
+	cc_ent_t *e;
+
+	if (!cc.table)
+		return NULL;
+
+	e = cc.table[cc_bucket(type, key, cc.nr_buckets)];
+	for (; e; e = e->hnext) {
+		if (e->key != key || e->type != type)
+			continue;
+		if (e != cc.head) {
+			cc_unlink(e);
+			e->prev = NULL;
+			e->next = cc.head;
+			cc.head->prev = e;
+			cc.head = e;
+		}
+		cc.hits[type]++;
+		if (size)
+			*size = e->size;
+		return e->data;
+	}
+	cc.misses[type]++;
+
+	return NULL;
+}
+
+static void
+cc_insert(int type, ulong key, void *data, ulong size)
+{
+	cc_ent_t *e, *n, **table;
+	ulong i, nr;
+
+	if (ACTIVE() || sizeof(cc_ent_t) + size > cc.limit)
+		return;
+
+	while (cc.tail && cc.bytes + sizeof(cc_ent_t) + size > cc.limit)
+		cc_remove(cc.tail);
+
+	if (cc.nr_ents >= cc.nr_buckets) {
+		nr = cc.nr_buckets ? cc.nr_buckets * 2 : 4096;
+		if (!(table = calloc(nr, sizeof(cc_ent_t *))))
+			return;
+		for (i = 0; i < cc.nr_buckets; i++) {
+			for (e = cc.table[i]; e; e = n) {
+				n = e->hnext;
+				e->hnext = table[cc_bucket(e->type, e->key, nr)];
+				table[cc_bucket(e->type, e->key, nr)] = e;
+			}
+		}
+		free(cc.table);
+		cc.table = table;
+		cc.nr_buckets = nr;
+	}
+
+	if (!(e = malloc(sizeof(cc_ent_t) + size)))
+		return;
+	e->key = key;
+	e->type = type;
+	e->size = size;
+	if (size)
+		memcpy(e->data, data, size);
+
+	i = cc_bucket(type, key, cc.nr_buckets);
+	e->hnext = cc.table[i];
+	cc.table[i] = e;
+	e->prev = NULL;
+	e->next = cc.head;
+	if (cc.head)
+		cc.head->prev = e;
+	else
+		cc.tail = e;
+	cc.head = e;
+
+	cc.bytes += sizeof(cc_ent_t) + size;
+	cc.ents[type]++;
+	cc.nr_ents++;
+}
+
+/*
+ * Only the span of the field plan is read and cached, at the same offset
+ * in the dentry buffer.
+ */
+static int
+read_dentry(ulong dentry, char *dentry_buf, ulong error_handle)
+{
+	char *data, *span = dentry_buf + plan.dentry_start;
+	long len = plan.dentry_end - plan.dentry_start;
+
+	if ((data = cc_lookup(CC_DENTRY, dentry, NULL))) {
+		memcpy(span, data, len);
+		return TRUE;
+	}
+
+	if (!readmem(dentry + plan.dentry_start, KVADDR, span, len,
+	    "dentry buffer", error_handle))
+		return FALSE;
+	cc_insert(CC_DENTRY, dentry, span, len);
+
+	return TRUE;
+}
+
+static int
+dentry_mounted(char *dentry_buf)
+{
+	if (CU_VALID_MEMBER(dentry_d_mounted))	/* 2.6.37 and older */
+		return INT(dentry_buf + CU_OFFSET(dentry_d_mounted)) > 0;
+	if (CU_VALID_MEMBER(dentry_d_flags))
+		return !!(UINT(dentry_buf + CU_OFFSET(dentry_d_flags)) &
+			dcache_mounted);
+
+	return TRUE;
+}
+
+/*
+ * NOTE: If alloc is 0, do not strdup() and no need to free(), but
+ * need to copy the name if we want to get another dentry's name with
+ * this function before consuming the former one.
+ */
+static char *
+get_dentry_name(ulong dentry, char *dentry_buf, int alloc)
+{
+	ulong d_name_name, d_name_len, d_iname;
+	static char name[NAME_MAX+1];
+	static char unknown[] = "(unknown)";
+	char *name_addr;
+
+	BZERO(name, sizeof(name));
+
+	d_name_name = ULONG(dentry_buf + OFFSET(dentry_d_name)
+					+ OFFSET(qstr_name));
+	d_name_len = UINT(dentry_buf + OFFSET(dentry_d_name)
+					+ OFFSET(qstr_len));
+	d_iname = dentry + OFFSET(dentry_d_iname);
+
+	/*
+	 * d_name.name and d_iname are guaranteed NUL-terminated.
+	 * See d_alloc() in the kernel.
+	 */
+	if (d_name_name == d_iname)
+		name_addr = dentry_buf + OFFSET(dentry_d_iname);
+	else if ((name_addr = cc_lookup(CC_NAME, d_name_name, NULL))) {
+		strncpy(name, name_addr, NAME_MAX);
+		name_addr = name;
+	} else if (d_name_len <= NAME_MAX &&
+		   readmem(d_name_name, KVADDR, name, d_name_len + 1,
+			"dentry.d_name.name", RETURN_ON_ERROR)) {
+		name[d_name_len] = '\0';
+		name_addr = name;
+		cc_insert(CC_NAME, d_name_name, name, d_name_len + 1);
+	} else
+		name_addr = unknown;
+
+	/*
+	 * the number of malloc() via GETBUF() is limited to
+	 * MAX_MALLOC_BUFS(2000), so require strdup() here.
+	 */
+	if (alloc)
+		name_addr = strdup(name_addr);
+
+	return name_addr;
+}
+
+/*
+ * The inode is not inserted into the cache unless cache is set, for a bulk
+ * scan of inodes which would only evict the useful ones.
+ */
+static int
+read_inode_info(ulong inode, uint *i_mode, ulong *i_mapping,
+		ulonglong *i_size, ulong *nrpages, struct timespec *i_mtime,
+		int cache)
+{
+	char inode_buf[SIZE(inode) + sizeof(ulong)], *data, *span;
+	long len = plan.inode_end - plan.inode_start;
+	ulong mapping, pages;
+
+	/* The span of the inode is cached with the nrpages of its i_mapping. */
+	span = inode_buf + plan.inode_start;
+	if ((data = cc_lookup(CC_INODE, inode, NULL))) {
+		memcpy(span, data, len);
+		pages = ULONG(data + len);
+	} else {
+		if (!readmem(inode + plan.inode_start, KVADDR, span, len,
+		    "inode buffer", RETURN_ON_ERROR))
+			return FALSE;
+		mapping = ULONG(inode_buf + OFFSET(inode_i_mapping));
+		if (!mapping)
+			pages = BADADDR;
+		else if (plan.i_data_nrpages >= 0 &&
+			 mapping == inode + CU_OFFSET(inode_i_data))
+			pages = ULONG(inode_buf + plan.i_data_nrpages);
+		else if (!readmem(mapping + OFFSET(address_space_nrpages),
+		    KVADDR, &pages, sizeof(ulong), "i_mapping.nrpages",
+		    RETURN_ON_ERROR|QUIET))
+			pages = BADADDR;
+		/* the same layout as the span followed by nrpages */
+		ULONG(span + len) = pages;
+		if (cache)
+			cc_insert(CC_INODE, inode, span, len + sizeof(ulong));
+	}
+
+	if (i_mode) {
+		if (plan.umode_32bit)
+			*i_mode = UINT(inode_buf + OFFSET(inode_i_mode));
+		else
+			*i_mode = USHORT(inode_buf + OFFSET(inode_i_mode));
+	}
+	if (i_mapping)
+		*i_mapping = ULONG(inode_buf + OFFSET(inode_i_mapping));
+	if (i_size)
+		*i_size = ULONGLONG(inode_buf + CU_OFFSET(inode_i_size));
+	if (nrpages) {
+		*nrpages = pages;
+		if (*nrpages == BADADDR) {
+			error(INFO, "invalid i_mapping.nrpages: inode %lx\n",
+				inode);
+			return FALSE;
+		}
+	}
+	if (i_mtime) {
+		/*
+		 * There are some dirty assumptions and kludges here
+		 * for some reason I can't explain :)
+		 */
+		switch (plan.mtime) {
+		case MTIME_SEC_NSEC:
+			/* time64_t: long long */
+			i_mtime->tv_sec = (long long)ULONGLONG(inode_buf + CU_OFFSET(inode_i_mtime_sec));
+			/* u32: unsigned int */
+			i_mtime->tv_nsec = (long)UINT(inode_buf + CU_OFFSET(inode_i_mtime_nsec));
+			break;
+		case MTIME_TIMESPEC64:
+			i_mtime->tv_sec = (long)ULONGLONG(inode_buf
+						+ CU_OFFSET(inode_i_mtime));
+			i_mtime->tv_nsec = LONG(inode_buf
+						+ CU_OFFSET(inode_i_mtime)
+						+ sizeof(long long));
+			break;
+		default:
+			i_mtime->tv_sec = LONG(inode_buf
+						+ CU_OFFSET(inode_i_mtime));
+			i_mtime->tv_nsec = LONG(inode_buf
+						+ CU_OFFSET(inode_i_mtime)
+						+ sizeof(long));
+			break;
+		}
+	}
+
+	return TRUE;
+}
+
+static int
+get_inode_info(ulong inode, uint *i_mode, ulong *i_mapping,
+		ulonglong *i_size, ulong *nrpages, struct timespec *i_mtime)
+{
+	return read_inode_info(inode, i_mode, i_mapping, i_size, nrpages,
+		i_mtime, TRUE);
+}
+
+/*
+ * Brent's loop detection for a kernel list, which can loop back to any
+ * entry if corrupted: an entry is marked at each power of two steps, and
+ * the loop is found when the mark is seen again.  No memory is needed.
+ */
+typedef struct {
+	ulong mark, power, lam;
+} loop_check_t;
+
+static int
+loop_seen(loop_check_t *lc, ulong entry)
+{
+	if (entry == lc->mark)
+		return TRUE;
+	if (++lc->lam >= lc->power) {
+		lc->power = lc->power ? lc->power * 2 : 2;
+		lc->mark = entry;
+		lc->lam = 0;
+	}
+
+	return FALSE;
+}
+
+/*
+ * Iterates over the children of a dentry.  Each child dentry is read once,
+ * and the link to the next child, the inode and the name are taken from
+ * the same buffer, instead of walking the list with do_list() and then
+ * reading the children again.  The addresses of the children are cached
+ * when the walk completes, and the next walk goes through them with the
+ * cached dentries.  A directory with more than SUBDIRS_CACHE_MAX children
+ * is not cached, so that a walk takes bounded memory.
+ *
+ *	for (ok = subdirs_first(&it, dentry); ok; ok = subdirs_next(&it))
+ *		... it.dentry, it.buf, it.inode ...
+ *	subdirs_end(&it);
+ */
+#define SUBDIRS_CACHE_MAX	(65536)
+
+typedef struct {
+	ulong parent;
+	ulong head;		/* &parent->d_subdirs or d_children */
+	ulong next;		/* link of the next child */
+	ulong *cached;		/* the cached children */
+	int nr_cached;
+	int index;
+	ulong *list;		/* the children walked, to be cached */
+	int count, size;
+	loop_check_t loop;
+	int error;
+	ulong dentry;		/* the current child */
+	char *buf;		/* and its dentry buffer */
+	ulong inode;
+	int d_unhashed;
+	int mounted;		/* may be a mountpoint */
+} subdirs_iter_t;
+
+static ulong
+subdirs_link_offset(void)
+{
+	return CU_INVALID_MEMBER(dentry_d_child) ?
+		CU_OFFSET(dentry_d_sib) : CU_OFFSET(dentry_d_child);
+}
+
+static void
+subdirs_end(subdirs_iter_t *it)
+{
+	if (it->buf)
+		FREEBUF(it->buf);
+	if (it->list)
+		FREEBUF(it->list);
+	if (it->cached)
+		FREEBUF(it->cached);
+	it->buf = NULL;
+	it->list = it->cached = NULL;
+}
+
+static int
+subdirs_next(subdirs_iter_t *it)
+{
+	ulong d, off = subdirs_link_offset();
+
+	for (;;) {
+		if (it->cached) {
+			if (it->index >= it->nr_cached)
+				return FALSE;
+			d = it->cached[it->index++];
+			if (!read_dentry(d, it->buf, RETURN_ON_ERROR))
+				continue;
+			break;
+		}
+
+		if (it->error)
+			return FALSE;
+
+		/* the end of list_head d_subdirs, or hlist_head d_children */
+		if (!it->next || it->next == it->head) {
+			if (it->list)
+				cc_insert(CC_SUBDIRS, it->parent, it->list,
+					sizeof(ulong) * it->count);
+			it->error = TRUE;	/* done */
+			return FALSE;
+		}
+
+		d = it->next - off;
+		if (loop_seen(&it->loop, d)) {
+			error(INFO, "dentry %lx: d_subdirs list loops\n",
+				it->parent);
+			it->error = TRUE;
+			return FALSE;
+		}
+		if (!read_dentry(d, it->buf, RETURN_ON_ERROR)) {
+			it->error = TRUE;
+			return FALSE;
+		}
+		it->next = ULONG(it->buf + off);
+
+		if (it->list && it->count == it->size) {
+			if (it->size >= SUBDIRS_CACHE_MAX) {
+				FREEBUF(it->list);
+				it->list = NULL;
+			} else {
+				RESIZEBUF(it->list, sizeof(ulong) * it->size,
+					sizeof(ulong) * it->size * 2);
+				it->size *= 2;
+			}
+		}
+		if (it->list)
+			it->list[it->count] = d;
+		it->count++;
+
+		if (CRASHDEBUG(3))
+			fprintf(fp, "%lx\n", d);
+		break;
+	}
+
+	it->dentry = d;
+	it->inode = ULONG(it->buf + OFFSET(dentry_d_inode));
+	/* unfinished dentry */
+	it->d_unhashed = !ULONG(it->buf + CU_OFFSET(dentry_d_hash) +
+				CU_OFFSET(hlist_bl_node_pprev));
+	it->mounted = dentry_mounted(it->buf);
+
+	return TRUE;
+}
+
+static int
+subdirs_first(subdirs_iter_t *it, ulong dentry)
+{
+	char *data;
+	ulong size;
+
+	BZERO(it, sizeof(subdirs_iter_t));
+	it->parent = dentry;
+	it->buf = GETBUF(SIZE(dentry));
+
+	/* An empty list is cached with size 0. */
+	if ((data = cc_lookup(CC_SUBDIRS, dentry, &size))) {
+		it->nr_cached = size / sizeof(ulong);
+		it->cached = (ulong *)GETBUF(size ? size : sizeof(ulong));
+		memcpy(it->cached, data, size);
+		return subdirs_next(it);
+	}
+
+	it->head = dentry + (CU_INVALID_MEMBER(dentry_d_subdirs) ?
+			CU_OFFSET(dentry_d_children) : CU_OFFSET(dentry_d_subdirs));
+
+	if (!readmem(it->head, KVADDR, &it->next, sizeof(ulong),
+	    "dentry.d_subdirs", RETURN_ON_ERROR)) {
+		it->error = TRUE;
+		return FALSE;
+	}
+
+	it->size = 64;
+	it->list = (ulong *)GETBUF(sizeof(ulong) * it->size);
+
+	return subdirs_next(it);
+}
+
+static char *
+get_type_indicator(uint i_mode, ulong inode)
+{
+	static char c[2] = {'\0', '\0'};
+	static char link[PATH_MAX] = {' ', '-', '>', ' '};
+
+	if (S_ISREG(i_mode)) {
+		if (i_mode & (S_IXUSR|S_IXGRP|S_IXOTH))
+			*c = '*';
+		else
+			*c = '\0';
+	} else if (S_ISDIR(i_mode))
+		*c = '/';
+	else if (S_ISLNK(i_mode)) {
+		ulong i_link;
+		if ((flags & SHOW_INFO_LONG) && CU_VALID_MEMBER(inode_i_link) &&
+		    readmem(inode + CU_OFFSET(inode_i_link), KVADDR, &i_link,
+				sizeof(ulong), "inode.i_link", RETURN_ON_ERROR) &&
+		    i_link && read_string(i_link, link+4, PATH_MAX-4))
+			return link;
+		*c = '@';
+	} else if (S_ISFIFO(i_mode))
+		*c = '|';
+	else if (S_ISSOCK(i_mode))
+		*c = '=';
+	else
+		*c = '\0';
+
+	return c;
+}
+
+#define TIME_LEN	30
+static char *
+get_strtime(struct timespec *ts)
+{
+	static char buf[TIME_LEN];
+	static char na[2] = {'-', '\0'};
+	size_t ret;
+
+	ret = strftime(buf, TIME_LEN, "%F.%T", localtime(&ts->tv_sec));
+	if (!ret)
+		return na;
+
+	ret = snprintf(buf + ret, TIME_LEN - ret, ".%09ld", ts->tv_nsec);
+	if (ret < 0)
+		return na;
+
+	return buf;
+}
+
+static int
+calc_cached_percent(ulong nrpages, ulonglong i_size)
+{
+	if (!i_size)
+		return 0;
+
+	return (nrpages * 100) / byte_to_page(i_size);
+}
+
+/*
+ * Machine-readable output with -F json|csv: one record per line, in
+ * NDJSON or CSV.  A CSV file has one header line with the union of the
+ * fields of the command's record types, given to rec_open(), and a field
+ * not in a record is left empty.  Records are formatted into a large
+ * buffer and written out in chunks, to the file given with -f directly,
+ * not through the pager, or to fp.  Names are not always UTF-8, so the
+ * bytes not in valid UTF-8 sequences are escaped as \udc80-\udcff in JSON
+ * strings, like the surrogateescape of Python, and the rest are as is.
+ */
+#define OUT_TEXT	(0)
+#define OUT_JSON	(1)
+#define OUT_CSV		(2)
+
+#define REC_BUFSIZE	(1024 * 1024)
+#define REC_LINE_MAX	(PATH_MAX * 6 + 1024)	/* escaped */
+#define REC_HEAD_MAX	(512)
+#define REC_MAX_COLS	(16)
+#define REC_MNT_NS_COLS	"mnt_ns,pid,command"	/* of show_mnt_ns() */
+
+static struct {
+	int format;
+	char *file;
+	int fd;			/* of the file, or -1 for fp */
+	char *buf;
+	ulong len;
+	ulong start;		/* of the current record */
+	int nr_fields;
+	/* for CSV */
+	char head[REC_HEAD_MAX];	/* the columns */
+	char *cols[REC_MAX_COLS];
+	int nr_cols;
+	int header;		/* the header has been written */
+	int field_col[REC_MAX_COLS];
+	ulong field_off[REC_MAX_COLS+1];
+	char *line;		/* a record in the order of the columns */
+} rec = { .fd = -1 };
+
+static void
+rec_init(void)
+{
+	/* In case that the last command was interrupted. */
+	if (rec.fd >= 0)
+		close(rec.fd);
+	BZERO(&rec, sizeof(rec));
+	rec.fd = -1;
+}
+
+static void
+rec_option(int c, char *arg)
+{
+	if (c == 'f') {
+		rec.file = arg;
+		return;
+	}
+
+	if (STREQ(arg, "json"))
+		rec.format = OUT_JSON;
+	else if (STREQ(arg, "csv"))
+		rec.format = OUT_CSV;
+	else
+		error(FATAL, "invalid output format: %s\n", arg);
+}
+
+static void
+rec_flush(void)
+{
+	ulong done;
+	ssize_t ret;
+
+	if (rec.fd < 0)
+		fwrite(rec.buf, 1, rec.len, fp);
+	else {
+		for (done = 0; done < rec.len; done += ret) {
+			ret = write(rec.fd, rec.buf + done, rec.len - done);
+			if (ret < 0) {
+				if (errno == EINTR) {
+					ret = 0;
+					continue;
+				}
+				error(FATAL, "%s: write failed: %s\n",
+					rec.file, strerror(errno));
+			}
+		}
+	}
+	rec.len = 0;
+}
+
+/*
+ * columns are the fields of all the record types of the command, except
+ * for "type" and the ones of show_mnt_ns().
+ */
+static void
+rec_open(char *columns)
+{
+	char *c;
+
+	if (rec.file && !rec.format)
+		error(FATAL, "-f requires -F json or csv\n");
+	if (!rec.format)
+		return;
+
+	if (rec.format == OUT_CSV) {
+		snprintf(rec.head, REC_HEAD_MAX, "type,%s%s", columns,
+			(flags & ALL_MNT_NS) ? "," REC_MNT_NS_COLS : "");
+		rec.nr_cols = 0;
+		for (c = strtok(rec.head, ","); c && rec.nr_cols < REC_MAX_COLS;
+		     c = strtok(NULL, ","))
+			rec.cols[rec.nr_cols++] = c;
+		rec.line = GETBUF(REC_HEAD_MAX + REC_LINE_MAX);
+		rec.header = FALSE;
+	}
+
+	if (rec.file) {
+		rec.fd = open(rec.file, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+		if (rec.fd < 0)
+			error(FATAL, "%s: cannot open: %s\n",
+				rec.file, strerror(errno));
+	}
+	rec.buf = GETBUF(REC_BUFSIZE);
+	rec.len = 0;
+}
+
+static void
+rec_close(void)
+{
+	if (!rec.format)
+		return;
+
+	rec_flush();
+	if (rec.fd >= 0) {
+		if (close(rec.fd) < 0)
+			error(INFO, "%s: close failed: %s\n",
+				rec.file, strerror(errno));
+		rec.fd = -1;
+	}
+	FREEBUF(rec.buf);
+	if (rec.line)
+		FREEBUF(rec.line);
+	rec.line = NULL;
+	rec.format = OUT_TEXT;
+}
+
+static void
+rec_key(char *key)
+{
+	int i;
+
+	if (rec.format == OUT_JSON) {
+		rec.len += sprintf(rec.buf + rec.len, "%s\"%s\":",
+			rec.nr_fields ? "," : "", key);
+		rec.nr_fields++;
+		return;
+	}
+
+	/* The values are reordered to the columns at rec_end(). */
+	for (i = 0; i < rec.nr_cols; i++)
+		if (STREQ(rec.cols[i], key))
+			break;
+	if (i == rec.nr_cols || rec.nr_fields == REC_MAX_COLS)
+		error(FATAL, "no CSV column for %s\n", key);
+	rec.field_col[rec.nr_fields] = i;
+	rec.field_off[rec.nr_fields] = rec.len;
+	rec.nr_fields++;
+}
+
+static void
+rec_begin(char *type)
+{
+	if (rec.len > REC_BUFSIZE - REC_HEAD_MAX - REC_LINE_MAX)
+		rec_flush();
+
+	rec.start = rec.len;
+	rec.nr_fields = 0;
+	if (rec.format == OUT_JSON)
+		rec.buf[rec.len++] = '{';
+	rec_key("type");
+	rec.len += sprintf(rec.buf + rec.len,
+		rec.format == OUT_JSON ? "\"%s\"" : "%s", type);
+}
+
+/* The length of the valid UTF-8 sequence at s, or 0 */
+static int
+utf8_len(unsigned char *s)
+{
+	int i, len;
+	uint c;
+
+	if (*s < 0x80)
+		return 1;
+	else if ((*s & 0xe0) == 0xc0) {
+		len = 2;
+		c = *s & 0x1f;
+	} else if ((*s & 0xf0) == 0xe0) {
+		len = 3;
+		c = *s & 0x0f;
+	} else if ((*s & 0xf8) == 0xf0) {
+		len = 4;
+		c = *s & 0x07;
+	} else
+		return 0;
+
+	for (i = 1; i < len; i++) {
+		if ((s[i] & 0xc0) != 0x80)
+			return 0;
+		c = (c << 6) | (s[i] & 0x3f);
+	}
+
+	/* overlong forms, surrogates and beyond U+10FFFF */
+	if ((len == 2 && c < 0x80) || (len == 3 && c < 0x800) ||
+	    (len == 4 && c < 0x10000) || (c >= 0xd800 && c <= 0xdfff) ||
+	    c > 0x10ffff)
+		return 0;
+
+	return len;
+}
+
+static void
+rec_str(char *key, char *val)
+{
+	char *s, *d;
+	int quote, len;
+
+	rec_key(key);
+	d = rec.buf + rec.len;
+
+	if (rec.format == OUT_JSON) {
+		*d++ = '"';
+		for (s = val; *s && d - rec.buf < REC_BUFSIZE - 8; s++) {
+			if (*s == '"' || *s == '\\') {
+				*d++ = '\\';
+				*d++ = *s;
+			} else if ((unsigned char)*s < 0x20)
+				d += sprintf(d, "\\u%04x", (unsigned char)*s);
+			else if (!(len = utf8_len((unsigned char *)s)))
+				d += sprintf(d, "\\udc%02x", (unsigned char)*s);
+			else {
+				memcpy(d, s, len);
+				d += len;
+				s += len - 1;
+			}
+		}
+		*d++ = '"';
+	} else {
+		quote = strpbrk(val, ",\"\r\n") != NULL;
+		if (quote)
+			*d++ = '"';
+		for (s = val; *s && d - rec.buf < REC_BUFSIZE - 8; s++) {
+			if (*s == '"')
+				*d++ = '"';
+			*d++ = *s;
+		}
+		if (quote)
+			*d++ = '"';
+	}
+	rec.len = d - rec.buf;
+}
+
+/* addresses, as strings in JSON not to lose the upper bits */
+static void
+rec_hex(char *key, ulong val)
+{
+	rec_key(key);
+	rec.len += sprintf(rec.buf + rec.len,
+		rec.format == OUT_JSON ? "\"%lx\"" : "%lx", val);
+}
+
+static void
+rec_num(char *key, ulonglong val)
+{
+	rec_key(key);
+	rec.len += sprintf(rec.buf + rec.len, "%llu", val);
+}
+
+static void
+rec_time(char *key, struct timespec *ts)
+{
+	rec_key(key);
+	rec.len += sprintf(rec.buf + rec.len, "%ld.%09ld",
+		ts->tv_sec, ts->tv_nsec);
+}
+
+static void
+rec_end(void)
+{
+	char *d;
+	int c, i;
+
+	if (rec.format == OUT_JSON) {
+		rec.buf[rec.len++] = '}';
+		rec.buf[rec.len++] = '\n';
+		return;
+	}
+
+	d = rec.line;
+	if (!rec.header) {
+		for (c = 0; c < rec.nr_cols; c++)
+			d += sprintf(d, "%s%s", c ? "," : "", rec.cols[c]);
+		*d++ = '\n';
+		rec.header = TRUE;
+	}
+
+	rec.field_off[rec.nr_fields] = rec.len;
+	for (c = 0; c < rec.nr_cols; c++) {
+		if (c)
+			*d++ = ',';
+		for (i = 0; i < rec.nr_fields; i++) {
+			if (rec.field_col[i] != c)
+				continue;
+			memcpy(d, rec.buf + rec.field_off[i],
+				rec.field_off[i+1] - rec.field_off[i]);
+			d += rec.field_off[i+1] - rec.field_off[i];
+			break;
+		}
+	}
+	*d++ = '\n';
+
+	memcpy(rec.buf + rec.start, rec.line, d - rec.line);
+	rec.len = rec.start + (d - rec.line);
+}
+
+/*
+ * A dcache index written by "cindex build": the dentry tree of a mount
+ * namespace walked across mounts, as an array of nodes followed by a
+ * string table of the names.  The nodes are in breadth-first order, so
+ * the children of a directory are contiguous and in the order of its
+ * child list.  The root of a mount is a separate node, which the node of
+ * its mount point refers to.  The file is mapped with mmap(), and used by
+ * cls, cfind and the path lookup instead of reading the dentries if it
+ * was built from the same dumpfile and in the same mount namespace.
+ */
+#define CINDEX_MAGIC		"CUINDEX1"
+#define CINDEX_SUFFIX		".cindex"
+#define CINDEX_ID_BYTES		(65536)	/* dumpfile header to identify */
+
+#define CI_NEGATIVE		(0x1)
+#define CI_UNHASHED		(0x2)
+#define CI_MOUNT_ROOT		(0x4)
+#define CI_MOUNTPOINT		(0x8)
+
+typedef struct {
+	char magic[8];
+	uint node_size;
+	uint nr_nodes;		/* including the unused node 0 */
+	ulonglong id[2];	/* hash of the dumpfile identity */
+	ulonglong mnt_ns;
+	ulonglong strtab_size;
+} cindex_header_t;
+
+typedef struct {
+	ulonglong dentry, inode, i_mapping, i_size, nrpages;
+	long long mtime_sec;
+	uint mtime_nsec, i_mode;
+	uint name;		/* offset in the string table */
+	uint parent;
+	uint child, nr_children;
+	uint mnt;		/* the root node of the mount on it, or 0 */
+	uint flags;
+} cindex_node_t;
+
+static struct {
+	int tried;		/* for the default file */
+	int use;		/* for this command, -1 if not checked yet */
+	char path[PATH_MAX];
+	char *map;
+	ulong map_size;
+	cindex_header_t *hdr;
+	cindex_node_t *nodes;	/* node 1 is the root directory */
+	char *strtab;
+} cindex = { .use = -1 };
+
+static uint
+cindex_eff(uint n)
+{
+	return cindex.nodes[n].mnt ? cindex.nodes[n].mnt : n;
+}
+
+typedef struct {
+	ulong dentry;
+	char *name;
+	ulong inode;
+	ulong i_mapping;
+	ulonglong i_size;
+	ulong nrpages;
+	uint i_mode;
+	int d_unhashed;
+	int mounted;
+	struct timespec i_mtime;
+	uint node;		/* in the index */
+	ulong mnt;		/* of the dentry */
+	int info;		/* the inode fields are read */
+} inode_info_t;
+
+static int
+sort_by_name(const void *arg1, const void *arg2)
+{
+	inode_info_t *p = (inode_info_t *)arg1;
+	inode_info_t *q = (inode_info_t *)arg2;
+
+	/*
+	 * NOTE: To sort files like ls command, strcoll(3) should be used,
+	 * but since the crash utility doesn't call setlocale(LC_ALL, ""),
+	 * it doesn't work according to the environment variables.
+	 */
+	return strcmp(p->name, q->name);
+}
+
+static int
+sort_by_mtime(const void *arg1, const void *arg2)
+{
+	struct timespec *p = &((inode_info_t *)arg1)->i_mtime;
+	struct timespec *q = &((inode_info_t *)arg2)->i_mtime;
+
+	/* newest first */
+	if (p->tv_sec == q->tv_sec)
+		return q->tv_nsec - p->tv_nsec;
+
+	return q->tv_sec - p->tv_sec;
+}
+
+/*
+ * The walk of a directory tree for cls -R, cfind, cdu, ccat -d and cgrep.
+ * The directories being walked are kept on an explicit stack, instead of
+ * recursion with path buffers in every frame, and their path is built up
+ * in place, so that a deep tree takes a tree_level_t per level.  A command
+ * supplies visitors: enter() before the children of a directory, returning
+ * FALSE to skip it, visit() for each child with its path, returning
+ * TREE_DESCEND to walk into it next, and leave() after the children.  The
+ * children come from the index, or the dentry cache, or next() to have
+ * them in another order.  The mounts are followed on descending.
+ */
+#define TREE_DESCEND		(1)
+
+typedef struct {
+	inode_info_t dir;	/* the directory, without the name */
+	int depth;
+	int pathlen, dstlen;
+	int entered;
+	uint child;		/* the next one in the index */
+	subdirs_iter_t it;
+	int iter;		/* 1 at the first child of it, 2 after */
+	void *data;		/* for the visitors */
+} tree_level_t;
+
+typedef struct tree {
+	char path[PATH_MAX];
+	char dst[PATH_MAX];	/* for ccat -d, built up alike */
+	int nrpages;		/* nrpages is needed with the inodes */
+	int (*enter)(struct tree *, tree_level_t *);
+	int (*visit)(struct tree *, tree_level_t *, inode_info_t *);
+	void (*leave)(struct tree *, tree_level_t *);
+	int (*next)(struct tree *, tree_level_t *, inode_info_t *);
+	tree_level_t *stack;
+	int nr_levels, max_levels;
+} tree_t;
+
+/* Read the inode of a child, unless it is from the index. */
+static int
+tree_inode(tree_t *w, inode_info_t *p)
+{
+	uint i_mode;
+	ulong i_mapping, nrpages;
+	ulonglong i_size;
+	struct timespec i_mtime;
+
+	if (p->info || !p->inode)
+		return p->info;
+
+	if (!get_inode_info(p->inode, &i_mode, &i_mapping, &i_size,
+	    w->nrpages ? &nrpages : NULL, &i_mtime))
+		return FALSE;
+
+	p->i_mode = i_mode;
+	p->i_mapping = i_mapping;
+	p->i_size = i_size;
+	p->nrpages = w->nrpages ? nrpages : 0;
+	p->i_mtime = i_mtime;
+	p->info = TRUE;
+
+	return TRUE;
+}
+
+static void
+tree_fill_node(inode_info_t *p, uint node)
+{
+	cindex_node_t *n = &cindex.nodes[node];
+
+	p->node = node;
+	p->dentry = n->dentry;
+	p->d_unhashed = !!(n->flags & CI_UNHASHED);
+	if (n->flags & CI_NEGATIVE)
+		return;
+
+	p->inode = n->inode;
+	p->i_mapping = n->i_mapping;
+	p->i_size = n->i_size;
+	p->nrpages = n->nrpages;
+	p->i_mode = n->i_mode;
+	p->i_mtime.tv_sec = n->mtime_sec;
+	p->i_mtime.tv_nsec = n->mtime_nsec;
+	p->info = TRUE;
+}
+
+/*
+ * Replace a mountpoint with the root of the mounts on it.  Returns FALSE
+ * if the root cannot be read or has no valid inode, to skip it.
+ */
+static int
+tree_follow(tree_t *w, inode_info_t *p)
+{
+	ulong d, m, inode;
+	char *name = p->name;
+
+	if (!p->mounted)
+		return TRUE;
+	p->mounted = FALSE;
+
+	if (p->node) {
+		m = cindex.nodes[p->node].mnt;
+		if (m) {
+			BZERO(p, sizeof(inode_info_t));
+			tree_fill_node(p, m);
+			p->name = name;
+		}
+		return TRUE;
+	}
+
+	m = p->mnt;
+	if ((d = follow_mount(&m, p->dentry)) == p->dentry)
+		return TRUE;
+
+	if (!read_dentry(d, dentry_data, RETURN_ON_ERROR|QUIET)) {
+		error(INFO, "%s: cannot read mounted dentry %lx\n", w->path, d);
+		return FALSE;
+	}
+	inode = ULONG(dentry_data + OFFSET(dentry_d_inode));
+	BZERO(p, sizeof(inode_info_t));
+	p->name = name;
+	p->dentry = d;
+	p->inode = inode;
+	p->mnt = m;
+	if (!tree_inode(w, p)) {
+		error(INFO, "%s: invalid inode\n", w->path);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/*
+ * The children of a directory in the index or the dentry cache.  The name
+ * is valid until the next child.
+ */
+static int
+tree_next(tree_t *w, tree_level_t *lv, inode_info_t *p)
+{
+	cindex_node_t *n;
+
+	BZERO(p, sizeof(inode_info_t));
+	p->mnt = lv->dir.mnt;
+
+	if (lv->dir.node) {
+		n = &cindex.nodes[lv->dir.node];
+		if (lv->child >= n->nr_children)
+			return FALSE;
+		tree_fill_node(p, n->child + lv->child++);
+		p->name = cindex.strtab + cindex.nodes[p->node].name;
+		p->mounted = !!cindex.nodes[p->node].mnt;
+		return TRUE;
+	}
+
+	if (!lv->iter)
+		return FALSE;
+	if (lv->iter++ > 1 && !subdirs_next(&lv->it))
+		return FALSE;
+
+	p->name = get_dentry_name(lv->it.dentry, lv->it.buf, 0); /* no alloc */
+	p->dentry = lv->it.dentry;
+	p->inode = lv->it.inode;
+	p->d_unhashed = lv->it.d_unhashed;
+	/*
+	 * A dentry may be mounted only in another namespace, or without
+	 * d_flags, every dentry may be, so ask the mounts for -xdev.
+	 */
+	p->mounted = lv->it.mounted &&
+		mount_lookup(p->mnt, p->dentry) >= 0;
+
+	return TRUE;
+}
+
+static void
+tree_end(tree_level_t *lv)
+{
+	if (lv->iter)
+		subdirs_end(&lv->it);
+	lv->iter = 0;
+}
+
+static int
+tree_first(tree_t *w, tree_level_t *lv, inode_info_t *p)
+{
+	tree_end(lv);
+	lv->child = 0;
+	if (!lv->dir.node)
+		lv->iter = subdirs_first(&lv->it, lv->dir.dentry) ? 1 : 0;
+
+	return tree_next(w, lv, p);
+}
+
+/* Append the name of a child to the paths of its directory. */
+static int
+tree_path(tree_t *w, tree_level_t *lv, char *name)
+{
+	char *slash = (lv->pathlen == 1 && w->path[0] == '/') ? "" : "/";
+
+	if (lv->pathlen + strlen(slash) + strlen(name) >= PATH_MAX ||
+	    lv->dstlen + 1 + strlen(name) >= PATH_MAX) {
+		error(INFO, "%s/%s: path too long\n", w->path, name);
+		return FALSE;
+	}
+
+	sprintf(w->path + lv->pathlen, "%s%s", slash, name);
+	sprintf(w->dst + lv->dstlen, "/%s", name);
+
+	return TRUE;
+}
+
+static void
+tree_push(tree_t *w, inode_info_t *dir)
+{
+	tree_level_t *lv;
+
+	if (w->nr_levels == w->max_levels) {
+		RESIZEBUF(w->stack, sizeof(tree_level_t) * w->max_levels,
+			sizeof(tree_level_t) * w->max_levels * 2);
+		w->max_levels *= 2;
+	}
+
+	lv = &w->stack[w->nr_levels];
+	BZERO(lv, sizeof(tree_level_t));
+	lv->dir = *dir;
+	lv->dir.name = NULL;
+	lv->depth = w->nr_levels++;
+	lv->pathlen = strlen(w->path);
+	lv->dstlen = strlen(w->dst);
+}
+
+static void
+tree_walk(tree_t *w, inode_info_t *root, char *path, char *dst)
+{
+	tree_level_t *lv;
+	inode_info_t child;
+	int ok;
+
+	snprintf(w->path, PATH_MAX, "%s", path);
+	snprintf(w->dst, PATH_MAX, "%s", dst ? dst : "");
+	w->max_levels = 16;
+	w->stack = (tree_level_t *)GETBUF(sizeof(tree_level_t) *
+			w->max_levels);
+	w->nr_levels = 0;
+	tree_push(w, root);
+
+	while (w->nr_levels) {
+		/* The stack may have moved with a push. */
+		lv = &w->stack[w->nr_levels - 1];
+		w->path[lv->pathlen] = '\0';
+		w->dst[lv->dstlen] = '\0';
+
+		if (!lv->entered) {
+			lv->entered = TRUE;
+			if (w->enter && !w->enter(w, lv)) {
+				w->nr_levels--;
+				continue;
+			}
+			ok = w->next ? w->next(w, lv, &child) :
+				tree_first(w, lv, &child);
+		} else
+			ok = w->next ? w->next(w, lv, &child) :
+				tree_next(w, lv, &child);
+
+		if (!ok) {
+			tree_end(lv);
+			if (w->leave)
+				w->leave(w, lv);
+			w->nr_levels--;
+			continue;
+		}
+
+		if (tree_path(w, lv, child.name) &&
+		    w->visit(w, lv, &child) == TREE_DESCEND &&
+		    tree_follow(w, &child))
+			tree_push(w, &child);
+	}
+
+	FREEBUF(w->stack);
+}
+
+static void
+rec_inode(ulong dentry, ulong inode, ulong nrpages, ulonglong i_size,
+	uint i_mode, struct timespec *i_mtime, char *path)
+{
+	rec_begin("inode");
+	rec_hex("dentry", dentry);
+	rec_hex("inode", inode);
+	rec_num("nrpages", nrpages);
+	rec_num("percent", calc_cached_percent(nrpages, i_size));
+	rec_num("mode", i_mode);
+	rec_num("size", i_size);
+	rec_time("mtime", i_mtime);
+	rec_str("path", path);
+	rec_end();
+}
+
+static void
+rec_negdent(ulong dentry, int d_unhashed, char *path)
+{
+	rec_begin("negdent");
+	rec_hex("dentry", dentry);
+	rec_num("unhashed", d_unhashed);
+	rec_str("path", path);
+	rec_end();
+}
+
+static void
+show_inode_info(inode_info_t *p, char *src)
+{
+	if (rec.format) {
+		char path[PATH_MAX];
+
+		snprintf(path, PATH_MAX, "%s%s%s", src,
+			(src[1] == '\0') ? "" : "/", p->name);
+		if (p->i_mapping)
+			rec_inode(p->dentry, p->inode, p->nrpages,
+				p->i_size, p->i_mode, &p->i_mtime, path);
+		else
+			rec_negdent(p->dentry, p->d_unhashed, path);
+
+	} else if (p->i_mapping) {
+		int pct = calc_cached_percent(p->nrpages, p->i_size);
+
+		if (flags & SHOW_INFO_LONG) {
+			fprintf(fp, dentry_lfmt, p->dentry, p->inode,
+				p->nrpages, pct, p->i_mode, p->i_size,
+				get_strtime(&p->i_mtime), p->name,
+				get_type_indicator(p->i_mode, p->inode));
+			if (CRASHDEBUG(1))
+				fprintf(fp,
+				    "  i_mapping:%-16lx i_mtime:%ld.%09ld\n",
+					p->i_mapping, p->i_mtime.tv_sec,
+					p->i_mtime.tv_nsec);
+		} else {
+			fprintf(fp, dentry_fmt, p->dentry, p->inode,
+				p->nrpages, pct, p->name,
+				get_type_indicator(p->i_mode, p->inode));
+			if (CRASHDEBUG(1))
+				fprintf(fp, "  i_mapping:%-16lx\n",
+					p->i_mapping);
+		}
+
+	} else if (flags & SHOW_INFO_NEG_DENTS) {
+		char buf[NAME_MAX+3]; /* brackets and null byte */
+		char *name;
+		if (p->d_unhashed) {
+			snprintf(buf, sizeof(buf), "(%s)", p->name);
+			name = buf;
+		} else
+			name = p->name;
+
+		if (flags & SHOW_INFO_LONG)
+			fprintf(fp, negdent_lfmt, p->dentry, "-",
+				"-", "-", "-", "-", "-", name);
+		else
+			fprintf(fp, negdent_fmt, p->dentry, "-",
+				"-", "-", name);
+	}
+}
+
+/*
+ * A directory is listed in chunks of CLS_CHUNK entries, so that cls runs
+ * in bounded memory however many dentries it has.  A directory that fits
+ * in a chunk is sorted and listed in memory.  Otherwise with -U, each chunk
+ * is listed when it fills, and without -U, each chunk is sorted and written
+ * to a temporary file as a run, and the runs are merged for the listing.
+ * At most CLS_MERGE_FANIN runs are merged at a time, into a longer run in
+ * a new temporary file while there are more.  The directories to be listed
+ * with -R after that are written to another temporary file in order.
+ */
+#define CLS_CHUNK		(1024)
+#define CLS_RUN_AHEAD		(16)	/* entries read at a time from a run */
+#define CLS_MERGE_FANIN		(16)
+
+typedef struct {
+	inode_info_t info;
+	char name[NAME_MAX+1];
+} cls_rec_t;
+
+typedef struct {
+	long pos, end;		/* in records */
+} cls_span_t;
+
+typedef struct {
+	long pos, end;		/* in records */
+	int nr, cur;		/* in buf */
+	cls_rec_t buf[CLS_RUN_AHEAD];
+} cls_run_t;
+
+typedef struct {
+	char *src;
+	int (*cmp)(const void *, const void *);
+	int spilled;
+	FILE *runs;
+	long nr_recs;		/* in runs */
+	cls_span_t *span;	/* of the runs */
+	int nr_runs, max_runs;
+	cls_run_t *run;		/* the runs being merged */
+	FILE *dirs;		/* for -R, if spilled */
+	inode_info_t *list;	/* or in memory */
+	int count, pos;
+	cls_rec_t rec;
+} cls_ctx_t;
+
+static FILE *
+cls_tmpfile(void)
+{
+	FILE *f;
+
+	if (!(f = tmpfile()))
+		error(FATAL, "cannot create temporary file: %s\n",
+			strerror(errno));
+	return f;
+}
+
+static void
+cls_write(FILE *f, inode_info_t *p)
+{
+	cls_rec_t r;
+
+	BZERO(&r, sizeof(cls_rec_t));
+	r.info = *p;
+	strncpy(r.name, p->name, NAME_MAX);
+	if (fwrite(&r, sizeof(cls_rec_t), 1, f) != 1)
+		error(FATAL, "cannot write temporary file: %s\n",
+			strerror(errno));
+}
+
+/* the next entry of a run, or NULL at its end */
+static inode_info_t *
+cls_peek(cls_ctx_t *c, cls_run_t *run)
+{
+	int i;
+
+	if (run->cur == run->nr) {
+		run->nr = MIN(CLS_RUN_AHEAD, run->end - run->pos);
+		run->cur = 0;
+		if (!run->nr)
+			return NULL;
+		if (fseek(c->runs, run->pos * sizeof(cls_rec_t), SEEK_SET) < 0 ||
+		    fread(run->buf, sizeof(cls_rec_t), run->nr, c->runs) !=
+		    run->nr)
+			error(FATAL, "cannot read temporary file\n");
+		run->pos += run->nr;
+		for (i = 0; i < run->nr; i++)
+			run->buf[i].info.name = run->buf[i].name;
+	}
+
+	return &run->buf[run->cur].info;
+}
+
+static void
+cls_emit(cls_ctx_t *c, inode_info_t *p)
+{
+	show_inode_info(p, c->src);
+
+	if ((flags & SHOW_INFO_RECURSIVE) && S_ISDIR(p->i_mode)) {
+		if (!c->dirs)
+			c->dirs = cls_tmpfile();
+		cls_write(c->dirs, p);
+	}
+}
+
+/* List or write out the chunk, and free its names. */
+static void
+cls_spill(cls_ctx_t *c, inode_info_t *list, int count)
+{
+	int i;
+
+	c->spilled = TRUE;
+
+	if (!c->cmp) {
+		for (i = 0; i < count; i++)
+			cls_emit(c, &list[i]);
+	} else if (count) {
+		qsort(list, count, sizeof(inode_info_t), c->cmp);
+		if (!c->runs)
+			c->runs = cls_tmpfile();
+		if (c->nr_runs == c->max_runs) {
+			RESIZEBUF(c->span, sizeof(cls_span_t) * c->max_runs,
+				sizeof(cls_span_t) * c->max_runs * 2);
+			c->max_runs *= 2;
+		}
+		c->span[c->nr_runs].pos = c->nr_recs;
+		for (i = 0; i < count; i++)
+			cls_write(c->runs, &list[i]);
+		c->nr_recs += count;
+		c->span[c->nr_runs].end = c->nr_recs;
+		c->nr_runs++;
+	}
+
+	for (i = 0; i < count; i++)
+		free(list[i].name);
+}
+
+static int
+cls_heap_less(cls_ctx_t *c, int *heap, int a, int b)
+{
+	return c->cmp(cls_peek(c, &c->run[heap[a]]),
+		cls_peek(c, &c->run[heap[b]])) < 0;
+}
+
+static void
+cls_heap_down(cls_ctx_t *c, int *heap, int nr, int i)
+{
+	int child, tmp;
+
+	while ((child = i * 2 + 1) < nr) {
+		if (child + 1 < nr && cls_heap_less(c, heap, child + 1, child))
+			child++;
+		if (!cls_heap_less(c, heap, child, i))
+			break;
+		tmp = heap[i];
+		heap[i] = heap[child];
+		heap[child] = tmp;
+		i = child;
+	}
+}
+
+/*
+ * Merge n runs from the first one, and write them to out, or list them
+ * if out is NULL.
+ */
+static void
+cls_merge_runs(cls_ctx_t *c, int first, int n, FILE *out)
+{
+	int i, nr, heap[CLS_MERGE_FANIN];
+
+	for (i = nr = 0; i < n; i++) {
+		c->run[i].pos = c->span[first + i].pos;
+		c->run[i].end = c->span[first + i].end;
+		c->run[i].nr = c->run[i].cur = 0;
+		if (cls_peek(c, &c->run[i]))
+			heap[nr++] = i;
+	}
+	for (i = nr / 2 - 1; i >= 0; i--)
+		cls_heap_down(c, heap, nr, i);
+
+	while (nr) {
+		if (out)
+			cls_write(out, cls_peek(c, &c->run[heap[0]]));
+		else
+			cls_emit(c, cls_peek(c, &c->run[heap[0]]));
+		c->run[heap[0]].cur++;
+		if (!cls_peek(c, &c->run[heap[0]]))
+			heap[0] = heap[--nr];
+		cls_heap_down(c, heap, nr, 0);
+	}
+}
+
+static void
+cls_merge(cls_ctx_t *c)
+{
+	FILE *out;
+	int i, n, nr;
+
+	c->run = (cls_run_t *)GETBUF(sizeof(cls_run_t) * CLS_MERGE_FANIN);
+
+	for (;;) {
+		if (fflush(c->runs))
+			error(FATAL, "cannot write temporary file: %s\n",
+				strerror(errno));
+		if (c->nr_runs <= CLS_MERGE_FANIN)
+			break;
+
+		/* a pass to merge every CLS_MERGE_FANIN runs into one */
+		out = cls_tmpfile();
+		for (i = nr = 0; i < c->nr_runs; i += n, nr++) {
+			n = MIN(CLS_MERGE_FANIN, c->nr_runs - i);
+			cls_merge_runs(c, i, n, out);
+			c->span[nr].pos = c->span[i].pos;
+			c->span[nr].end = c->span[i + n - 1].end;
+		}
+		fclose(c->runs);
+		c->runs = out;
+		c->nr_runs = nr;
+	}
+
+	cls_merge_runs(c, 0, c->nr_runs, NULL);
+	FREEBUF(c->run);
+}
+
+/* The listing of a directory, before its subdirectories with -R. */
+static int
+cls_enter(tree_t *w, tree_level_t *lv)
+{
+	int i, ok, size;
+	inode_info_t e, *inode_list, *p;
+	cls_ctx_t *ctx;
+
+	if (lv->depth && !rec.format)
+		fprintf(fp, "\n%s:\n", w->path);
+
+	size = lv->dir.node ?
+		MIN(cindex.nodes[lv->dir.node].nr_children, CLS_CHUNK) : 64;
+	if (!size)
+		return FALSE;
+
+	ctx = (cls_ctx_t *)GETBUF(sizeof(cls_ctx_t));
+	ctx->src = w->path;
+	if (!(flags & SHOW_INFO_DONT_SORT))
+		ctx->cmp = (flags & SHOW_INFO_SORT_MTIME) ?
+				sort_by_mtime : sort_by_name;
+	ctx->max_runs = 16;
+	ctx->span = (cls_span_t *)GETBUF(sizeof(cls_span_t) * ctx->max_runs);
+
+	inode_list = (inode_info_t *)GETBUF(sizeof(inode_info_t) * size);
+	p = inode_list;
+
+	for (ok = tree_first(w, lv, &e); ok; ok = tree_next(w, lv, &e)) {
+		if (p - inode_list == size) {
+			if (size == CLS_CHUNK) {
+				cls_spill(ctx, inode_list, CLS_CHUNK);
+				p = inode_list;
+			} else {
+				RESIZEBUF(inode_list,
+					sizeof(inode_info_t) * size,
+					sizeof(inode_info_t) * size * 2);
+				p = inode_list + size;
+				size *= 2;
+			}
+		}
+
+		if (!tree_inode(w, &e) && !(flags & SHOW_INFO_NEG_DENTS))
+			continue;
+		*p = e;
+		p->name = strdup(e.name);
+		p++;
+	}
+	tree_end(lv);
+	ctx->count = p - inode_list;
+
+	if (ctx->spilled) {
+		cls_spill(ctx, inode_list, ctx->count);
+		FREEBUF(inode_list);
+		if (ctx->runs) {
+			cls_merge(ctx);
+			fclose(ctx->runs);
+		}
+		if (ctx->dirs)
+			rewind(ctx->dirs);
+	} else {
+		if (ctx->cmp)
+			qsort(inode_list, ctx->count, sizeof(inode_info_t),
+				ctx->cmp);
+		for (i = 0; i < ctx->count; i++)
+			show_inode_info(&inode_list[i], w->path);
+		ctx->list = inode_list;
+	}
+	FREEBUF(ctx->span);
+
+	lv->data = ctx;
+	return TRUE;
+}
+
+/* The subdirectories with -R, in the listed order */
+static int
+cls_next(tree_t *w, tree_level_t *lv, inode_info_t *p)
+{
+	cls_ctx_t *ctx = (cls_ctx_t *)lv->data;
+
+	if (!(flags & SHOW_INFO_RECURSIVE))
+		return FALSE;
+
+	if (ctx->spilled) {
+		if (!ctx->dirs ||
+		    fread(&ctx->rec, sizeof(cls_rec_t), 1, ctx->dirs) != 1)
+			return FALSE;
+		*p = ctx->rec.info;
+		p->name = ctx->rec.name;
+		return TRUE;
+	}
+
+	while (ctx->pos < ctx->count) {
+		*p = ctx->list[ctx->pos++];
+		if (S_ISDIR(p->i_mode))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+static int
+cls_visit(tree_t *w, tree_level_t *lv, inode_info_t *p)
+{
+	return TREE_DESCEND;
+}
+
+static void
+cls_leave(tree_t *w, tree_level_t *lv)
+{
+	cls_ctx_t *ctx = (cls_ctx_t *)lv->data;
+	int i;
+
+	if (ctx->dirs)
+		fclose(ctx->dirs);
+	if (ctx->list) {
+		for (i = 0; i < ctx->count; i++)
+			free(ctx->list[i].name);
+		FREEBUF(ctx->list);
+	}
+	FREEBUF(ctx);
+}
+
+static void
+show_subdirs_info(ulong dentry, ulong mnt, uint node, char *src)
+{
+	tree_t w;
+	inode_info_t root;
+
+	BZERO(&w, sizeof(tree_t));
+	w.nrpages = TRUE;
+	w.enter = cls_enter;
+	w.next = cls_next;
+	w.visit = cls_visit;
+	w.leave = cls_leave;
+
+	BZERO(&root, sizeof(inode_info_t));
+	root.dentry = dentry;
+	root.mnt = mnt;
+	root.node = node;
+
+	tree_walk(&w, &root, src, NULL);
+}
+
+/*
+ * The mounts of a namespace are hashed by the parent mount and the
+ * mountpoint dentry, so that a walk crosses into a mount only at dentries
+ * marked as mounted, as the kernel does, without comparing paths.  The
+ * list is cached as the number of mounts and the mount_info_t array.
+ */
+static ulong
+get_mnt_ns(void)
+{
+	ulong nsproxy, mnt_ns;
+
+	if (!VALID_MEMBER(task_struct_nsproxy) ||
+	    !VALID_MEMBER(nsproxy_mnt_ns))
+		return 0;
+
+	if (!readmem(tc->task + OFFSET(task_struct_nsproxy), KVADDR, &nsproxy,
+	    sizeof(ulong), "task_struct.nsproxy", RETURN_ON_ERROR|QUIET) ||
+	    !nsproxy || !readmem(nsproxy + OFFSET(nsproxy_mnt_ns), KVADDR,
+	    &mnt_ns, sizeof(ulong), "nsproxy.mnt_ns", RETURN_ON_ERROR|QUIET))
+		return tc->task;
+
+	return mnt_ns;
+}
+
+static ulong
+mount_bucket(ulong parent, ulong mountpoint)
+{
+	ulonglong h = ((ulonglong)parent * 0x9E3779B97F4A7C15ULL) ^ mountpoint;
+
+	return (h * 0x9E3779B97F4A7C15ULL >> 32) & mount_hash_mask;
+}
+
+static void
+hash_mounts(void)
+{
+	ulong i, b;
+	mount_info_t *m;
+
+	for (mount_hash_mask = 1; mount_hash_mask < mount_count * 2; )
+		mount_hash_mask <<= 1;
+	mount_hash = (int *)GETBUF(sizeof(int) * mount_hash_mask);
+	memset(mount_hash, 0xff, sizeof(int) * mount_hash_mask);
+	mount_hash_mask--;
+
+	/* A later mount on the same mountpoint replaces the former. */
+	for (i = 0; i < mount_count; i++) {
+		m = &mount_info[i];
+		for (b = mount_bucket(m->parent, m->mountpoint);
+		     mount_hash[b] >= 0; b = (b + 1) & mount_hash_mask) {
+			if (mount_info[mount_hash[b]].parent == m->parent &&
+			    mount_info[mount_hash[b]].mountpoint == m->mountpoint)
+				break;
+		}
+		mount_hash[b] = i;
+	}
+}
+
+static int
+load_mounts(void)
+{
+	ulong *mount_list, mnt_ns, size;
+	char *mount_buf, *data;
+	mount_info_t *m;
+	int i;
+
+	if (mount_info)
+		return TRUE;
+
+	mnt_ns = get_mnt_ns();
+	if ((data = cc_lookup(CC_MOUNTS, mnt_ns, &size))) {
+		mount_count = size / sizeof(mount_info_t);
+		mount_info = (mount_info_t *)GETBUF(MAX(size,
+					sizeof(mount_info_t)));
+		memcpy(mount_info, data, size);
+		hash_mounts();
+		return TRUE;
+	}
+
+	size = VALID_STRUCT(mount) ? SIZE(mount) : SIZE(vfsmount);
+	mount_list = get_mount_list(&mount_count, tc);
+	mount_buf = GETBUF(size);
+	mount_info = (mount_info_t *)GETBUF(sizeof(mount_info_t) *
+				MAX(mount_count, 1));
+
+	for (i = 0; i < mount_count; i++) {
+		if (!readmem(mount_list[i], KVADDR, mount_buf, size,
+		    "(vfs)mount buffer", RETURN_ON_ERROR)) {
+			FREEBUF(mount_buf);
+			FREEBUF(mount_list);
+			FREEBUF(mount_info);
+			mount_info = NULL;
+			mount_count = 0;
+			return FALSE;
+		}
+
+		m = &mount_info[i];
+		m->mnt = mount_list[i];
+		if (VALID_STRUCT(mount)) {
+			m->parent = ULONG(mount_buf + OFFSET(mount_mnt_parent));
+			m->mountpoint = ULONG(mount_buf +
+				OFFSET(mount_mnt_mountpoint));
+			m->root = ULONG(mount_buf + OFFSET(mount_mnt) +
+				CU_OFFSET(vfsmount_mnt_root));
+		} else {
+			m->parent = ULONG(mount_buf +
+				OFFSET(vfsmount_mnt_parent));
+			m->mountpoint = ULONG(mount_buf +
+				OFFSET(vfsmount_mnt_mountpoint));
+			m->root = ULONG(mount_buf + CU_OFFSET(vfsmount_mnt_root));
+		}
+		if (CRASHDEBUG(2))
+			error(INFO, "mnt:%lx parent:%lx mountpoint:%lx root:%lx\n",
+				m->mnt, m->parent, m->mountpoint, m->root);
+	}
+	FREEBUF(mount_buf);
+	FREEBUF(mount_list);
+
+	cc_insert(CC_MOUNTS, mnt_ns, mount_info,
+		sizeof(mount_info_t) * mount_count);
+	hash_mounts();
+
+	return TRUE;
+}
+
+/*
+ * Returns the index in mount_info of the mount on the dentry in mnt,
+ * or -1 if not mounted.
+ */
+static int
+mount_lookup(ulong mnt, ulong dentry)
+{
+	ulong b;
+	int i;
+
+	if (!load_mounts())
+		return -1;
+
+	for (b = mount_bucket(mnt, dentry); (i = mount_hash[b]) >= 0;
+	     b = (b + 1) & mount_hash_mask) {
+		if (mount_info[i].parent == mnt &&
+		    mount_info[i].mountpoint == dentry)
+			break;
+	}
+
+	return i;
+}
+
+/*
+ * Returns the root dentry of the mounts stacked on the dentry in *mnt,
+ * and updates *mnt to the top mount, or returns the dentry itself.
+ */
+static ulong
+follow_mount(ulong *mnt, ulong dentry)
+{
+	int i, depth;
+
+	if (!load_mounts())
+		return dentry;
+
+	for (depth = 0; depth < mount_count; depth++) {
+		if ((i = mount_lookup(*mnt, dentry)) < 0)
+			break;
+		if (CRASHDEBUG(2))
+			error(INFO, "dentry:%lx mnt:%lx -> mnt:%lx root:%lx\n",
+				dentry, *mnt, mount_info[i].mnt,
+				mount_info[i].root);
+		*mnt = mount_info[i].mnt;
+		dentry = mount_info[i].root;
+	}
+
+	return dentry;
+}
+
+/*
+ * The root dentry of the namespace, and its mount in *mnt.  The root
+ * mount is its own parent.
+ */
+static ulong
+get_root_dentry(ulong *mnt)
+{
+	int i;
+
+	if (!load_mounts() || !mount_count)
+		return 0;
+
+	for (i = 0; i < mount_count; i++)
+		if (mount_info[i].parent == mount_info[i].mnt)
+			break;
+	if (i == mount_count)
+		i = 0;
+
+	*mnt = mount_info[i].mnt;
+
+	return follow_mount(mnt, mount_info[i].root);
+}
+
+/*
+ * Lookup of a path component in dentry_hashtable like d_lookup(), instead
+ * of reading all the children of the parent.  The name hash and the bucket
+ * index have changed with kernel versions and architectures, so they are
+ * chosen with the first hashed dentry found by the list scan: the name hash
+ * must equal its d_name.hash, and the index its bucket, which is found by
+ * following the d_hash.pprev pointers back.  If none matches, or a name is
+ * not found in the table, the list scan is used.
+ */
+#define DHASH_UNTESTED		(0)
+#define DHASH_OK		(1)
+#define DHASH_NONE		(2)
+
+/* name hashes */
+#define NAME_WORD64_SALT	(0)	/* 4.8 and later, word at a time */
+#define NAME_WORD32_SALT	(1)
+#define NAME_BYTE_SALT		(2)	/* 4.8 and later, byte at a time */
+#define NAME_WORD64_HASH64	(3)	/* 4.7 */
+#define NAME_WORD64		(4)	/* 4.6 and older */
+#define NR_NAME_HASHES		(5)
+
+/* bucket indexes */
+#define BUCKET_SHIFT		(0)	/* 4.17 and later */
+#define BUCKET_HASH32		(1)	/* 4.8 to 4.16 */
+#define BUCKET_PARENT_HASH32	(2)	/* 4.7 */
+#define BUCKET_PARENT_PRIME32	(3)	/* 3.17 to 4.6 */
+#define BUCKET_PARENT_MASK	(4)	/* 3.16 and older */
+#define NR_BUCKETS		(5)
+
+#define GOLDEN_RATIO_32		(0x61C88647U)
+#define GOLDEN_RATIO_64		(0x61C8864680B583EBULL)
+#define GOLDEN_RATIO_PRIME_32	(0x9e370001U)
+
+#define DHASH_MAX_CHAIN		(4096)	/* against a corrupted chain */
+
+static struct {
+	int state;
+	int name_hash, bucket;
+	ulong l1;		/* L1_CACHE_BYTES for the parent salt */
+	ulong table, nr_buckets, shift, mask;
+} dhash;
+
+#define ROL64(x, n)	(((x) << (n)) | ((x) >> (64 - (n))))
+#define ROL32(x, n)	((uint)(((x) << (n)) | ((x) >> (32 - (n)))))
+
+/*
+ * full_name_hash() of the kernel, which is equal to hash_name() for a
+ * path component.  A word is loaded as little-endian like x86, arm64 and
+ * ppc64le, the architectures with CONFIG_DCACHE_WORD_ACCESS.
+ */
+static uint
+dhash_name(int type, ulong salt, char *name, uint len)
+{
+	ulonglong a, x, y, hash;
+	uint x32, y32, a32, n, w;
+
+	w = (type == NAME_WORD32_SALT) ? 4 : 8;
+	x = hash = 0;
+	y = salt;
+	x32 = 0;
+	y32 = salt;
+
+	if (type == NAME_BYTE_SALT) {
+		for (n = 0; n < len; n++) {
+			a = (unsigned char)name[n];
+			y = (y + (a << 4) + (a >> 4)) * 11;
+		}
+		/* hash_long(hash, 32) */
+		if (BITS64())
+			return (y * GOLDEN_RATIO_64) >> 32;
+		return (uint)y * GOLDEN_RATIO_32;
+	}
+
+	for (; len; name += w, len -= n) {
+		n = MIN(len, w);
+		a = 0;
+		memcpy(&a, name, n);	/* zero-padded like the kernel's mask */
+
+		switch (type)
+		{
+		case NAME_WORD64_SALT:
+			x ^= a;
+			if (n < w)
+				break;
+			y ^= x; x = ROL64(x, 12);
+			x += y; y = ROL64(y, 45);
+			y *= 9;
+			break;
+		case NAME_WORD32_SALT:
+			a32 = a;
+			x32 ^= a32;
+			if (n < w)
+				break;
+			y32 ^= x32; x32 = ROL32(x32, 7);
+			x32 += y32; y32 = ROL32(y32, 20);
+			y32 *= 9;
+			break;
+		default:
+			hash += a;
+			if (n == w)
+				hash *= 9;
+			break;
+		}
+	}
+
+	switch (type)
+	{
+	case NAME_WORD64_SALT:
+		y ^= x * GOLDEN_RATIO_64;
+		y *= GOLDEN_RATIO_64;
+		return y >> 32;
+	case NAME_WORD32_SALT:
+		return (y32 ^ (x32 * GOLDEN_RATIO_32)) * GOLDEN_RATIO_32;
+	case NAME_WORD64_HASH64:
+		return (hash * GOLDEN_RATIO_64) >> 32;
+	default:
+		return hash + (hash >> 32);
+	}
+}
+
+static ulong
+dhash_bucket(int type, ulong l1, ulong parent, uint hash)
+{
+	uint h = hash + parent / l1;
+
+	switch (type)
+	{
+	case BUCKET_SHIFT:
+		return hash >> dhash.shift;
+	case BUCKET_HASH32:
+		return (hash * GOLDEN_RATIO_32) >> (32 - dhash.shift);
+	case BUCKET_PARENT_HASH32:
+		return (h * GOLDEN_RATIO_32) >> (32 - dhash.shift);
+	case BUCKET_PARENT_PRIME32:
+		return (h * GOLDEN_RATIO_PRIME_32) >> (32 - dhash.shift);
+	default:
+		return (h + (h >> dhash.shift)) & dhash.mask;
+	}
+}
+
+static int
+dhash_init(void)
+{
+	uint shift, mask;
+
+	if (CU_INVALID_MEMBER(qstr_hash) || CU_INVALID_MEMBER(dentry_d_hash) ||
+	    !symbol_exists("dentry_hashtable") ||
+	    !symbol_exists("d_hash_shift") ||
+	    !get_symbol_data("dentry_hashtable", sizeof(ulong), &dhash.table) ||
+	    !get_symbol_data("d_hash_shift", sizeof(uint), &shift) ||
+	    !dhash.table)
+		return FALSE;
+
+	dhash.shift = shift;
+	if (symbol_exists("d_hash_mask")) {
+		if (!get_symbol_data("d_hash_mask", sizeof(uint), &mask))
+			return FALSE;
+		dhash.mask = mask;
+		dhash.nr_buckets = (ulong)mask + 1;
+	} else if (shift > 0 && shift < 32) {
+		/* 4.17 and later: 854d3e63438d */
+		dhash.nr_buckets = 1UL << (32 - shift);
+	} else
+		return FALSE;
+
+	return TRUE;
+}
+
+/*
+ * Choose the name hash and the bucket index with a dentry found by the
+ * list scan.
+ */
+static void
+dhash_calibrate(ulong dentry, char *dentry_buf, ulong parent, char *name)
+{
+	static ulong l1s[] = { 64, 128, 32 };
+	ulong addr, bucket, i, b, l;
+	uint hash, len;
+	int n;
+
+	if (dhash.state == DHASH_UNTESTED && !dhash_init()) {
+		dhash.state = DHASH_NONE;
+		return;
+	}
+
+	/* An unhashed dentry tells nothing. */
+	addr = ULONG(dentry_buf + CU_OFFSET(dentry_d_hash) +
+		CU_OFFSET(hlist_bl_node_pprev));
+	for (i = 0; i < DHASH_MAX_CHAIN && addr; i++) {
+		if (addr >= dhash.table &&
+		    addr < dhash.table + sizeof(ulong) * dhash.nr_buckets)
+			break;
+		/* &prev->next, which is the prev node */
+		if (!readmem(addr + CU_OFFSET(hlist_bl_node_pprev), KVADDR,
+		    &addr, sizeof(ulong), "hlist_bl_node.pprev",
+		    RETURN_ON_ERROR))
+			return;
+	}
+	if (i == DHASH_MAX_CHAIN || !addr)
+		return;
+	bucket = (addr - dhash.table) / sizeof(ulong);
+
+	hash = UINT(dentry_buf + OFFSET(dentry_d_name) + CU_OFFSET(qstr_hash));
+	len = strlen(name);
+
+	dhash.state = DHASH_NONE;
+	for (n = 0; n < NR_NAME_HASHES; n++) {
+		/* the word size of the dump's kernel */
+		if ((n == NAME_WORD32_SALT && BITS64()) ||
+		    (n != NAME_WORD32_SALT && n != NAME_BYTE_SALT && !BITS64()))
+			continue;
+		if (dhash_name(n, parent, name, len) == hash)
+			break;
+	}
+	if (n == NR_NAME_HASHES)
+		goto out;
+	dhash.name_hash = n;
+
+	for (b = 0; b < NR_BUCKETS; b++) {
+		if ((b == BUCKET_SHIFT) == (dhash.mask != 0))
+			continue;
+		for (l = 0; l < sizeof(l1s) / sizeof(ulong); l++) {
+			if (dhash_bucket(b, l1s[l], parent, hash) == bucket) {
+				dhash.bucket = b;
+				dhash.l1 = l1s[l];
+				dhash.state = DHASH_OK;
+				goto out;
+			}
+		}
+	}
+out:
+	if (CRASHDEBUG(1))
+		error(INFO, "dentry_hashtable: %s (name hash %d, bucket %d)\n",
+			dhash.state == DHASH_OK ? "used" : "not used",
+			dhash.name_hash, dhash.bucket);
+}
+
+/*
+ * Returns the hashed child dentry of parent named name, read in dentry_buf.
+ */
+static ulong
+dhash_lookup(ulong parent, char *name, char *dentry_buf)
+{
+	ulong node, dentry, i;
+	uint hash, len;
+
+	len = strlen(name);
+	hash = dhash_name(dhash.name_hash, parent, name, len);
+	node = dhash.table + sizeof(ulong) * dhash_bucket(dhash.bucket,
+		dhash.l1, parent, hash);
+
+	if (!readmem(node, KVADDR, &node, sizeof(ulong),
+	    "dentry_hashtable", RETURN_ON_ERROR))
+		return 0;
+	node &= ~1UL;	/* the bit lock of hlist_bl_head */
+
+	for (i = 0; node && i < DHASH_MAX_CHAIN; i++) {
+		dentry = node - CU_OFFSET(dentry_d_hash);
+		if (!read_dentry(dentry, dentry_buf, RETURN_ON_ERROR))
+			return 0;
+
+		if (ULONG(dentry_buf + OFFSET(dentry_d_parent)) == parent &&
+		    UINT(dentry_buf + OFFSET(dentry_d_name) +
+			CU_OFFSET(qstr_hash)) == hash &&
+		    UINT(dentry_buf + OFFSET(dentry_d_name) +
+			OFFSET(qstr_len)) == len &&
+		    STREQ(get_dentry_name(dentry, dentry_buf, 0), name))
+			return dentry;
+
+		node = ULONG(dentry_buf + CU_OFFSET(dentry_d_hash));
+	}
+
+	return 0;
+}
+
+static void
+cindex_close(void)
+{
+	if (cindex.map)
+		munmap(cindex.map, cindex.map_size);
+	cindex.map = NULL;
+	cindex.hdr = NULL;
+	cindex.nodes = NULL;
+	cindex.strtab = NULL;
+	cindex.use = -1;
+}
+
+/*
+ * The identity of the dumpfile: the utsname, the size and the first
+ * CINDEX_ID_BYTES bytes of the file.
+ */
+static int
+cindex_identity(ulonglong *id)
+{
+	struct stat st;
+	char *buf;
+	ssize_t len;
+	int fd;
+
+	if (ACTIVE() || !pc->dumpfile)
+		return FALSE;
+	if ((fd = open(pc->dumpfile, O_RDONLY)) < 0)
+		return FALSE;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return FALSE;
+	}
+
+	buf = GETBUF(sizeof(kt->utsname) + sizeof(st.st_size) +
+		CINDEX_ID_BYTES);
+	memcpy(buf, &kt->utsname, sizeof(kt->utsname));
+	memcpy(buf + sizeof(kt->utsname), &st.st_size, sizeof(st.st_size));
+	len = read(fd, buf + sizeof(kt->utsname) + sizeof(st.st_size),
+		CINDEX_ID_BYTES);
+	close(fd);
+	if (len < 0) {
+		FREEBUF(buf);
+		return FALSE;
+	}
+
+	hash128(buf, sizeof(kt->utsname) + sizeof(st.st_size) + len, id);
+	FREEBUF(buf);
+
+	return TRUE;
+}
+
+/*
+ * Check the references in the nodes not to go out of the file.
+ */
+static int
+cindex_check(cindex_header_t *hdr, char *data)
+{
+	cindex_node_t *nodes = (cindex_node_t *)data;
+	char *strtab = (char *)(nodes + hdr->nr_nodes);
+	uint i, nr = hdr->nr_nodes;
+
+	if (!hdr->strtab_size || strtab[hdr->strtab_size - 1] != '\0')
+		return FALSE;
+
+	for (i = 1; i < nr; i++) {
+		if (nodes[i].name >= hdr->strtab_size ||
+		    nodes[i].parent >= nr || nodes[i].mnt >= nr ||
+		    nodes[i].child > nr ||
+		    nodes[i].nr_children > nr - nodes[i].child)
+			return FALSE;
+		/* breadth-first, so no loop */
+		if ((nodes[i].nr_children && nodes[i].child <= i) ||
+		    (nodes[i].mnt && nodes[i].mnt <= i))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static int
+cindex_load(char *path, int verbose)
+{
+	struct stat st;
+	cindex_header_t *hdr;
+	ulonglong id[2];
+	char *map;
+	int fd;
+
+	cindex_close();
+
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		if (verbose)
+			error(INFO, "%s: cannot open: %s\n", path,
+				strerror(errno));
+		return FALSE;
+	}
+	if (fstat(fd, &st) < 0 || st.st_size < sizeof(cindex_header_t)) {
+		if (verbose)
+			error(INFO, "%s: invalid index\n", path);
+		close(fd);
+		return FALSE;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		if (verbose)
+			error(INFO, "%s: cannot mmap: %s\n", path,
+				strerror(errno));
+		return FALSE;
+	}
+
+	hdr = (cindex_header_t *)map;
+	if (memcmp(hdr->magic, CINDEX_MAGIC, sizeof(hdr->magic)) ||
+	    hdr->node_size != sizeof(cindex_node_t) || hdr->nr_nodes < 2 ||
+	    sizeof(cindex_header_t) + (ulonglong)hdr->nr_nodes *
+	    sizeof(cindex_node_t) + hdr->strtab_size != st.st_size) {
+		if (verbose)
+			error(INFO, "%s: invalid index\n", path);
+		munmap(map, st.st_size);
+		return FALSE;
+	}
+	if (!cindex_check(hdr, map + sizeof(cindex_header_t))) {
+		if (verbose)
+			error(INFO, "%s: corrupted index\n", path);
+		munmap(map, st.st_size);
+		return FALSE;
+	}
+	if (!cindex_identity(id) || id[0] != hdr->id[0] || id[1] != hdr->id[1]) {
+		if (verbose)
+			error(INFO, "%s: built from another dumpfile\n", path);
+		munmap(map, st.st_size);
+		return FALSE;
+	}
+
+	cindex.map = map;
+	cindex.map_size = st.st_size;
+	cindex.hdr = hdr;
+	cindex.nodes = (cindex_node_t *)(map + sizeof(cindex_header_t));
+	cindex.strtab = (char *)(cindex.nodes + hdr->nr_nodes);
+	strncpy(cindex.path, path, PATH_MAX - 1);
+
+	if (CRASHDEBUG(1))
+		error(INFO, "%s: %u nodes\n", path, hdr->nr_nodes - 1);
+
+	return TRUE;
+}
+
+/*
+ * Whether the index can be used for the current command, loading the
+ * file next to the dumpfile at the first time.
+ */
+static int
+cindex_enabled(void)
+{
+	char path[PATH_MAX];
+
+	if (!cindex.tried) {
+		cindex.tried = TRUE;
+		if (!ACTIVE() && pc->dumpfile) {
+			snprintf(path, PATH_MAX, "%s%s", pc->dumpfile,
+				CINDEX_SUFFIX);
+			cindex_load(path, FALSE);
+		}
+	}
+
+	if (cindex.use < 0)
+		cindex.use = cindex.map && cindex.hdr->mnt_ns == get_mnt_ns();
+
+	return cindex.use;
+}
+
+/*
+ * Returns the node of a normalized absolute path, or the root node of the
+ * mount on it, or 0 if not found or negative.
+ */
+static uint
+cindex_lookup(char *path)
+{
+	cindex_node_t *node;
+	char *p, *s, *name;
+	uint n, i, end;
+	size_t len;
+
+	if (!cindex_enabled())
+		return 0;
+
+	n = 1;
+	for (p = path; *p; p = s) {
+		while (*p == '/')
+			p++;
+		if (*p == '\0')
+			break;
+		s = strchrnul(p, '/');
+		len = s - p;
+
+		node = &cindex.nodes[cindex_eff(n)];
+		for (i = node->child, end = i + node->nr_children; i < end;
+		     i++) {
+			name = cindex.strtab + cindex.nodes[i].name;
+			if (!(cindex.nodes[i].flags & CI_NEGATIVE) &&
+			    strncmp(name, p, len) == 0 && name[len] == '\0')
+				break;
+		}
+		if (i == end)
+			return 0;
+		n = i;
+	}
+
+	return cindex_eff(n);
+}
+
+/*
+ * Looks up the path from the root of the mount namespace, crossing into
+ * the mounts on the way.  If mnt is given, the mount of the dentry is
+ * returned in it, and the index is not used as it has no mounts.
+ */
+static ulong
+path_to_dentry(char *path, ulong *inode, ulong *mnt)
+{
+	subdirs_iter_t it;
+	int i, ok;
+	ulong d, m, dentry, parent, child;
+	char *path_buf, *dentry_buf, *slash_pos, *path_start, *name;
+	size_t len;
+	uint n;
+
+	if (!mnt && (n = cindex_lookup(path))) {
+		if (inode)
+			*inode = cindex.nodes[n].inode;
+		return cindex.nodes[n].dentry;
+	}
+
+	if (!(d = get_root_dentry(&m))) {
+		error(INFO, "%s: root mount not found\n", path);
+		return 0;
+	}
+
+	len = strlen(path);
+	path_buf = GETBUF(len + 1);
+	memcpy(path_buf, path, len + 1);
+	for (path_start = path_buf; *path_start == '/'; path_start++)
+		;
+
+	dentry = 0;
+	dentry_buf = GETBUF(SIZE(dentry));
+
+	while (strlen(path_start)) {
+		if ((slash_pos = strchr(path_start, '/')))
+			*slash_pos = '\0';
+
+		parent = d;
+		if (dhash.state == DHASH_OK &&
+		    (child = dhash_lookup(parent, path_start, dentry_buf))) {
+			if (CRASHDEBUG(2))
+				error(INFO, "q:%s hashed: d:%lx\n",
+					path_start, child);
+		} else {
+			child = 0;
+			for (i = 0, ok = subdirs_first(&it, parent); ok;
+			     i++, ok = subdirs_next(&it)) {
+				/* no alloc */
+				name = get_dentry_name(it.dentry, it.buf, 0);
+
+				if (CRASHDEBUG(2))
+					error(INFO, "q:%s %3d: d:%lx name:%s\n",
+						path_start, i, it.dentry, name);
+
+				if (STREQ(path_start, name)) {
+					if (dhash.state == DHASH_UNTESTED)
+						dhash_calibrate(it.dentry,
+							it.buf, parent,
+							path_start);
+					memcpy(dentry_buf, it.buf, SIZE(dentry));
+					child = it.dentry;
+					break;
+				}
+			}
+			subdirs_end(&it);
+
+			/* no such dentry */
+			if (!child)
+				goto not_found;
+		}
+
+		d = child;
+		if (dentry_mounted(dentry_buf) &&
+		    (child = follow_mount(&m, d)) != d) {
+			d = child;
+			if (!read_dentry(d, dentry_buf, RETURN_ON_ERROR))
+				goto not_found;
+		}
+
+		if (!slash_pos)
+			goto found;
+		path_start = slash_pos + 1;
+	}
+	/* the root, or the path ends with '/' */
+	if (!read_dentry(d, dentry_buf, RETURN_ON_ERROR))
+		goto not_found;
+
+found:
+	dentry = d;
+	if (inode)
+		*inode = ULONG(dentry_buf + OFFSET(dentry_d_inode));
+	if (mnt)
+		*mnt = m;
+
+not_found:
+	FREEBUF(dentry_buf);
+	FREEBUF(path_buf);
+
+	return dentry;
+}
+
+/*
+ * For cfind: the predicates following the path, all of which have to match
+ * for an entry to be displayed.  They are evaluated in order of cost, the
+ * name from the dentry already read first, and the inode is read only for
+ * -type, -size and -mmin.  -maxdepth, -prune and -xdev stop the walk before
+ * reading the directories below.
+ */
+static struct {
+	int nr;			/* number of predicates */
+	char *name;		/* -name pattern */
+	char *prune;		/* -prune pattern */
+	uint type;		/* -type, in S_IFMT */
+	int size_cmp;		/* -size: '+', '-', '=' or 0 */
+	ulonglong size, size_unit;
+	int mmin_cmp;		/* -mmin */
+	ulonglong mmin;
+	int maxdepth;		/* -1 for no limit */
+	int xdev;
+} cfind;
+
+static int
+cfind_number(char *arg, int *cmp, ulonglong *val, ulonglong *unit)
+{
+	char *end;
+
+	*cmp = '=';
+	if (*arg == '+' || *arg == '-')
+		*cmp = *arg++;
+	if (!isdigit((unsigned char)*arg))
+		return FALSE;
+
+	*val = strtoull(arg, &end, 10);
+	if (!unit)
+		return *end == '\0';
+
+	switch (*end) {
+	case '\0':
+	case 'b': *unit = 512; break;
+	case 'c': *unit = 1; break;
+	case 'w': *unit = 2; break;
+	case 'k': *unit = 1ULL << 10; break;
+	case 'M': *unit = 1ULL << 20; break;
+	case 'G': *unit = 1ULL << 30; break;
+	default:
+		return FALSE;
+	}
+	return *end == '\0' || end[1] == '\0';
+}
+
+static int
+cfind_compare(int cmp, ulonglong val, ulonglong arg)
+{
+	switch (cmp) {
+	case '+':
+		return val > arg;
+	case '-':
+		return val < arg;
+	default:
+		return val == arg;
+	}
+}
+
+static void
+cfind_parse(char **argv)
+{
+	char *arg, *val;
+	long maxdepth;
+
+	BZERO(&cfind, sizeof(cfind));
+	cfind.maxdepth = -1;
+
+	for (; (arg = *argv); argv++, cfind.nr++) {
+		if (STREQ(arg, "-xdev")) {
+			cfind.xdev = TRUE;
+			continue;
+		}
+		if (!STREQ(arg, "-name") && !STREQ(arg, "-prune") &&
+		    !STREQ(arg, "-type") && !STREQ(arg, "-size") &&
+		    !STREQ(arg, "-mmin") && !STREQ(arg, "-maxdepth"))
+			error(FATAL, "%s: unknown predicate\n", arg);
+		if (!(val = *++argv))
+			error(FATAL, "%s: missing argument\n", arg);
+
+		if (STREQ(arg, "-name"))
+			cfind.name = val;
+		else if (STREQ(arg, "-prune"))
+			cfind.prune = val;
+		else if (STREQ(arg, "-type")) {
+			switch (val[0] && !val[1] ? val[0] : 0) {
+			case 'f': cfind.type = S_IFREG; break;
+			case 'd': cfind.type = S_IFDIR; break;
+			case 'l': cfind.type = S_IFLNK; break;
+			case 'b': cfind.type = S_IFBLK; break;
+			case 'c': cfind.type = S_IFCHR; break;
+			case 'p': cfind.type = S_IFIFO; break;
+			case 's': cfind.type = S_IFSOCK; break;
+			default:
+				error(FATAL, "-type %s: invalid type\n", val);
+			}
+		} else if (STREQ(arg, "-size")) {
+			if (!cfind_number(val, &cfind.size_cmp, &cfind.size,
+			    &cfind.size_unit))
+				error(FATAL, "-size %s: invalid size\n", val);
+		} else if (STREQ(arg, "-mmin")) {
+			if (!cfind_number(val, &cfind.mmin_cmp, &cfind.mmin,
+			    NULL))
+				error(FATAL, "-mmin %s: invalid minutes\n", val);
+		} else {
+			maxdepth = dtol(val, FAULT_ON_ERROR, NULL);
+			if (maxdepth < 0)
+				error(FATAL, "-maxdepth %s: invalid depth\n",
+					val);
+			cfind.maxdepth = maxdepth;
+		}
+	}
+}
+
+static int
+cfind_need_inode(void)
+{
+	return cfind.type || cfind.size_cmp || cfind.mmin_cmp;
+}
+
+static int
+cfind_match_name(char *name)
+{
+	return !cfind.name || !fnmatch(cfind.name, name, 0);
+}
+
+static int
+cfind_match_inode(uint i_mode, ulonglong i_size, struct timespec *i_mtime)
+{
+	ulonglong units, age;
+
+	if (cfind.type && (i_mode & S_IFMT) != cfind.type)
+		return FALSE;
+
+	if (cfind.size_cmp) {
+		/* rounded up like find */
+		units = (i_size + cfind.size_unit - 1) / cfind.size_unit;
+		if (!cfind_compare(cfind.size_cmp, units, cfind.size))
+			return FALSE;
+	}
+
+	if (cfind.mmin_cmp) {
+		/* relative to the time of the dump */
+		age = kt->date.tv_sec > i_mtime->tv_sec ?
+			(kt->date.tv_sec - i_mtime->tv_sec) / 60 : 0;
+		if (!cfind_compare(cfind.mmin_cmp, age, cfind.mmin))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/*
+ * A dentry with children is a directory, so that it can be walked without
+ * reading its inode.
+ */
+static int
+dentry_has_children(ulong dentry, char *dentry_buf)
+{
+	long off;
+	ulong next;
+
+	off = CU_INVALID_MEMBER(dentry_d_subdirs) ?
+		CU_OFFSET(dentry_d_children) : CU_OFFSET(dentry_d_subdirs);
+	next = ULONG(dentry_buf + off);
+
+	return next && next != dentry + off;
+}
+
+static void
+cfind_print(ulong dentry, ulong inode, char *path)
+{
+	if (!rec.format) {
+		fprintf(fp, "%16lx %16lx %s\n", dentry, inode, path);
+		return;
+	}
+
+	rec_begin("path");
+	rec_hex("dentry", dentry);
+	rec_hex("inode", inode);
+	rec_str("path", path);
+	rec_end();
+}
+
+static void
+cfind_print_count(int count, int nr_negdents, char *path)
+{
+	if (!rec.format) {
+		fprintf(fp, count_dentry_fmt,
+			count, count - nr_negdents, nr_negdents, path);
+		return;
+	}
+
+	rec_begin("count");
+	rec_num("total", count);
+	rec_num("dentries", count - nr_negdents);
+	rec_num("negdent", nr_negdents);
+	rec_str("path", path);
+	rec_end();
+}
+
+/*
+ * With -c, the children are counted before the subdirectories, so that
+ * a directory is displayed before them.  Only the dentries are read for
+ * the count, and the inodes are read once in the walk.
+ */
+static int
+cfind_enter(tree_t *w, tree_level_t *lv)
+{
+	inode_info_t e;
+	int ok, count = 0, nr_negdents = 0;
+
+	if (!(flags & FIND_COUNT_DENTRY))
+		return TRUE;
+
+	for (ok = tree_first(w, lv, &e); ok; ok = tree_next(w, lv, &e)) {
+		count++;
+		if (!e.inode)
+			nr_negdents++;
+	}
+	tree_end(lv);
+
+	cfind_print_count(count, nr_negdents, w->path);
+	total_dentry += count;
+	total_negdent += nr_negdents;
+
+	return TRUE;
+}
+
+static int
+cfind_visit(tree_t *w, tree_level_t *lv, inode_info_t *p)
+{
+	int show, dir, descend, need_inode;
+
+	/* the children are at depth + 1 */
+	descend = cfind.maxdepth < 0 || lv->depth + 1 < cfind.maxdepth;
+	need_inode = !cfind.nr || (flags & FIND_COUNT_DENTRY);
+	show = !(flags & FIND_COUNT_DENTRY) && cfind_match_name(p->name);
+
+	/* the mounted root in place of the mountpoint */
+	if (!cfind.xdev && !tree_follow(w, p))
+		return 0;
+
+	if (p->inode && (p->info || need_inode ||
+	    (show && cfind_need_inode())) && tree_inode(w, p)) {
+		show = show && cfind_match_inode(p->i_mode, p->i_size,
+					&p->i_mtime);
+		dir = S_ISDIR(p->i_mode);
+	} else if (p->inode && !need_inode) {
+		/* the inode is not needed, or could not be read */
+		show = show && !cfind_need_inode();
+		dir = dentry_has_children(p->dentry, lv->it.buf);
+	} else {
+		show = show && (flags & SHOW_INFO_NEG_DENTS) &&
+			!cfind_need_inode();
+		dir = FALSE;
+	}
+
+	if (show)
+		cfind_print(p->dentry, p->inode, w->path);
+
+	if (dir && descend && !p->mounted &&
+	    !(cfind.prune && !fnmatch(cfind.prune, p->name, 0)))
+		return TREE_DESCEND;
+
+	return 0;
+}
+
+/*
+ * Display the children of a directory that match, and walk the
+ * subdirectories as they come.
+ */
+static void
+list_dir(char *src, ulong dentry, ulong mnt, uint node)
+{
+	tree_t w;
+	inode_info_t root;
+
+	BZERO(&w, sizeof(tree_t));
+	w.enter = cfind_enter;
+	w.visit = cfind_visit;
+
+	BZERO(&root, sizeof(inode_info_t));
+	root.dentry = dentry;
+	root.mnt = mnt;
+	root.node = node;
+
+	tree_walk(&w, &root, src, NULL);
+}
+
+/*
+ * For cdu: the cached pages and sizes of the regular files are summed up
+ * into their directories on the way back from a single walk, and the
+ * directories within the depth are displayed in that order like "du", or
+ * collected to be sorted by the cached pages at the end.
+ */
+typedef struct {
+	ulong nrpages;
+	ulonglong i_size;
+	ulong pages;		/* pages to cache the whole files */
+} cdu_sum_t;
+
+typedef struct {
+	char *path;
+	cdu_sum_t sum;
+} cdu_ent_t;
+
+static struct {
+	int depth;		/* -1 for no limit */
+	int all, sort;
+	cdu_ent_t *ents;
+	int nr_ents, max_ents;
+} cdu;
+
+static char *cdu_header_fmt = "%10s %12s %12s %3s %s\n";
+static char *cdu_fmt        = "%10lu %12lu %12llu %3d %s\n";
+
+static void
+cdu_print(char *path, cdu_sum_t *sum)
+{
+	if (rec.format) {
+		rec_begin("du");
+		rec_num("nrpages", sum->nrpages);
+		rec_num("size", sum->i_size);
+		rec_num("pages", sum->pages);
+		rec_num("percent", sum->pages ?
+			sum->nrpages * 100 / sum->pages : 0);
+		rec_str("path", path);
+		rec_end();
+		return;
+	}
+
+	fprintf(fp, cdu_fmt, sum->nrpages, PAGESIZE() * sum->nrpages >> 10,
+		(sum->i_size + 1023) >> 10,
+		sum->pages ? (int)(sum->nrpages * 100 / sum->pages) : 0, path);
+}
+
+static void
+cdu_report(char *path, cdu_sum_t *sum, int depth)
+{
+	cdu_ent_t *e;
+
+	if (cdu.depth >= 0 && depth > cdu.depth)
+		return;
+
+	if (!cdu.sort) {
+		cdu_print(path, sum);
+		return;
+	}
+
+	if (cdu.nr_ents == cdu.max_ents) {
+		RESIZEBUF(cdu.ents, sizeof(cdu_ent_t) * cdu.max_ents,
+			sizeof(cdu_ent_t) * cdu.max_ents * 2);
+		cdu.max_ents *= 2;
+	}
+	e = &cdu.ents[cdu.nr_ents++];
+	e->path = strdup(path);
+	e->sum = *sum;
+}
+
+static void
+cdu_add_file(char *path, ulong nrpages, ulonglong i_size, int depth,
+	cdu_sum_t *total)
+{
+	cdu_sum_t sum;
+
+	sum.nrpages = nrpages;
+	sum.i_size = i_size;
+	sum.pages = byte_to_page(i_size);
+	/* a file at depth 0 is abspath itself */
+	if (cdu.all || !depth)
+		cdu_report(path, &sum, depth);
+
+	total->nrpages += sum.nrpages;
+	total->i_size += sum.i_size;
+	total->pages += sum.pages;
+}
+
+static int
+cdu_enter(tree_t *w, tree_level_t *lv)
+{
+	lv->data = GETBUF(sizeof(cdu_sum_t));
+	return TRUE;
+}
+
+static int
+cdu_visit(tree_t *w, tree_level_t *lv, inode_info_t *p)
+{
+	if (!tree_follow(w, p) || !tree_inode(w, p))
+		return 0;
+
+	if (S_ISDIR(p->i_mode))
+		return TREE_DESCEND;
+	else if (S_ISREG(p->i_mode))
+		cdu_add_file(w->path, p->nrpages, p->i_size, lv->depth + 1,
+			(cdu_sum_t *)lv->data);
+
+	return 0;
+}
+
+static void
+cdu_leave(tree_t *w, tree_level_t *lv)
+{
+	cdu_sum_t *sum = (cdu_sum_t *)lv->data, *total;
+
+	cdu_report(w->path, sum, lv->depth);
+
+	if (lv->depth) {
+		total = (cdu_sum_t *)w->stack[lv->depth - 1].data;
+		total->nrpages += sum->nrpages;
+		total->i_size += sum->i_size;
+		total->pages += sum->pages;
+	}
+	FREEBUF(sum);
+}
+
+static void
+du_dir(char *src, ulong dentry, ulong mnt, uint node)
+{
+	tree_t w;
+	inode_info_t root;
+
+	BZERO(&w, sizeof(tree_t));
+	w.nrpages = TRUE;
+	w.enter = cdu_enter;
+	w.visit = cdu_visit;
+	w.leave = cdu_leave;
+
+	BZERO(&root, sizeof(inode_info_t));
+	root.dentry = dentry;
+	root.mnt = mnt;
+	root.node = node;
+
+	tree_walk(&w, &root, src, NULL);
+}
+
+/*
+ * For cdstat: the dentries under a directory are counted in a single walk
+ * to find what bloats the dentry cache.  A dentry is estimated to take
+ * SIZE(dentry) in its slab, and a name too long for d_iname another
+ * kmalloc'ed external_name.  The directories with the most negative
+ * children and the subtrees with the most bytes are kept in min-heaps of
+ * the requested size, and the names are clustered into patterns in a table
+ * of bounded size, so that the memory does not grow with the dentries.
+ */
+#define CDSTAT_DEFAULT_COUNT	(10)
+#define CDSTAT_PATTERNS		(4096)	/* power of 2 */
+#define CDSTAT_PATTERN_LEN	(64)
+
+typedef struct {
+	ulong nr, negative, unhashed, ext_names;
+	ulonglong bytes;
+} dstat_sum_t;
+
+typedef struct {
+	char *path;
+	dstat_sum_t sum;
+	ulonglong key;
+} dstat_ent_t;
+
+typedef struct {
+	dstat_ent_t *ents;
+	int nr;
+} dstat_heap_t;
+
+typedef struct {
+	char name[CDSTAT_PATTERN_LEN];
+	ulong nr, negative;
+} dstat_pattern_t;
+
+static struct {
+	int max;		/* of each heap */
+	int depth;		/* of the subtrees, -1 for no limit */
+	int walked;
+	long inline_len;	/* DNAME_INLINE_LEN */
+	long ext_header;	/* external_name.name */
+	dstat_sum_t total;
+	dstat_heap_t negs;	/* by the negative children */
+	dstat_heap_t trees;	/* by the bytes of the subtree */
+	dstat_pattern_t *patterns;
+	int nr_patterns;
+	dstat_pattern_t other;	/* when the table is full */
+} cdstat;
+
+static void
+dstat_add(dstat_sum_t *to, dstat_sum_t *from)
+{
+	to->nr += from->nr;
+	to->negative += from->negative;
+	to->unhashed += from->unhashed;
+	to->ext_names += from->ext_names;
+	to->bytes += from->bytes;
+}
+
+static void
+dstat_heap_down(dstat_heap_t *heap, int i)
+{
+	dstat_ent_t *h = heap->ents, tmp;
+	int c;
+
+	while ((c = i * 2 + 1) < heap->nr) {
+		if (c + 1 < heap->nr && h[c + 1].key < h[c].key)
+			c++;
+		if (h[i].key <= h[c].key)
+			break;
+		tmp = h[i];
+		h[i] = h[c];
+		h[c] = tmp;
+		i = c;
+	}
+}
+
+static void
+dstat_heap_add(dstat_heap_t *heap, char *path, dstat_sum_t *sum,
+		ulonglong key)
+{
+	dstat_ent_t *h = heap->ents, tmp;
+	int i, p;
+
+	if (!key)
+		return;
+
+	if (heap->nr < cdstat.max) {
+		i = heap->nr++;
+		h[i].path = strdup(path);
+		h[i].sum = *sum;
+		h[i].key = key;
+		for (; i && h[p = (i - 1) / 2].key > h[i].key; i = p) {
+			tmp = h[i];
+			h[i] = h[p];
+			h[p] = tmp;
+		}
+	} else if (cdstat.max && key > h[0].key) {
+		free(h[0].path);
+		h[0].path = strdup(path);
+		h[0].sum = *sum;
+		h[0].key = key;
+		dstat_heap_down(heap, 0);
+	}
+}
+
+/*
+ * The pattern of a name: a word of letters and digits is replaced with '*'
+ * if it has digits and 6 or more characters, like a random suffix, and
+ * otherwise its runs of digits with '#'.
+ */
+static void
+dstat_pattern(char *name, char *buf)
+{
+	char *s, *e, *d = buf, *end = buf + CDSTAT_PATTERN_LEN - 1;
+	int digits;
+
+	for (s = name; *s && d < end; s = e) {
+		if (!isalnum((unsigned char)*s)) {
+			*d++ = *s;
+			e = s + 1;
+			continue;
+		}
+
+		for (e = s, digits = 0; isalnum((unsigned char)*e); e++)
+			if (isdigit((unsigned char)*e))
+				digits++;
+
+		if (digits && (digits == e - s || e - s >= 6)) {
+			*d++ = (digits == e - s) ? '#' : '*';
+			continue;
+		}
+		for (; s < e && d < end; s++) {
+			if (!isdigit((unsigned char)*s))
+				*d++ = *s;
+			else if (s == name || !isdigit((unsigned char)s[-1]))
+				*d++ = '#';
+		}
+	}
+	*d = '\0';
+}
+
+static void
+dstat_add_pattern(char *name, int negative)
+{
+	char buf[CDSTAT_PATTERN_LEN];
+	dstat_pattern_t *p;
+	uint h = 2166136261U;	/* FNV-1a */
+	char *s;
+
+	dstat_pattern(name, buf);
+	for (s = buf; *s; s++)
+		h = (h ^ (uchar)*s) * 16777619U;
+
+	for (h &= CDSTAT_PATTERNS - 1; ; h = (h + 1) & (CDSTAT_PATTERNS - 1)) {
+		p = &cdstat.patterns[h];
+		if (p->nr && !strcmp(p->name, buf))
+			break;
+		if (p->nr)
+			continue;
+		/* keep the table sparse */
+		if (cdstat.nr_patterns >= CDSTAT_PATTERNS / 4 * 3) {
+			p = &cdstat.other;
+			break;
+		}
+		strcpy(p->name, buf);
+		cdstat.nr_patterns++;
+		break;
+	}
+
+	p->nr++;
+	if (negative)
+		p->negative++;
+}
+
+/* The size of the kmalloc cache for size bytes */
+static ulong
+kmalloc_size(ulong size)
+{
+	ulong n;
+
+	if (size > 64 && size <= 96)
+		return 96;
+	if (size > 128 && size <= 192)
+		return 192;
+	for (n = 8; n < size; n <<= 1)
+		;
+
+	return n;
+}
+
+/* the sums of the children, and of the subtree */
+static int
+dstat_enter(tree_t *w, tree_level_t *lv)
+{
+	lv->data = GETBUF(sizeof(dstat_sum_t) * 2);
+	return TRUE;
+}
+
+static int
+dstat_visit(tree_t *w, tree_level_t *lv, inode_info_t *p)
+{
+	dstat_sum_t *sum = (dstat_sum_t *)lv->data;
+	long len = strlen(p->name);
+
+	sum->nr++;
+	sum->bytes += SIZE(dentry);
+	if (len >= cdstat.inline_len) {
+		sum->ext_names++;
+		sum->bytes += kmalloc_size(cdstat.ext_header + len + 1);
+	}
+	if (p->d_unhashed)
+		sum->unhashed++;
+	if (!p->inode)
+		sum->negative++;
+	dstat_add_pattern(p->name, !p->inode);
+
+	if (!p->inode)
+		return 0;
+
+	/* the dentries with children, without reading the inodes */
+	if (p->node ? S_ISDIR(p->i_mode) :
+	    (p->mounted || dentry_has_children(p->dentry, lv->it.buf)))
+		return TREE_DESCEND;
+
+	return 0;
+}
+
+static void
+dstat_leave(tree_t *w, tree_level_t *lv)
+{
+	dstat_sum_t *sum = (dstat_sum_t *)lv->data, *tree = sum + 1;
+
+	dstat_add(tree, sum);
+	dstat_heap_add(&cdstat.negs, w->path, sum, sum->negative);
+
+	if (lv->depth) {
+		if (cdstat.depth < 0 || lv->depth <= cdstat.depth)
+			dstat_heap_add(&cdstat.trees, w->path, tree,
+				tree->bytes);
+		dstat_add((dstat_sum_t *)w->stack[lv->depth - 1].data + 1,
+			tree);
+	} else
+		cdstat.total = *tree;
+
+	FREEBUF(sum);
+}
+
+static void
+dstat_dir(char *src, ulong dentry, ulong mnt, uint node)
+{
+	tree_t w;
+	inode_info_t root;
+
+	BZERO(&w, sizeof(tree_t));
+	w.enter = dstat_enter;
+	w.visit = dstat_visit;
+	w.leave = dstat_leave;
+
+	BZERO(&root, sizeof(inode_info_t));
+	root.dentry = dentry;
+	root.mnt = mnt;
+	root.node = node;
+
+	tree_walk(&w, &root, src, NULL);
+	cdstat.walked = TRUE;
+}
+
+/*
+ * For cgrep: the cached pages of a file are appended to pgbuf in index
+ * order after the incomplete last line of the previous pages, so that a
+ * match across a page boundary is found.  The complete lines are searched
+ * with memmem() for literals, or regexec() with REG_STARTEND for regular
+ * expressions, over the whole buffer rather than line by line.  A hole in
+ * the page cache ends the current line.
+ */
+#define GREP_MAX_PATTERNS	(32)
+#define GREP_LINE_MAX		(EXTENT_BUFSIZE - PAGESIZE())
+
+static struct {
+	int nr_patterns;
+	char *patterns[GREP_MAX_PATTERNS];
+	size_t lens[GREP_MAX_PATTERNS];
+	regex_t regex[GREP_MAX_PATTERNS];
+	int nr_regex;
+	int extended, icase, list, count;
+	char *lbuf;		/* lower-cased copy of pgbuf for -i */
+	char *path;
+	ulong len;		/* bytes in pgbuf */
+	ulonglong base;		/* file offset of pgbuf */
+	ulonglong next;		/* file offset following pgbuf */
+	int partial;		/* pgbuf does not start at a line */
+	ulong nr_matches;	/* matching lines in the file */
+	ulong total_matches, total_files;
+} grep;
+
+static void
+grep_reset(void)
+{
+	int i;
+
+	for (i = 0; i < grep.nr_regex; i++)
+		regfree(&grep.regex[i]);
+	grep.nr_regex = grep.nr_patterns = 0;
+	grep.lbuf = NULL;
+}
+
+/*
+ * Returns the offset of the first match in pgbuf from start to end, or -1.
+ */
+static long
+grep_match(ulong start, ulong end)
+{
+	regmatch_t pm;
+	char *hay, *p;
+	ulong lim;
+	long m = -1;
+	int i, eflags;
+
+	if (grep.extended) {
+		eflags = REG_STARTEND;
+		if (start == 0 && grep.partial)
+			eflags |= REG_NOTBOL;
+		for (i = 0; i < grep.nr_regex; i++) {
+			pm.rm_so = start;
+			pm.rm_eo = end;
+			if (regexec(&grep.regex[i], pgbuf, 1, &pm, eflags) == 0 &&
+			    (m < 0 || pm.rm_so < m))
+				m = pm.rm_so;
+		}
+		return m;
+	}
+
+	hay = grep.icase ? grep.lbuf : pgbuf;
+	for (i = 0; i < grep.nr_patterns; i++) {
+		/* A later pattern only has to be searched before m. */
+		lim = (m < 0) ? end : MIN(end, m + grep.lens[i] - 1);
+		if (lim <= start)
+			continue;
+		p = memmem(hay + start, lim - start, grep.patterns[i],
+			grep.lens[i]);
+		if (p && (m < 0 || p - hay < m))
+			m = p - hay;
+	}
+
+	return m;
+}
+
+static int
+grep_line(ulong start, ulong end)
+{
+	grep.nr_matches++;
+
+	if (grep.list) {
+		fprintf(fp, "%s\n", grep.path);
+		walk.stop = TRUE;
+		return FALSE;
+	} else if (grep.count)
+		return TRUE;
+
+	fprintf(fp, "%s:%llu:", grep.path, grep.base + start);
+	fwrite(pgbuf + start, 1, end - start, fp);
+	fputc('\n', fp);
+
+	return TRUE;
+}
+
+/*
+ * Search the complete lines in pgbuf, or all bytes if final, and
+ * return the number of bytes done.
+ */
+static ulong
+grep_scan(int final)
+{
+	ulong start, end, ls, le;
+	char *p;
+	long m;
+
+	if (final)
+		end = grep.len;
+	else if ((p = memrchr(pgbuf, '\n', grep.len)))
+		end = p - pgbuf + 1;
+	else
+		return 0;
+
+	for (start = 0; start < end; start = le + 1) {
+		if ((m = grep_match(start, end)) < 0)
+			break;
+
+		p = memrchr(pgbuf + start, '\n', m - start);
+		ls = p ? p - pgbuf + 1 : start;
+		p = memchr(pgbuf + m, '\n', end - m);
+		le = p ? p - pgbuf : end;
+
+		if (!grep_line(ls, le))
+			break;
+	}
+
+	return end;
+}
+
+/*
+ * Search and drop the bytes in pgbuf, e.g. at a hole.
+ */
+static void
+grep_flush(ulonglong next)
+{
+	if (grep.len && !walk.stop)
+		grep_scan(TRUE);
+	grep.len = 0;
+	grep.base = grep.next = next;
+	grep.partial = (next != 0);
+}
+
+static int
+grep_page(physaddr_t phys, ulong index)
+{
+	ulonglong pos = (ulonglong)index * PAGESIZE();
+	ulong size, done, i;
+
+	if (walk.stop)
+		return TRUE;
+
+	if (pos != grep.next)
+		grep_flush(pos);
+
+	size = MIN(PAGESIZE(), out_size - pos);
+	if (!readmem(phys, PHYSADDR, pgbuf + grep.len, PAGESIZE(),
+	    "page content", RETURN_ON_ERROR|QUIET)) {
+		nr_excluded++;
+		grep_flush(pos + PAGESIZE());
+		return TRUE;
+	}
+
+	if (grep.icase) {
+		for (i = grep.len; i < grep.len + size; i++)
+			grep.lbuf[i] = tolower((unsigned char)pgbuf[i]);
+	}
+	grep.len += size;
+	grep.next = pos + size;
+
+	done = grep_scan(FALSE);
+	if (done) {
+		grep.len -= done;
+		memmove(pgbuf, pgbuf + done, grep.len);
+		if (grep.icase)
+			memmove(grep.lbuf, grep.lbuf + done, grep.len);
+		grep.base += done;
+		grep.partial = FALSE;
+	} else if (grep.len > GREP_LINE_MAX)
+		grep_flush(grep.next);	/* a too long line */
+
+	return TRUE;
+}
+
+static int
+grep_slot(ulong slot)
+{
+	return for_each_folio_page(slot, grep_page);
+}
+
+static void
+grep_file(char *src, ulong i_mapping, ulonglong i_size)
+{
+	out_size = i_size;
+	folio_next = nr_cached = 0;
+	nr_excluded = 0;
+
+	grep.path = src;
+	grep.nr_matches = 0;
+	grep.len = grep.base = grep.next = 0;
+	grep.partial = FALSE;
+
+	if (i_size)
+		walk_page_cache(i_mapping, 0, (i_size - 1) / PAGESIZE(), FALSE,
+			grep_slot);
+	grep_flush(0);
+
+	if (grep.nr_matches) {
+		grep.total_files++;
+		grep.total_matches += grep.nr_matches;
+		if (grep.count && !grep.list)
+			fprintf(fp, "%s:%lu\n", src, grep.nr_matches);
+	}
+
+	if (nr_excluded && CRASHDEBUG(1))
+		error(INFO, "%s: %lu pages excluded\n", src, nr_excluded);
+}
+
+static int
+dump_enter(tree_t *w, tree_level_t *lv)
+{
+	char *dst = w->dst;
+
+	if (flags & DUMP_ARCHIVE)
+		tar_dir(dst, lv->dir.i_mode, &lv->dir.i_mtime);
+	else if (flags & DUMP_STORE)
+		store_dir(dst, lv->dir.i_mode, &lv->dir.i_mtime);
+	else if (flags & DUMP_MANIFEST)
+		manifest_dir(dst, lv->dir.i_mode, &lv->dir.i_mtime);
+	else if (!(flags & (DUMP_COUNT_ONLY|GREP_CONTENTS))) {
+		if (CRASHDEBUG(1))
+			fprintf(fp, "create dir  %s\n", dst);
+
+		if (mkdir(dst, MODE_RWX) < 0 &&
+		    !(errno == EEXIST && (flags & DUMP_RESUME))) {
+			error(INFO, "%s: cannot create directory: %s\n",
+				dst, strerror(errno));
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+static int
+dump_visit(tree_t *w, tree_level_t *lv, inode_info_t *p)
+{
+	char *srcpath = w->path, *dstpath = w->dst;
+
+	if (!tree_inode(w, p))
+		return 0;
+
+	if (S_ISDIR(p->i_mode))
+		return TREE_DESCEND;
+	else if (!S_ISREG(p->i_mode))
+		return 0;
+
+	/* uncached files as well, to tell them from removed ones */
+	if (flags & DUMP_MANIFEST) {
+		manifest_file(srcpath, dstpath, p->inode, p->i_mapping,
+			p->i_size, p->i_mtime, p->i_mode, p->nrpages);
+		total_pages += nr_written;
+		return 0;
+	} else if (!p->nrpages) {
+		if (CRASHDEBUG(1))
+			fprintf(fp, "%s: no cached pages\n", srcpath);
+		return 0;
+	} else if (flags & DUMP_COUNT_ONLY) {
+		total_pages += p->nrpages;
+		return 0;
+	} else if (flags & GREP_CONTENTS) {
+		grep_file(srcpath, p->i_mapping, p->i_size);
+		return 0;
+	}
+
+	if (CRASHDEBUG(1))
+		fprintf(fp, "create file %s\n", dstpath);
+
+	if (flags & DUMP_SORT_PHYS) {
+		sched_file(srcpath, dstpath, p->i_mapping, p->i_size,
+			p->i_mtime);
+		return 0;
+	} else if (flags & DUMP_ARCHIVE) {
+		tar_file(srcpath, dstpath, p->i_mapping, p->i_size,
+			p->i_mtime, p->i_mode);
+		total_pages += nr_written;
+		return 0;
+	} else if (flags & DUMP_STORE) {
+		store_file(srcpath, dstpath, p->i_mapping, p->i_size,
+			p->i_mtime, p->i_mode);
+		total_pages += nr_written;
+		return 0;
+	} else if ((flags & DUMP_RESUME) &&
+		   journal_check(dstpath, p->i_size, p->i_mtime)) {
+		if (CRASHDEBUG(1))
+			fprintf(fp, "%s: completed\n", dstpath);
+		return 0;
+	}
+
+	dump_file(srcpath, dstpath, p->i_mapping, p->i_size, p->i_mtime);
+	total_pages += nr_written;
+	total_extents += nr_extents;
+
+	return 0;
+}
+
+static void
+dump_leave(tree_t *w, tree_level_t *lv)
+{
+	if (!(flags & (DUMP_COUNT_ONLY|DUMP_ARCHIVE|DUMP_STORE|DUMP_MANIFEST|
+	    GREP_CONTENTS))) {
+		set_mtime(w->dst, lv->dir.i_mtime);
+	}
+}
+
+static void
+dump_dir(char *src, char *dst, ulong dentry, ulong mnt,
+		struct timespec i_mtime, uint i_mode)
+{
+	tree_t w;
+	inode_info_t root;
+
+	BZERO(&w, sizeof(tree_t));
+	w.nrpages = TRUE;
+	w.enter = dump_enter;
+	w.visit = dump_visit;
+	w.leave = dump_leave;
+
+	BZERO(&root, sizeof(inode_info_t));
+	root.dentry = dentry;
+	root.mnt = mnt;
+	root.i_mode = i_mode;
+	root.i_mtime = i_mtime;
+	root.info = TRUE;
+
+	tree_walk(&w, &root, src, dst);
+}
+
+/*
+ * Currently just squeeze a series of slashes into a slash,
+ * and remove the last slash.
+ */
+static void
+normalize_path(char *path)
+{
+	char *s, *d;
+
+	if (!path || *path == '\0')
+		return;
+
+	s = d = path;
+	while (*s) {
+		if (*s == '/' && *(s+1) == '/') {
+			s++;
+			continue;
+		}
+		*d++ = *s++;
+	}
+	*d = '\0';
+
+	d--;
+	if (d != path && *d == '/')
+		*d = '\0';
+}
+
+static void
+rec_estimate(char *path, ulong nrpages)
+{
+	rec_begin("estimate");
+	rec_num("nrpages", nrpages);
+	rec_str("path", path);
+	rec_end();
+}
+
+static void
+do_command(char *src, char *dst)
+{
+	ulong inode, i_mapping, dentry, mnt, nrpages;
+	ulonglong i_size;
+	uint i_mode, node;
+	struct timespec i_mtime;
+
+	inode = dentry = mnt = 0;
+	node = 0;
+	if (flags & DUMP_FILE)
+		inode = htol(src, RETURN_ON_ERROR|QUIET, NULL);
+
+	if (inode == 0 || inode == BADADDR) {
+		if (src[0] != '/')
+			cmd_usage(pc->curcmd, SYNOPSIS);
+
+		normalize_path(src);
+
+		/* dump_dir() needs the mount, not in the index */
+		if (!(flags & (DUMP_DIRECTORY|GREP_CONTENTS)))
+			node = cindex_lookup(src);
+		dentry = path_to_dentry(src, &inode, node ? NULL : &mnt);
+		if (!dentry) {
+			error(INFO, "%s: not found in dentry cache\n", src);
+			return;
+		} else if (!inode) {
+			error(INFO, "%s: negative dentry\n", src);
+			return;
+		}
+	}
+
+	if (!get_inode_info(inode, &i_mode, &i_mapping, &i_size, &nrpages,
+				&i_mtime))
+		return;
+
+	if (flags & DUMP_FILE) {
+		if (!S_ISREG(i_mode)) {
+			error(INFO, "%s: not regular file\n", src);
+			return;
+		} else if (!nrpages) {
+			error(INFO, "%s: no cached pages\n", src);
+			return;
+		} else if (flags & DUMP_COUNT_ONLY) {
+			if (flags & DUMP_RANGE)
+				nrpages = count_range_pages(i_mapping, i_size);
+			if (rec.format)
+				rec_estimate(src, nrpages);
+			else
+				fprintf(fp, "Estimated %lu pages (%lu KiB)\n",
+					nrpages, PAGESIZE() * nrpages >> 10);
+			return;
+		}
+
+		if (flags & DUMP_STORE) {
+			if (!store_open(storedir, dst))
+				return;
+			store_file(src, strrchr(src, '/') ?
+				strrchr(src, '/') + 1 : src,
+				i_mapping, i_size, i_mtime, i_mode);
+			store_finish();
+			return;
+		} else if (flags & DUMP_MANIFEST) {
+			if (!manifest_open(dst))
+				return;
+			manifest_file(src, strrchr(src, '/') ?
+				strrchr(src, '/') + 1 : src, inode,
+				i_mapping, i_size, i_mtime, i_mode, nrpages);
+			manifest_finish();
+			return;
+		}
+
+		dump_file(src, dst, i_mapping, i_size, i_mtime);
+
+	} else if (flags & DUMP_DIRECTORY) {
+		char *name;
+
+		if (!S_ISDIR(i_mode)) {
+			error(INFO, "%s: not directory\n", src);
+			return;
+		}
+
+		if ((flags & DUMP_ARCHIVE) && !tar_open(dst))
+			return;
+		if ((flags & DUMP_STORE) && !store_open(storedir, dst))
+			return;
+		if ((flags & DUMP_MANIFEST) && !manifest_open(dst))
+			return;
+		if ((flags & DUMP_RESUME) && !journal_open(src, dst))
+			return;
+
+		if (flags & (DUMP_ARCHIVE|DUMP_STORE|DUMP_MANIFEST)) {
+			/* Members are named like "tar -C /var -c log". */
+			name = strrchr(src, '/') + 1;
+			if (*name == '\0')
+				name = ".";
+		} else
+			name = dst;
+
+		if (flags & DUMP_COUNT_ONLY) {
+			if (!rec.format)
+				fprintf(fp, "Estimating %s...\n", src);
+		} else if (flags & DUMP_ARCHIVE)
+			fprintf(fp, "Archiving %s to %s...\n", src, dst);
+		else if (flags & DUMP_STORE)
+			fprintf(fp, "Storing %s to %s...\n", src, storedir);
+		else if (flags & DUMP_MANIFEST)
+			fprintf(fp, "Recording %s to %s...\n", src, dst);
+		else if (journal.nr_ents)
+			fprintf(fp, "Resuming %s to %s...\n", src, dst);
+		else
+			fprintf(fp, "Extracting %s to %s...\n", src, dst);
+
+		total_pages = total_extents = 0;
+		nr_written = nr_extents = 0;
+
+		dump_dir(src, name, dentry, mnt, i_mtime, i_mode);
+
+		if (flags & DUMP_SORT_PHYS) {
+			sched_finish();
+			total_pages = nr_written;
+			total_extents = nr_extents;
+		} else if (flags & DUMP_STORE) {
+			fprintf(fp, "Total %lu pages (%lu KiB)\n",
+				total_pages, PAGESIZE() * total_pages >> 10);
+			store_finish();
+			return;
+		} else if (flags & DUMP_MANIFEST) {
+			fprintf(fp, "Total %lu pages (%lu KiB)\n",
+				total_pages, PAGESIZE() * total_pages >> 10);
+			manifest_finish();
+			return;
+		} else if (flags & DUMP_ARCHIVE) {
+			tar_finish();
+			fprintf(fp, "Total %lu pages (%lu KiB)\n",
+				total_pages, PAGESIZE() * total_pages >> 10);
+			return;
+		}
+
+		if (flags & DUMP_ASYNC)
+			total_pages = writer_written();
+
+		if (flags & DUMP_RESUME)
+			journal_finish();
+
+		if ((flags & DUMP_COUNT_ONLY) && rec.format)
+			rec_estimate(src, total_pages);
+		else if (flags & DUMP_COUNT_ONLY)
+			fprintf(fp, "Total %lu pages (%lu KiB)\n",
+				total_pages, PAGESIZE() * total_pages >> 10);
+		else
+			fprintf(fp, "Total %lu pages (%lu KiB) in %lu extents\n",
+				total_pages, PAGESIZE() * total_pages >> 10,
+				total_extents);
+
+	} else if (flags & SHOW_INFO) {
+		int pct = calc_cached_percent(nrpages, i_size);
+		char *name = src;
+
+		if (S_ISDIR(i_mode) && !(flags & SHOW_INFO_DIRS))
+			name = ".";
+
+		if (rec.format)
+			rec_inode(dentry, inode, nrpages, i_size, i_mode,
+				&i_mtime, src);
+		else if (flags & SHOW_INFO_LONG) {
+			fprintf(fp, header_lfmt, "DENTRY", "INODE", "NRPAGES",
+				"%", "MODE", "SIZE", "MTIME", "PATH");
+			fprintf(fp, dentry_lfmt, dentry, inode, nrpages,
+				pct, i_mode, i_size, get_strtime(&i_mtime),
+				name, get_type_indicator(i_mode, inode));
+			if (CRASHDEBUG(1))
+				fprintf(fp,
+				    "  i_mapping:%-16lx i_mtime:%ld.%09ld\n",
+					i_mapping, i_mtime.tv_sec,
+					i_mtime.tv_nsec);
+		} else {
+			fprintf(fp, header_fmt, "DENTRY", "INODE", "NRPAGES",
+				"%", "PATH");
+			fprintf(fp, dentry_fmt, dentry, inode, nrpages,
+				pct, name, get_type_indicator(i_mode, inode));
+			if (CRASHDEBUG(1))
+				fprintf(fp, "  i_mapping:%-16lx\n", i_mapping);
+		}
+
+		if (S_ISDIR(i_mode) && !(flags & SHOW_INFO_DIRS))
+			show_subdirs_info(dentry, mnt, node, src);
+
+	} else if (flags & FIND_FILES) {
+		char *name;
+
+		if ((flags & FIND_COUNT_DENTRY) && !rec.format) {
+			fprintf(fp, count_header_fmt,
+				"TOTAL", "DENTRY", "N_DENT", "PATH");
+			total_dentry = total_negdent = 0;
+		}
+
+		name = (src[1] == '\0') ? src : strrchr(src, '/') + 1;
+		if (!(flags & FIND_COUNT_DENTRY) && cfind_match_name(name) &&
+		    cfind_match_inode(i_mode, i_size, &i_mtime))
+			cfind_print(dentry, inode, src);
+
+		if (S_ISDIR(i_mode) && cfind.maxdepth != 0)
+			list_dir(src, dentry, mnt, node);
+
+		if ((flags & FIND_COUNT_DENTRY) && !rec.format) {
+			fprintf(fp, count_dentry_fmt,
+				total_dentry, total_dentry - total_negdent,
+				total_negdent, "TOTAL");
+		}
+
+	} else if (flags & SHOW_DU) {
+		cdu_sum_t sum;
+
+		BZERO(&sum, sizeof(cdu_sum_t));
+		if (!rec.format)
+			fprintf(fp, cdu_header_fmt, "NRPAGES", "CACHED(KiB)",
+				"SIZE(KiB)", "%", "PATH");
+		if (S_ISDIR(i_mode))
+			du_dir(src, dentry, mnt, node);
+		else if (S_ISREG(i_mode))
+			cdu_add_file(src, nrpages, i_size, 0, &sum);
+		else
+			error(INFO, "%s: not regular file or directory\n", src);
+
+	} else if (flags & SHOW_DSTAT) {
+		if (S_ISDIR(i_mode))
+			dstat_dir(src, dentry, mnt, node);
+		else
+			error(INFO, "%s: not directory\n", src);
+
+	} else if (flags & GREP_CONTENTS) {
+		if (S_ISDIR(i_mode))
+			dump_dir(src, src, dentry, mnt, i_mtime, i_mode);
+		else if (S_ISREG(i_mode))
+			grep_file(src, i_mapping, i_size);
+		else
+			error(INFO, "%s: not regular file or directory\n", src);
+	}
+}
+
+static void
+init_cache(void) {
+	/* In case that the last command was interrupted. */
+	mount_info = NULL;
+	mount_hash = NULL;
+	mount_count = 0;
+	cindex.use = -1;
+	writer_stop();
+	sched_reset();
+	tar_close();
+	store_close();
+	manifest_close();
+	journal_close();
+	dentry_data = GETBUF(SIZE(dentry));
+	if (flags & (DUMP_FILE|DUMP_DIRECTORY)) {
+		vmcore_init();
+		/* Copying into the page cache defeats O_DIRECT. */
+		if (vmcore.fd >= 0)
+			vmcore.method = (flags & DUMP_DIRECT_IO) ?
+				COPY_NONE : COPY_FILE_RANGE;
+	}
+	if (flags & DUMP_ASYNC)
+		writer_start();
+	else
+		pgbuf = GETBUF(EXTENT_BUFSIZE);
+}
+
+static void
+clear_cache(void)
+{
+	if (mount_info) {
+		FREEBUF(mount_info);
+		FREEBUF(mount_hash);
+		mount_info = NULL;
+		mount_hash = NULL;
+		mount_count = 0;
+	}
+	FREEBUF(dentry_data);
+	if (flags & DUMP_ASYNC)
+		writer_stop();
+	else
+		FREEBUF(pgbuf);
+}
+
+static void
+set_default_task_context(void)
+{
+	ulong pid = 0;
+
+	while ((tc = pid_to_context(pid)) == NULL)
+		pid++;
+}
+
+static int
+sort_by_pid(const void *arg1, const void *arg2)
+{
+	struct task_context *p = *(struct task_context **)arg1;
+	struct task_context *q = *(struct task_context **)arg2;
+
+	return (p->pid > q->pid) - (p->pid < q->pid);
+}
+
+/*
+ * For "-n all", returns a task of each distinct mount namespace, the one
+ * with the lowest PID except the idle tasks, in PID order.  Exiting tasks
+ * without nsproxy are skipped.
+ */
+static struct task_context **
+get_mnt_ns_tasks(int *cntptr)
+{
+	struct task_context *t, **tasks, *save = tc;
+	ulong *mnt_ns, ns;
+	int i, j, cnt = 0;
+
+	tasks = (struct task_context **)GETBUF(sizeof(struct task_context *) *
+			RUNNING_TASKS());
+	mnt_ns = (ulong *)GETBUF(sizeof(ulong) * RUNNING_TASKS());
+
+	t = FIRST_CONTEXT();
+	for (i = 0; i < RUNNING_TASKS(); i++, t++) {
+		tc = t;
+		if ((ns = get_mnt_ns()) == t->task)
+			continue;
+		for (j = 0; j < cnt; j++)
+			if (mnt_ns[j] == ns)
+				break;
+		if (j == cnt) {
+			mnt_ns[cnt] = ns;
+			tasks[cnt++] = t;
+		} else if (t->pid && (!tasks[j]->pid || t->pid < tasks[j]->pid))
+			tasks[j] = t;
+	}
+	tc = save;
+	FREEBUF(mnt_ns);
+
+	qsort(tasks, cnt, sizeof(struct task_context *), sort_by_pid);
+	*cntptr = cnt;
+
+	return tasks;
+}
+
+static void
+show_mnt_ns(int first)
+{
+	if (rec.format) {
+		rec_begin("mnt_ns");
+		rec_hex("mnt_ns", get_mnt_ns());
+		rec_num("pid", tc->pid);
+		rec_str("command", tc->comm);
+		rec_end();
+		return;
+	}
+
+	fprintf(fp, "%sMNT_NS: %lx  PID: %lu  COMMAND: \"%s\"\n",
+		first ? "" : "\n", get_mnt_ns(), tc->pid, tc->comm);
+}
+
+/*
+ * A byte count with an optional K, M or G suffix.
+ */
+static ulonglong
+str_to_bytes(char *str)
+{
+	char *end;
+	ulonglong val;
+	int shift = 0;
+
+	errno = 0;
+	val = strtoull(str, &end, 0);
+	switch (*end)
+	{
+	case 'k': case 'K':
+		shift = 10, end++;
+		break;
+	case 'm': case 'M':
+		shift = 20, end++;
+		break;
+	case 'g': case 'G':
+		shift = 30, end++;
+		break;
+	}
+	if (errno || end == str || *end != '\0' || *str == '-' ||
+	    val > (~0ULL >> shift))
+		error(FATAL, "invalid size: %s\n", str);
+
+	return val << shift;
+}
+
+static void
+cmd_ccat(void)
+{
+	int c;
+	char *src, *dst;
+	ulong value;
+
+	flags = DUMP_FILE;
+	tc = NULL;
+	range_offset = range_length = 0;
+	tail_pages = tail_lines = 0;
+	rec_init();
+
+	while ((c = getopt(argcnt, args, "acdF:f:l:mn:o:OprSs:T:t:wz")) != EOF) {
+		switch(c) {
+		case 'a':
+			flags |= DUMP_ARCHIVE;
+			break;
+		case 'c':
+			flags |= DUMP_COUNT_ONLY;
+			break;
+		case 'd':
+			flags &= ~DUMP_FILE; /* exclusive */
+			flags |= DUMP_DIRECTORY;
+			break;
+		case 'F':
+		case 'f':
+			rec_option(c, optarg);
+			break;
+		case 'l':
+			flags |= DUMP_RANGE;
+			if (!(range_length = str_to_bytes(optarg)))
+				argerrs++;
+			break;
+		case 'm':
+			flags |= DUMP_MANIFEST;
+			break;
+		case 'n':
+			switch (str_to_context(optarg, &value, &tc)) {
+			case STR_PID:
+			case STR_TASK:
+				break;
+			case STR_INVALID:
+				error(FATAL, "invalid task or pid value: %s\n",
+					optarg);
+				break;
+			}
+			break;
+		case 'o':
+			flags |= DUMP_RANGE;
+			range_offset = str_to_bytes(optarg);
+			break;
+		case 'O':
+			flags |= (DUMP_ASYNC|DUMP_DIRECT_IO);
+			break;
+		case 'p':
+			flags |= DUMP_SORT_PHYS;
+			break;
+		case 'r':
+			flags |= DUMP_RESUME;
+			break;
+		case 'S':
+			flags |= DUMP_DONT_SEEK;
+			break;
+		case 's':
+			flags |= DUMP_STORE;
+			storedir = optarg;
+			break;
+		case 'T':
+			flags |= DUMP_RANGE;
+			if (!(tail_pages = dtol(optarg, FAULT_ON_ERROR, NULL)))
+				argerrs++;
+			break;
+		case 't':
+			flags |= DUMP_RANGE;
+			if (!(tail_lines = dtol(optarg, FAULT_ON_ERROR, NULL)))
+				argerrs++;
+			break;
+		case 'w':
+			flags |= DUMP_ASYNC;
+			break;
+		case 'z':
+			flags |= DUMP_ZSTD;
+			break;
+		default:
+			argerrs++;
+			break;
+		}
+	}
+
+	/* pages are scattered to files by offset */
+	if ((flags & DUMP_SORT_PHYS) &&
+	    (!(flags & DUMP_DIRECTORY) || (flags & DUMP_DONT_SEEK)))
+		argerrs++;
+
+	/* an archive is a stream of a directory */
+	if (((flags & DUMP_ARCHIVE) && !(flags & DUMP_DIRECTORY)) ||
+	    ((flags & DUMP_ZSTD) && !(flags & DUMP_ARCHIVE)) ||
+	    ((flags & DUMP_ARCHIVE) && (flags & (DUMP_SORT_PHYS|
+	     DUMP_DONT_SEEK|DUMP_ASYNC))))
+		argerrs++;
+
+	/* pages are hashed into the store instead of written */
+	if ((flags & DUMP_STORE) && (flags & (DUMP_ARCHIVE|DUMP_SORT_PHYS|
+	    DUMP_DONT_SEEK|DUMP_ASYNC)))
+		argerrs++;
+
+	/* only hashes are recorded */
+	if ((flags & DUMP_MANIFEST) && (flags & (DUMP_STORE|DUMP_ARCHIVE|
+	    DUMP_SORT_PHYS|DUMP_DONT_SEEK|DUMP_ASYNC)))
+		argerrs++;
+
+	/* a part of a file, at unaligned offsets */
+	if ((flags & DUMP_RANGE) && ((flags & (DUMP_DIRECTORY|DUMP_STORE|
+	    DUMP_MANIFEST|DUMP_DIRECT_IO)) || (range_offset && tail_pages) ||
+	    ((range_offset || tail_pages) && tail_lines)))
+		argerrs++;
+
+	/* files are resumed from the page index in the journal */
+	if ((flags & DUMP_RESUME) && (!(flags & DUMP_DIRECTORY) ||
+	    (flags & (DUMP_COUNT_ONLY|DUMP_ARCHIVE|DUMP_STORE|DUMP_MANIFEST|
+	     DUMP_SORT_PHYS|DUMP_DONT_SEEK))))
+		argerrs++;
+
+	/* records only for the counts */
+	if ((rec.format || rec.file) && (!(flags & DUMP_COUNT_ONLY) ||
+	    (flags & (DUMP_ARCHIVE|DUMP_STORE|DUMP_MANIFEST))))
+		argerrs++;
+
+	if (argerrs || !args[optind])
+		cmd_usage(pc->curcmd, SYNOPSIS);
+
+	src = args[optind++];
+	dst = args[optind];
+
+	if (dst) {
+		if (dst[0] == '\0')
+			cmd_usage(pc->curcmd, SYNOPSIS);
+
+		normalize_path(dst);
+
+		if (access(dst, F_OK) == 0 && !(flags & DUMP_RESUME)) {
+			error(INFO, "%s: %s\n", dst, strerror(EEXIST));
+			return;
+		}
+	} else if ((flags & (DUMP_DIRECTORY|DUMP_STORE|DUMP_MANIFEST)) &&
+		   !(flags & DUMP_ARCHIVE))
+		cmd_usage(pc->curcmd, SYNOPSIS);
+	else if (flags & DUMP_ZSTD)
+		cmd_usage(pc->curcmd, SYNOPSIS);
+	/* messages would be mixed into an archive to crash's output */
+	else if ((flags & DUMP_ARCHIVE) && !(flags & DUMP_COUNT_ONLY))
+		cmd_usage(pc->curcmd, SYNOPSIS);
+
+	/* The writer thread is used only for files created by itself. */
+	if (!dst || (flags & DUMP_COUNT_ONLY))
+		flags &= ~(DUMP_ASYNC|DUMP_DIRECT_IO|DUMP_SORT_PHYS|DUMP_STORE|
+			   DUMP_MANIFEST);
+
+	/* nothing is archived, the pages are only counted */
+	if (flags & DUMP_COUNT_ONLY)
+		flags &= ~(DUMP_ARCHIVE|DUMP_ZSTD);
+
+	if (!tc)
+		set_default_task_context();
+
+	rec_open("nrpages,path");
+	init_cache();
+
+	do_command(src, dst);
+
+	clear_cache();
+	rec_close();
+}
+
+static char *help_ccat[] = {
+"ccat",				/* command name */
+"dump page caches",		/* short description */
+"   [-cOSw] [-n pid|task] abspath|inode [outfile]\n"
+"  ccat [-d] -c -F json|csv [-f file] [-n pid|task] abspath|inode\n"
+"  ccat [-Sw] [-o offset] [-l length] [-n pid|task] abspath|inode [outfile]\n"
+"  ccat [-Sw] -T pages|-t lines [-n pid|task] abspath|inode [outfile]\n"
+"  ccat -d [-cOprSw] [-n pid|task] abspath outdir\n"
+"  ccat -d -a [-cz] [-n pid|task] abspath archive\n"
+"  ccat [-d] -s storedir [-c] [-n pid|task] abspath index\n"
+"  ccat [-d] -m [-n pid|task] abspath manifest",
+				/* argument synopsis, or " " if none */
+"  This command dumps the page caches of a specified inode or path like",
+"  \"cat\" command.",
+"",
+"       -a  with -d, write a tar archive to archive instead of creating",
+"           files.  Files with missing pages are stored in the GNU sparse",
+"           format.",
+"       -c  only count the total pages to be written without creating any",
+"           files or directories.",
+"       -d  extract a directory and its contents to outdir.",
+"       -F  with -c, display the count as a record in NDJSON or CSV, to",
+"           be read by other tools.",
+"       -f  with -F, write the record to file directly instead of through",
+"           the output pager.",
+"       -l  write at most length bytes from the offset.",
+"       -m  record the size and the hashes of the cached pages of the file,",
+"           or of the files in the directory with -d, to manifest instead",
+"           of writing the data.  Use the cdiff command to compare them.",
+"       -O  write with O_DIRECT not to fill the page cache of this host.",
+"           This implies the -w option.",
+"       -o  write the file from offset instead of the beginning.  The",
+"           offset and length can have a K, M or G suffix.  Only the",
+"           nodes of the page cache tree that cover the range are read.",
+"       -p  with -d, collect the cached pages of all files first and read",
+"           them in physical address order, which makes reading the",
+"           dumpfile mostly sequential.  Cannot be used with -S.",
+"       -r  with -d, resume an interrupted extraction to outdir.  The",
+"           files completed and the pages written are recorded in the",
+"           journal file \"outdir.ccat-journal\", and the files completed",
+"           are skipped and the others are continued from the last",
+"           recorded page.  The journal is removed when it completes.",
+"           Cannot be used with -c, -p or -S.",
+"       -S  do not fseek() and ftruncate() to outfile in order to",
+"           create a non-sparse file.",
+"       -s  store each page only once in the content-addressed store in",
+"           storedir, which can be shared by many dumpfiles, and record",
+"           the file or directory as page hashes in index.  Use the",
+"           cstore command to reconstruct the files.",
+"       -T  write the last pages of the file.",
+"       -t  write the last lines of the file like \"tail -n\".  The lines",
+"           are counted in the cached pages from the end of the file.",
+"       -w  write outfile or files in outdir with a writer thread, so that",
+"           reading the dumpfile and writing them overlap.",
+"       -z  with -a, compress the archive with the zstd command.",
+"    inode  a hexadecimal inode pointer.",
+"  abspath  the absolute path of a file (or directory with the -d option).",
+"  outfile  a file path to be written. If a file already exists there,",
+"           the command fails.",
+"   outdir  a directory path to be created by the -d option.",
+"  archive  a tar archive path to be created by the -a option.",
+"    index  an index file path to be created by the -s option.",
+" manifest  a manifest file path to be created by the -m option.",
+"",
+"  For kernels supporting mount namespaces, the -n option may be used to",
+"  specify a task that has the target namespace:",
+"",
+"    -n pid   a process PID.",
+"    -n task  a hexadecimal task_struct pointer.",
+"",
+"EXAMPLE",
+"  Dump the existing page caches of the \"/var/log/messages\" file:",
+"",
+"    %s> ccat /var/log/messages",
+"    Sep 16 03:13:01 host systemd: Started Session 559694 of user root.",
+"    Sep 16 03:13:01 host systemd: Starting Session 559694 of user root.",
+"    Sep 16 03:13:39 host dnsmasq-dhcp[24341]: DHCPREQUEST(virbr0) 192.168",
+"    Sep 16 03:13:39 host dnsmasq-dhcp[24341]: DHCPACK(virbr0) 192.168.122",
+"    ...",
+"",
+"  Restore the size and data offset of the \"messages\" file as well to the",
+"  \"messages.sparse\" file even if some of its page caches don't exist, so",
+"  it could become sparse:",
+"",
+"    %s> ccat /var/log/messages messages.sparse",
+"",
+"  Dump the last lines of the \"/var/log/messages\" file, which reads only",
+"  the last pages of it:",
+"",
+"    %s> ccat -t 2 /var/log/messages",
+"    Sep 16 03:13:39 host dnsmasq-dhcp[24341]: DHCPREQUEST(virbr0) 192.168",
+"    Sep 16 03:13:39 host dnsmasq-dhcp[24341]: DHCPACK(virbr0) 192.168.122",
+"",
+"  Dump 1 MiB from the offset 2 GiB of a large file:",
+"",
+"    %s> ccat -o 2G -l 1M /var/log/huge.log huge.part",
+"",
+"  Create the non-sparse \"messages.non-sparse\" file:",
+"",
+"    %s> ccat -S /var/log/messages messages.non-sparse",
+"",
+"  NOTE: Redirecting to a file will also works, but it can contain crash's",
+"  messages, so specifying an outfile is recommended for restoring a file.",
+"",
+"  Extract the \"/var/log\" directory and its contents to the new \"/tmp/log\"",
+"  directory with one command:",
+"",
+"    %s> ccat -d /var/log /tmp/log",
+"    Extracting /var/log to /tmp/log...",
+"    Total 127034 pages (508136 KiB) in 2861 extents",
+"",
+"  Count the total pages to be written in advance without creating any",
+"  files or directories:",
+"",
+"    %s> ccat -c -d /var/log /tmp/log",
+"    Estimating /var/log...",
+"    Total 127034 pages (508136 KiB)",
+"",
+"  Extract a large directory with a writer thread and O_DIRECT, so that",
+"  the page cache of this host is not thrashed:",
+"",
+"    %s> ccat -d -O /var/lib /tmp/lib",
+"    Extracting /var/lib to /tmp/lib...",
+"    Total 2903412 pages (11613648 KiB) in 40517 extents",
+"",
+"  Extract a large directory with a journal, and resume it after being",
+"  interrupted:",
+"",
+"    %s> ccat -d -r / /mnt/root",
+"    Extracting / to /mnt/root...",
+"    ^C",
+"    %s> ccat -d -r / /mnt/root",
+"    Resuming / to /mnt/root...",
+"    Skipped 301529 files completed before",
+"    Total 21830592 pages (87322368 KiB) in 193027 extents",
+"",
+"  Write the \"/var/log\" directory to a compressed tar archive without",
+"  creating files:",
+"",
+"    %s> ccat -d -a -z /var/log log.tar.zst",
+"    Archiving /var/log to log.tar.zst...",
+"    Total 127034 pages (508136 KiB)",
+"",
+"  Store the \"/etc\" directory into a page store shared with the other",
+"  dumpfiles of the same fleet:",
+"",
+"    %s> ccat -d -s /srv/store /etc /srv/store/host1-etc.idx",
+"    Storing /etc to /srv/store...",
+"    Total 1523 pages (6092 KiB)",
+"    87 new pages (348 KiB) stored, 25140 pages in store",
+"",
+"  Record the manifest of the \"/etc\" directory to compare it with another",
+"  dumpfile by the cdiff command:",
+"",
+"    %s> ccat -d -m /etc /tmp/etc-1.mf",
+"    Recording /etc to /tmp/etc-1.mf...",
+"    Total 1523 pages (6092 KiB)",
+"    812 files recorded",
+NULL
+};
+
+static void
+print_debug_data(void)
+{
+	ulonglong data_debug = pc->flags & DATADEBUG;
+	pc->flags &= ~DATADEBUG;
+
+	fprintf(fp, "          env_flags: 0x%x", env_flags);
+	fprintf(fp, " %s", (env_flags & XARRAY) ? "XARRAY" : "RADIX_TREE");
+	if (CU_VALID_MEMBER(inode_i_mtime))
+		fprintf(fp, " %s", (env_flags & TIMESPEC64) ? "TIMESPEC64" : "TIMESPEC");
+	fprintf(fp, "\n");
+
+	fprintf(fp, "       inode_i_size: %ld\n", CU_OFFSET(inode_i_size));
+	fprintf(fp, "      inode_i_mtime: %ld\n", CU_OFFSET(inode_i_mtime));
+	fprintf(fp, "  inode_i_mtime_sec: %ld\n", CU_OFFSET(inode_i_mtime_sec));
+	fprintf(fp, " inode_i_mtime_nsec: %ld\n", CU_OFFSET(inode_i_mtime_nsec));
+	fprintf(fp, "       inode_i_link: %ld\n", CU_OFFSET(inode_i_link));
+	fprintf(fp, "  vfsmount_mnt_root: %ld\n", CU_OFFSET(vfsmount_mnt_root));
+	fprintf(fp, "      dentry_d_hash: %ld\n", CU_OFFSET(dentry_d_hash));
+	fprintf(fp, "       dentry_d_sib: %ld\n", CU_OFFSET(dentry_d_sib));
+	fprintf(fp, "  dentry_d_children: %ld\n", CU_OFFSET(dentry_d_children));
+	fprintf(fp, "     dentry_d_child: %ld\n", CU_OFFSET(dentry_d_child));
+	fprintf(fp, "   dentry_d_subdirs: %ld\n", CU_OFFSET(dentry_d_subdirs));
+	fprintf(fp, "hlist_bl_node_pprev: %ld\n", CU_OFFSET(hlist_bl_node_pprev));
+	fprintf(fp, " page_compound_head: %ld\n", CU_OFFSET(page_compound_head));
+	fprintf(fp, "page_compound_order: %ld\n", CU_OFFSET(page_compound_order));
+	fprintf(fp, "  folio_folio_order: %ld\n", CU_OFFSET(folio_folio_order));
+	fprintf(fp, "      folio_flags_1: %ld\n", CU_OFFSET(folio_flags_1));
+	fprintf(fp, "        pg_head_bit: %ld\n", pg_head_bit);
+	fprintf(fp, "     xarray_xa_head: %ld\n", CU_OFFSET(xarray_xa_head));
+	fprintf(fp, "      xa_node_shift: %ld\n", CU_OFFSET(xa_node_shift));
+	fprintf(fp, "      xa_node_slots: %ld\n", CU_OFFSET(xa_node_slots));
+	fprintf(fp, "          qstr_hash: %ld\n", CU_OFFSET(qstr_hash));
+	fprintf(fp, "       inode_i_data: %ld\n", CU_OFFSET(inode_i_data));
+	fprintf(fp, "     dentry_d_flags: %ld\n", CU_OFFSET(dentry_d_flags));
+	fprintf(fp, "   dentry_d_mounted: %ld\n", CU_OFFSET(dentry_d_mounted));
+	fprintf(fp, "     dcache_mounted: 0x%lx\n", dcache_mounted);
+	fprintf(fp, "     dentry_d_alias: %ld\n", CU_OFFSET(dentry_d_alias));
+	fprintf(fp, "     inode_i_dentry: %ld\n", CU_OFFSET(inode_i_dentry));
+	fprintf(fp, "    inode_i_sb_list: %ld\n", CU_OFFSET(inode_i_sb_list));
+	fprintf(fp, " super_block_s_list: %ld\n", CU_OFFSET(super_block_s_list));
+	fprintf(fp, "super_block_s_inodes: %ld\n", CU_OFFSET(super_block_s_inodes));
+	fprintf(fp, "   super_block_s_id: %ld\n", CU_OFFSET(super_block_s_id));
+	fprintf(fp, " super_block_s_type: %ld\n", CU_OFFSET(super_block_s_type));
+	fprintf(fp, "file_system_type_name: %ld\n", CU_OFFSET(file_system_type_name));
+	fprintf(fp, " external_name_name: %ld\n", CU_OFFSET(external_name_name));
+	fprintf(fp, "        dentry span: %ld-%ld of %ld\n", plan.dentry_start,
+		plan.dentry_end, SIZE(dentry));
+	fprintf(fp, "         inode span: %ld-%ld of %ld%s\n", plan.inode_start,
+		plan.inode_end, SIZE(inode),
+		plan.i_data_nrpages >= 0 ? " (with i_data.nrpages)" : "");
+
+	pc->flags |= data_debug;
+}
+
+static void
+cmd_cls(void)
+{
+	int c, i, n, nr;
+	ulong value;
+	struct task_context **tasks;
+
+	flags = SHOW_INFO;
+	tc = NULL;
+	rec_init();
+
+	while ((c = getopt(argcnt, args, "aDdF:f:ln:RtU")) != EOF) {
+		switch(c) {
+		case 'a':
+			flags |= SHOW_INFO_NEG_DENTS;
+			break;
+		case 'D':
+			print_debug_data();
+			return;
+		case 'd':
+			flags |= SHOW_INFO_DIRS;
+			break;
+		case 'l':
+			flags |= SHOW_INFO_LONG;
+			break;
+		case 'n':
+			if (STREQ(optarg, "all")) {
+				flags |= ALL_MNT_NS;
+				break;
+			}
+			switch (str_to_context(optarg, &value, &tc)) {
+			case STR_PID:
+			case STR_TASK:
+				break;
+			case STR_INVALID:
+				error(FATAL, "invalid task or pid value: %s\n",
+					optarg);
+				break;
+			}
+			break;
+		case 'R':
+			flags |= SHOW_INFO_RECURSIVE;
+			break;
+		case 't':
+			flags |= SHOW_INFO_SORT_MTIME;
+			break;
+		case 'U':
+			flags |= SHOW_INFO_DONT_SORT;
+			break;
+		case 'F':
+		case 'f':
+			rec_option(c, optarg);
+			break;
+		default:
+			argerrs++;
+			break;
+		}
+	}
+
+	if (argerrs || !args[optind])
+		cmd_usage(pc->curcmd, SYNOPSIS);
+
+	rec_open("dentry,inode,nrpages,percent,mode,size,mtime,unhashed,"
+		"path");
+
+	if (flags & ALL_MNT_NS)
+		tasks = get_mnt_ns_tasks(&nr);
+	else {
+		if (!tc)
+			set_default_task_context();
+		tasks = &tc;
+		nr = 1;
+	}
+
+	for (n = 0; n < nr; n++) {
+		tc = tasks[n];
+		if (flags & ALL_MNT_NS)
+			show_mnt_ns(n == 0);
+
+		init_cache();
+
+		i = optind;
+		do_command(args[i++], NULL);
+
+		while (args[i]) {
+			if (!rec.format)
+				fprintf(fp, "\n");
+			do_command(args[i++], NULL);
+		}
+
+		clear_cache();
+	}
+
+	rec_close();
+	if (flags & ALL_MNT_NS)
+		FREEBUF(tasks);
+}
+
+static char *help_cls[] = {
+"cls",				/* command name */
+"list dentry and inode caches",	/* short description */
+"[-adlRU] [-n pid|task|all] [-F json|csv [-f file]] abspath...",	/* argument synopsis, or " " if none */
+
+"  This command displays the addresses of dentry, inode and nrpages of a",
+"  specified absolute path and its subdirs if they exist in dentry cache.",
+"",
+"    -a  also display negative dentries in the subdirs list.",
+"    -d  display the directory itself only, without its contents.",
+"    -l  use a long format to display mode, size and mtime additionally.",
+"    -R  display subdirs recursively.",
+"    -t  sort subdirs by modification time, newest first.",
+"    -U  do not sort, list dentries in directory order.",
+"",
+"    -F json|csv  display a record per entry with all the fields in NDJSON",
+"                 or CSV, to be read by other tools.  Paths are absolute,",
+"                 and mtimes are in seconds.  CSV has a single header",
+"                 line, and the fields not in a record are empty.  Name",
+"                 bytes not in valid UTF-8 are escaped as \\udc80-\\udcff",
+"                 in NDJSON, like the surrogateescape of Python.",
+"    -f file      with -F, write the records to file directly instead of",
+"                 through the output pager.",
+"",
+"  For kernels supporting mount namespaces, the -n option may be used to",
+"  specify a task that has the target namespace:",
+"",
+"    -n pid   a process PID.",
+"    -n task  a hexadecimal task_struct pointer.",
+"    -n all   every mount namespace in turn, each after a line with the",
+"             namespace and the task of the lowest PID in it.",
+"",
+"  These are file type indicators, which are appended to entries:",
+"",
+"    / : directory",
+"    * : executable",
+"    @ : symbolic link",
+"    | : named pipe",
+"    = : socket",
+"    (name) : unfinished dentry",
+"",
+"EXAMPLE",
+"  Display the \"/var/log/messages\" regular file's information:",
+"",
+"    %s> cls /var/log/messages",
+"    DENTRY           INODE            NRPAGES   % PATH",
+"    ffff9c0c28fda480 ffff9c0c22c675b8     220 100 /var/log/messages",
+"",
+"  The '\%' column shows the percentage of cached pages in the file.",
+"",
+"  Display the \"/var/log\" directory and its subdirs information:",
+"",
+"    %s> cls /var/log",
+"    DENTRY           INODE            NRPAGES   % PATH",
+"    ffff9c0c3eabe300 ffff9c0c3e875b78       0   0 ./",
+"    ffff9c0c16a22900 ffff9c0c16ada2f8       0   0 anaconda/",
+"    ffff9c0c37611000 ffff9c0c3759f5b8       0   0 audit/",
+"    ffff9c0c375ccc00 ffff9c0c3761c8b8       1 100 btmp",
+"    ffff9c0c28fda240 ffff9c0c22c713f8       6 100 cron",
+"    ffff9c0c3eb7f180 ffff9c0bfd402a78      36   7 dnf.librepo.log",
+"    ...",
+"",
+"  In addition to the same information, display their mode, size and mtime:",
+"",
+"    %s> cls -l /var/log",
+"    DENTRY           INODE            NRPAGES   %   MODE        SIZE MTIME                         PATH",
+"    ffff9c0c3eabe300 ffff9c0c3e875b78       0   0  40755        4096 2018-11-25.03:39:01.479315763 ./",
+"    ffff9c0c16a22900 ffff9c0c16ada2f8       0   0  40755         250 2018-03-21.13:18:38.816000000 anaconda/",
+"    ffff9c0c37611000 ffff9c0c3759f5b8       0   0  40700          80 2018-10-25.19:02:13.968692776 audit/",
+"    ffff9c0c375ccc00 ffff9c0c3761c8b8       1 100 100660         384 2018-11-28.16:39:34.538315763 btmp",
+"    ffff9c0c28fda240 ffff9c0c22c713f8       6 100 100600       23435 2018-11-28.16:01:01.667315763 cron",
+"    ffff9c0c3eb7f180 ffff9c0bfd402a78      36   7 100600     1921580 2018-11-28.16:41:24.073315763 dnf.librepo.log",
+"    ...",
+"",
+"  Display the \"/var/log\" directory itself only:",
+"",
+"    %s> cls -d /var/log",
+"    DENTRY           INODE            NRPAGES   % PATH",
+"    ffff9c0c3eabe300 ffff9c0c3e875b78       0   0 /var/log/",
+"",
+"  Display the \"/var/log\" directory and its subdirs recursively:",
+"",
+"    crash> cls -R /var/log",
+"    DENTRY           INODE            NRPAGES   % PATH",
+"    ffff9c0c3eabe300 ffff9c0c3e875b78       0   0 ./",
+"    ffff9c0c16a22900 ffff9c0c16ada2f8       0   0 anaconda/",
+"    ffff9c0c37611000 ffff9c0c3759f5b8       0   0 audit/",
+"    ...",
+"",
+"    /var/log/anaconda:",
+"",
+"    /var/log/audit:",
+"    ffff9c0c37582e40 ffff9c0c3759d038     208  19 audit.log",
+"    ...",
+NULL
+};
+
+static void
+cmd_cfind(void)
+{
+	int c, n, nr;
+	ulong value;
+	struct task_context **tasks;
+
+	flags = FIND_FILES;
+	tc = NULL;
+	rec_init();
+
+	/* stop at the path, not to take the predicates for options */
+	while ((c = getopt(argcnt, args, "+acF:f:n:")) != EOF) {
+		switch(c) {
+		case 'a':
+			flags |= SHOW_INFO_NEG_DENTS;
+			break;
+		case 'c':
+			flags |= FIND_COUNT_DENTRY;
+			break;
+		case 'n':
+			if (STREQ(optarg, "all")) {
+				flags |= ALL_MNT_NS;
+				break;
+			}
+			switch (str_to_context(optarg, &value, &tc)) {
+			case STR_PID:
+			case STR_TASK:
+				break;
+			case STR_INVALID:
+				error(FATAL, "invalid task or pid value: %s\n",
+					optarg);
+				break;
+			}
+			break;
+		case 'F':
+		case 'f':
+			rec_option(c, optarg);
+			break;
+		default:
+			argerrs++;
+			break;
+		}
+	}
+
+	if (argerrs || !args[optind])
+		cmd_usage(pc->curcmd, SYNOPSIS);
+
+	cfind_parse(&args[optind + 1]);
+	rec_open("dentry,inode,total,dentries,negdent,path");
+
+	if (flags & ALL_MNT_NS)
+		tasks = get_mnt_ns_tasks(&nr);
+	else {
+		if (!tc)
+			set_default_task_context();
+		tasks = &tc;
+		nr = 1;
+	}
+
+	for (n = 0; n < nr; n++) {
+		tc = tasks[n];
+		if (flags & ALL_MNT_NS)
+			show_mnt_ns(n == 0);
+
+		init_cache();
+		do_command(args[optind], NULL);
+		clear_cache();
+	}
+
+	rec_close();
+	if (flags & ALL_MNT_NS)
+		FREEBUF(tasks);
+}
+
+static char *help_cfind[] = {
+"cfind",
+"search for files in a directory hierarchy",
+"[-ac] [-n pid|task|all] [-F json|csv [-f file]] abspath [predicate ...]",
+
+"  This command searches for files in a directory hierarchy across mounted",
+"  file systems like a \"find\" command.",
+"",
+"    -a  also display negative dentries.",
+"    -c  count dentries in each directory.",
+"",
+"    -F json|csv  display a record per line in NDJSON or CSV, to be read",
+"                 by other tools.  The TOTAL line of -c is omitted.",
+"    -f file      with -F, write the records to file directly instead of",
+"                 through the output pager.",
+"",
+"  The predicates after abspath select the files to display, all of which",
+"  have to match.  The name is matched before reading the inode, and the",
+"  inode is read only for -type, -size and -mmin.  With -c, only -maxdepth,",
+"  -prune and -xdev are used.",
+"",
+"    -name pattern  the file name matches the shell pattern.",
+"    -type c        the file is of type c: b, c, d, p, f, l or s.",
+"    -size [+-]n[bcwkMG]",
+"                   the file size is n units, rounded up like find.",
+"    -mmin [+-]n    the file was modified n minutes before the dump.",
+"    -maxdepth n    descend at most n levels below abspath.",
+"    -prune pattern do not descend into the directories whose names match",
+"                   the shell pattern.",
+"    -xdev          do not descend into the directories on other mounts.",
+"",
+"  For kernels supporting mount namespaces, the -n option may be used to",
+"  specify a task that has the target namespace:",
+"",
+"    -n pid   a process PID.",
+"    -n task  a hexadecimal task_struct pointer.",
+"    -n all   every mount namespace in turn, each after a line with the",
+"             namespace and the task of the lowest PID in it.",
+"",
+"EXAMPLE",
+"  Search for \"messages\" files through the root file system with the grep",
+"  command:",
+"",
+"    %s> cfind / | grep messages",
+"    ffff9dc4df288c00 ffff9dc24dbb6308 /var/log/messages",
+"",
+"  The addresses are the file's dentry and inode respectively.",
+"",
+"  Count dentries in the /boot directory and its subdirectories:",
+"",
+"    %s> cfind -c /boot",
+"      TOTAL DENTRY N_DENT PATH",
+"         18     12      6 /boot",
+"          8      6      2 /boot/grub2",
+"         34     34      0 /boot/grub2/locale",
+"        268    268      0 /boot/grub2/i386-pc",
+"          1      1      0 /boot/grub2/fonts",
+"          1      1      0 /boot/efi",
+"          2      1      1 /boot/efi/EFI",
+"          3      0      3 /boot/efi/EFI/redhat",
+"        335    323     12 TOTAL",
+"",
+"  Search for log files under /var without reading the inodes of the other",
+"  files:",
+"",
+"    %s> cfind /var -name *.log -type f",
+"    ffff9dc4c5b1a0c0 ffff9dc24d4e3a88 /var/log/dnf.log",
+"    ffff9dc4c5b1a3c0 ffff9dc24d4e4f08 /var/log/boot.log",
+"    ffff9dc4c5b1a6c0 ffff9dc24d4e5d48 /var/log/tuned/tuned.log",
+"",
+"  Write the files under /var as NDJSON records to a file:",
+"",
+"    %s> cfind -F json -f /tmp/var.json /var",
+"    %s> !head -2 /tmp/var.json",
+"    {\"type\":\"path\",\"dentry\":\"ffff9dc4c5b10a80\",\"inode\":\"ffff9dc24d4d0c88\",\"path\":\"/var\"}",
+"    {\"type\":\"path\",\"dentry\":\"ffff9dc4c5b12cc0\",\"inode\":\"ffff9dc24d4e1948\",\"path\":\"/var/log\"}",
+"",
+"  Search the mount namespaces of all the containers as well:",
+"",
+"    %s> cfind -n all /etc/hostname",
+"    MNT_NS: ffff9dc240d4c000  PID: 1  COMMAND: \"systemd\"",
+"    ffff9dc4df2a6f00 ffff9dc24dbfa2c8 /etc/hostname",
+"",
+"    MNT_NS: ffff9dc2d1e6e400  PID: 2853  COMMAND: \"nginx\"",
+"    ffff9dc2a0c3e9c0 ffff9dc24e0d44f8 /etc/hostname",
+"    ...",
+NULL
+};
+
+/*
+ * Create the directories in path after the first len bytes.
+ */
+static void
+make_parents(char *path, int len)
+{
+	char *slash;
+
+	for (slash = strchr(path + len + 1, '/'); slash;
+	     slash = strchr(slash + 1, '/')) {
+		*slash = '\0';
+		if (mkdir(path, MODE_RWX) < 0 && errno != EEXIST)
+			error(INFO, "%s: cannot create directory: %s\n",
+				path, strerror(errno));
+		*slash = '/';
+	}
+}
+
+/*
+ * A member name has to be relative and stay under outdir.
+ */
+static int
+member_name_valid(char *name)
+{
+	char *p;
+
+	if (*name == '\0' || *name == '/')
+		return FALSE;
+
+	for (p = name; p; p = strchr(p, '/')) {
+		if (*p == '/')
+			p++;
+		if (p[0] == '.' && p[1] == '.' && (p[2] == '/' || p[2] == '\0'))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static int
+path_matches(char *name, char *filter)
+{
+	size_t len;
+
+	if (!filter)
+		return TRUE;
+
+	len = strlen(filter);
+	return STRNEQ(name, filter) && (name[len] == '\0' || name[len] == '/');
+}
+
+typedef struct {
+	char *path;
+	struct timespec mtime;
+} restore_dir_t;
+
+static void
+restore_index(FILE *in, char *outdir, char *filter)
+{
+	char *line = NULL, *name, *buf;
+	size_t linesz = 0;
+	ssize_t len;
+	char path[PATH_MAX];
+	int fd = -1, n, outlen = strlen(outdir);
+	uint mode;
+	ulong index, nr_files = 0, nr_pages = 0, nr_missing = 0;
+	ulonglong size = 0, hash[2], pos;
+	struct timespec mtime, file_mtime;
+	store_ent_t *e;
+	restore_dir_t *dirs = NULL;
+	int nr_dirs = 0, i;
+
+	buf = GETBUF(store.pagesize);
+
+	while ((len = getline(&line, &linesz, in)) > 0) {
+		if (line[len-1] == '\n')
+			line[len-1] = '\0';
+
+		if (line[0] == 'P') {
+			if (fd < 0)
+				continue;
+			if (sscanf(line, "P %lu %16llx%16llx", &index,
+			    &hash[0], &hash[1]) != 3)
+				goto bad_line;
+			e = store_lookup(hash);
+			pos = (ulonglong)index * store.pagesize;
+			if (!e->offset || pos >= size ||
+			    pread(store.pack_fd, buf, store.pagesize,
+			    e->offset - 1) != store.pagesize) {
+				nr_missing++;
+				continue;
+			}
+			if (!write_extent(fd, buf, MIN(size - pos,
+			    store.pagesize), pos))
+				error(INFO, "%s: write error: %s\n",
+					path, strerror(errno));
+			nr_pages++;
+			continue;
+		}
+
+		/* a new entry, so finish the last file */
+		if (fd >= 0) {
+			close(fd);
+			set_mtime(path, file_mtime);
+			fd = -1;
+		}
+
+		if (line[0] == 'D') {
+			if (sscanf(line, "D %o %ld.%ld %n", &mode,
+			    &mtime.tv_sec, &mtime.tv_nsec, &n) != 3)
+				goto bad_line;
+			name = line + n;
+			if (!member_name_valid(name))
+				goto bad_name;
+			if (!path_matches(name, filter))
+				continue;
+			snprintf(path, PATH_MAX, "%s/%s", outdir, name);
+			make_parents(path, outlen);
+			if (mkdir(path, MODE_RWX) < 0 && errno != EEXIST) {
+				error(INFO, "%s: cannot create directory: %s\n",
+					path, strerror(errno));
+				continue;
+			}
+			dirs = realloc(dirs, sizeof(restore_dir_t) * (nr_dirs + 1));
+			if (!dirs)
+				error(FATAL, "cannot allocate directory list\n");
+			dirs[nr_dirs].path = strdup(path);
+			dirs[nr_dirs].mtime = mtime;
+			nr_dirs++;
+
+		} else if (line[0] == 'F') {
+			if (sscanf(line, "F %o %llu %ld.%ld %n", &mode, &size,
+			    &file_mtime.tv_sec, &file_mtime.tv_nsec, &n) != 4)
+				goto bad_line;
+			name = line + n;
+			if (!member_name_valid(name))
+				goto bad_name;
+			if (!path_matches(name, filter))
+				continue;
+			snprintf(path, PATH_MAX, "%s/%s", outdir, name);
+			make_parents(path, outlen);
+			if ((fd = open(path, O_WRONLY|O_CREAT|O_EXCL, 0666)) < 0) {
+				error(INFO, "%s: cannot open: %s\n",
+					path, strerror(errno));
+				continue;
+			}
+			if (ftruncate(fd, size) < 0)
+				error(INFO, "%s: cannot set size: %s\n",
+					path, strerror(errno));
+			nr_files++;
+		}
+		continue;
+bad_line:
+		error(INFO, "invalid line: %s\n", line);
+		continue;
+bad_name:
+		error(INFO, "%s: invalid member name\n", name);
+	}
+
+	if (fd >= 0) {
+		close(fd);
+		set_mtime(path, file_mtime);
+	}
+
+	/* children first */
+	for (i = nr_dirs - 1; i >= 0; i--) {
+		set_mtime(dirs[i].path, dirs[i].mtime);
+		free(dirs[i].path);
+	}
+	free(dirs);
+	free(line);
+	FREEBUF(buf);
+
+	if (nr_missing)
+		error(INFO, "%lu pages not found in store\n", nr_missing);
+	fprintf(fp, "Restored %lu files, %lu pages (%lu KiB)\n",
+		nr_files, nr_pages, store.pagesize * nr_pages >> 10);
+}
+
+static void
+cmd_cstore(void)
+{
+	int c;
+	char *dir, *index, *outdir, *filter;
+	ulong pagesize;
+	FILE *in;
+
+	while ((c = getopt(argcnt, args, "")) != EOF) {
+		switch(c) {
+		default:
+			argerrs++;
+			break;
+		}
+	}
+
+	if (argerrs || !args[optind] || !args[optind+1] || !args[optind+2])
+		cmd_usage(pc->curcmd, SYNOPSIS);
+
+	dir = args[optind++];
+	index = args[optind++];
+	outdir = args[optind++];
+	filter = args[optind];
+
+	normalize_path(outdir);
+	normalize_path(filter);
+
+	if (access(outdir, F_OK) == 0) {
+		error(INFO, "%s: %s\n", outdir, strerror(EEXIST));
+		return;
+	}
+
+	if ((in = fopen(index, "r")) == NULL) {
+		error(INFO, "%s: cannot open: %s\n", index, strerror(errno));
+		return;
+	}
+	if (fscanf(in, STORE_MAGIC " %lu%*[^\n]\n", &pagesize) != 1) {
+		error(INFO, "%s: not a store index\n", index);
+		fclose(in);
+		return;
+	}
+
+	/* The store is looked up with the page size in the index. */
+	if (!pagesize || (pagesize & (pagesize - 1)) ||
+	    pagesize > MAX_STORE_PAGESIZE) {
+		error(INFO, "%s: page size %lu is not supported\n",
+			index, pagesize);
+		fclose(in);
+		return;
+	}
+	if (!store_load(dir, FALSE, pagesize))
+		goto out;
+
+	if (mkdir(outdir, MODE_RWX) < 0) {
+		error(INFO, "%s: cannot create directory: %s\n",
+			outdir, strerror(errno));
+		goto out;
+	}
+
+	restore_index(in, outdir, filter);
+out:
+	store_close();
+	fclose(in);
+}
+
+static char *help_cstore[] = {
+"cstore",
+"reconstruct files from a page store",
+"storedir index outdir [path]",
+
+"  This command reconstructs the files and directories recorded in an index",
+"  file by \"ccat -s\" from the pages in a content-addressed page store.",
+"",
+"  storedir  the store directory specified with the ccat -s option.",
+"     index  the index file created by the ccat -s option.",
+"    outdir  a directory path to be created.",
+"      path  reconstruct only the path and its contents in the index.",
+"",
+"EXAMPLE",
+"  Reconstruct the \"etc/ssh\" directory stored by ccat -s:",
+"",
+"    %s> cstore /srv/store /srv/store/host1-etc.idx /tmp/host1 etc/ssh",
+"    Restored 14 files, 31 pages (124 KiB)",
+NULL
+};
+
+/*
+ * cdiff: the entries of the first manifest are kept in the order read, and
+ * looked up by path for the entries of the second one.
+ */
+typedef struct {
+	char *path;
+	int type;
+	int seen;
+	ulonglong size, hash[2];
+	ulong first, nr_pages;	/* in cdiff.pages */
+} cdiff_ent_t;
+
+static struct {
+	cdiff_ent_t *ents;
+	ulong nr_ents, ents_size;
+	ulong *table;		/* index in ents, plus one; 0 means empty */
+	ulong size;
+	manifest_page_t *pages;
+	ulong nr_pages, pages_size;
+	ulong nr_compared, nr_modified, nr_added, nr_removed;
+} cdiff;
+
+static void
+cdiff_close(void)
+{
+	ulong i;
+
+	for (i = 0; i < cdiff.nr_ents; i++)
+		free(cdiff.ents[i].path);
+	free(cdiff.ents);
+	free(cdiff.table);
+	free(cdiff.pages);
+	BZERO(&cdiff, sizeof(cdiff));
+	manifest_close();
+}
+
+static ulong *
+cdiff_lookup(char *path)
+{
+	ulonglong hash[2];
+	ulong i, *e;
+
+	hash128(path, strlen(path), hash);
+	for (i = hash[0] & (cdiff.size - 1); ; i = (i + 1) & (cdiff.size - 1)) {
+		e = &cdiff.table[i];
+		if (!*e || STREQ(cdiff.ents[*e - 1].path, path))
+			return e;
+	}
+}
+
+static void
+cdiff_insert(cdiff_ent_t *ent, manifest_page_t *pages, ulong nr_pages)
+{
+	ulong i, *e;
+
+	if ((cdiff.nr_ents + 1) * 2 > cdiff.size) {
+		free(cdiff.table);
+		cdiff.size = cdiff.size ? cdiff.size * 2 : 4096;
+		if (!(cdiff.table = calloc(cdiff.size, sizeof(ulong))))
+			error(FATAL, "cannot allocate cdiff table\n");
+		for (i = 0; i < cdiff.nr_ents; i++)
+			*cdiff_lookup(cdiff.ents[i].path) = i + 1;
+	}
+
+	e = cdiff_lookup(ent->path);
+	if (*e)
+		return;		/* duplicated, use the first one */
+
+	if (cdiff.nr_ents == cdiff.ents_size) {
+		cdiff.ents_size = cdiff.ents_size ? cdiff.ents_size * 2 : 1024;
+		cdiff.ents = realloc(cdiff.ents,
+				sizeof(cdiff_ent_t) * cdiff.ents_size);
+		if (!cdiff.ents)
+			error(FATAL, "cannot allocate cdiff entries\n");
+	}
+	if (cdiff.nr_pages + nr_pages > cdiff.pages_size) {
+		while (cdiff.nr_pages + nr_pages > cdiff.pages_size)
+			cdiff.pages_size = cdiff.pages_size ?
+				cdiff.pages_size * 2 : 4096;
+		cdiff.pages = realloc(cdiff.pages,
+				sizeof(manifest_page_t) * cdiff.pages_size);
+		if (!cdiff.pages)
+			error(FATAL, "cannot allocate cdiff pages\n");
+	}
+
+	memcpy(cdiff.pages + cdiff.nr_pages, pages,
+		sizeof(manifest_page_t) * nr_pages);
+	cdiff.ents[cdiff.nr_ents] = *ent;
+	cdiff.ents[cdiff.nr_ents].path = strdup(ent->path);
+	cdiff.ents[cdiff.nr_ents].first = cdiff.nr_pages;
+	cdiff.ents[cdiff.nr_ents].nr_pages = nr_pages;
+	cdiff.nr_pages += nr_pages;
+	*e = ++cdiff.nr_ents;
+}
+
+/*
+ * Append the changed pages in index ranges like "0-3,7" to buf.
+ */
+static void
+cdiff_ranges(char *buf, int size, ulonglong start, ulonglong end)
+{
+	int len = strlen(buf);
+
+	/* already truncated */
+	if (len >= 3 && STREQ(buf + len - 3, "..."))
+		return;
+	if (len > size - 48) {	/* room for ",<start>-<end>" */
+		strcat(buf, len ? ",..." : "...");
+		return;
+	}
+
+	if (start == end)
+		snprintf(buf + len, size - len, "%s%llu", len ? "," : "",
+			start);
+	else
+		snprintf(buf + len, size - len, "%s%llu-%llu", len ? "," : "",
+			start, end);
+}
+
+static void
+cdiff_compare(cdiff_ent_t *ent, manifest_page_t *pages, ulong nr_pages)
+{
+	cdiff_ent_t *old;
+	manifest_page_t *op;
+	ulong *e, i, j;
+	ulonglong start = 0, end = 0;
+	int changed = FALSE;
+	char ranges[BUFSIZE], sizes[BUFSIZE];
+
+	e = cdiff_lookup(ent->path);
+	if (!*e) {
+		fprintf(fp, "A %s%s\n", ent->path, ent->type == 'D' ? "/" : "");
+		cdiff.nr_added++;
+		return;
+	}
+	old = &cdiff.ents[*e - 1];
+	old->seen = TRUE;
+
+	if (old->type != ent->type) {
+		fprintf(fp, "M %s  file type\n", ent->path);
+		cdiff.nr_modified++;
+		return;
+	} else if (ent->type == 'D')
+		return;
+
+	cdiff.nr_compared++;
+	if (old->size == ent->size && old->hash[0] == ent->hash[0] &&
+	    old->hash[1] == ent->hash[1])
+		return;
+
+	/* Only the pages cached in both can be compared. */
+	ranges[0] = '\0';
+	op = cdiff.pages + old->first;
+	for (i = j = 0; i < old->nr_pages && j < nr_pages; ) {
+		if (op[i].index < pages[j].index) {
+			i++;
+			continue;
+		} else if (op[i].index > pages[j].index) {
+			j++;
+			continue;
+		}
+
+		if (op[i].hash[0] != pages[j].hash[0] ||
+		    op[i].hash[1] != pages[j].hash[1]) {
+			if (changed && pages[j].index == end + 1)
+				end++;
+			else {
+				if (changed)
+					cdiff_ranges(ranges, BUFSIZE, start, end);
+				start = end = pages[j].index;
+				changed = TRUE;
+			}
+		}
+		i++, j++;
+	}
+	if (changed)
+		cdiff_ranges(ranges, BUFSIZE, start, end);
+
+	if (old->size == ent->size && !changed)
+		return;
+
+	sizes[0] = '\0';
+	if (old->size != ent->size)
+		snprintf(sizes, BUFSIZE, "size %llu -> %llu%s", old->size,
+			ent->size, changed ? ", " : "");
+
+	fprintf(fp, "M %s  %s%s%s\n", ent->path, sizes,
+		changed ? "pages " : "", ranges);
+	cdiff.nr_modified++;
+}
+
+/*
+ * Read a manifest and call fn with each entry and its cached pages.
+ * The page size has to be the same as *pagesize unless it is zero.
+ */
+static int
+cdiff_read(char *path, ulong *pagesize,
+	void (*fn)(cdiff_ent_t *, manifest_page_t *, ulong))
+{
+	FILE *in;
+	char *line = NULL;
+	size_t linesz = 0;
+	ssize_t len;
+	ulong psize, nr;
+	uint mode;
+	int n, pending = FALSE;
+	long sec, nsec;
+	cdiff_ent_t ent;
+	manifest_page_t mp;
+
+	if ((in = fopen(path, "r")) == NULL) {
+		error(INFO, "%s: cannot open: %s\n", path, strerror(errno));
+		return FALSE;
+	}
+	if (fscanf(in, MANIFEST_MAGIC " %lu%*[^\n]\n", &psize) != 1) {
+		error(INFO, "%s: not a manifest\n", path);
+		fclose(in);
+		return FALSE;
+	} else if (*pagesize && psize != *pagesize) {
+		error(INFO, "%s: page size %lu differs from %lu\n", path,
+			psize, *pagesize);
+		fclose(in);
+		return FALSE;
+	}
+	*pagesize = psize;
+
+	BZERO(&ent, sizeof(ent));
+	manifest.nr_pages = 0;
+
+	while ((len = getline(&line, &linesz, in)) > 0) {
+		if (line[len-1] == '\n')
+			line[len-1] = '\0';
+
+		if (line[0] == 'P') {
+			if (!pending || sscanf(line, "P %llu %16llx%16llx",
+			    &mp.index, &mp.hash[0], &mp.hash[1]) != 3)
+				goto bad_line;
+			if (manifest.nr_pages == manifest.size) {
+				manifest.size = manifest.size ?
+					manifest.size * 2 : 1024;
+				manifest.pages = realloc(manifest.pages,
+					sizeof(manifest_page_t) * manifest.size);
+				if (!manifest.pages)
+					error(FATAL, "cannot allocate manifest pages\n");
+			}
+			manifest.pages[manifest.nr_pages++] = mp;
+			continue;
+		}
+
+		if (pending) {
+			fn(&ent, manifest.pages, manifest.nr_pages);
+			free(ent.path);
+			BZERO(&ent, sizeof(ent));
+			manifest.nr_pages = 0;
+			pending = FALSE;
+		}
+
+		if (line[0] == 'D') {
+			if (sscanf(line, "D %o %ld.%ld %n", &mode, &sec, &nsec,
+			    &n) != 3)
+				goto bad_line;
+		} else if (line[0] == 'F') {
+			if (sscanf(line, "F %*x %o %llu %ld.%ld %lu %16llx%16llx %n",
+			    &mode, &ent.size, &sec, &nsec, &nr, &ent.hash[0],
+			    &ent.hash[1], &n) != 7)
+				goto bad_line;
+		} else
+			goto bad_line;
+
+		ent.type = line[0];
+		ent.path = strdup(line + n);
+		pending = TRUE;
+		continue;
+bad_line:
+		error(INFO, "%s: invalid line: %s\n", path, line);
+	}
+
+	if (pending) {
+		fn(&ent, manifest.pages, manifest.nr_pages);
+		free(ent.path);
+	}
+
+	free(line);
+	fclose(in);
+
+	return TRUE;
+}
+
+static void
+cmd_cdiff(void)
+{
+	int c;
+	ulong i, pagesize = 0;
+	char *old, *new;
+
+	while ((c = getopt(argcnt, args, "")) != EOF) {
+		switch(c) {
+		default:
+			argerrs++;
+			break;
+		}
+	}
+
+	if (argerrs || !args[optind] || !args[optind+1])
+		cmd_usage(pc->curcmd, SYNOPSIS);
+
+	old = args[optind++];
+	new = args[optind];
+
+	/* In case that the last command was interrupted. */
+	cdiff_close();
+
+	if (!cdiff_read(old, &pagesize, cdiff_insert) ||
+	    !cdiff_read(new, &pagesize, cdiff_compare))
+		goto out;
+
+	for (i = 0; i < cdiff.nr_ents; i++) {
+		if (cdiff.ents[i].seen)
+			continue;
+		fprintf(fp, "R %s%s\n", cdiff.ents[i].path,
+			cdiff.ents[i].type == 'D' ? "/" : "");
+		cdiff.nr_removed++;
+	}
+
+	fprintf(fp, "%lu modified, %lu added, %lu removed in %lu files\n",
+		cdiff.nr_modified, cdiff.nr_added, cdiff.nr_removed,
+		cdiff.nr_compared);
+out:
+	cdiff_close();
+}
+
+static char *help_cdiff[] = {
+"cdiff",
+"compare two manifests of cached files",
+"manifest1 manifest2",
+
+"  This command compares two manifests recorded by \"ccat -m\", for example",
+"  from two dumpfiles of the same host, and lists the files whose cached",
+"  contents differ without extracting them.  The lines start with:",
+"",
+"    M  modified: the size or the cached pages differ.  The indexes of",
+"       the changed pages are shown.",
+"    A  added: only in manifest2.",
+"    R  removed: only in manifest1.",
+"",
+"  Only the pages cached in both dumpfiles can be compared, so a change",
+"  in pages that are not cached in either of them is not detected.",
+"",
+"EXAMPLE",
+"  Compare the \"/etc\" directories of two dumpfiles:",
+"",
+"    %s> cdiff /tmp/etc-1.mf /tmp/etc-2.mf",
+"    M etc/ssh/sshd_config  size 3667 -> 3702, pages 0",
+"    M etc/resolv.conf  pages 0",
+"    A etc/sysconfig/network-scripts/ifcfg-eth1",
+"    R etc/resolv.conf.bak",
+"    2 modified, 1 added, 1 removed in 812 files",
+NULL
+};
+
+static void
+grep_add_pattern(char *pattern)
+{
+	char *p;
+
+	if (*pattern == '\0')
+		error(FATAL, "empty pattern\n");
+	if (strchr(pattern, '\n'))
+		error(FATAL, "pattern with a newline\n");
+
+	/* a lower-cased copy, not to change the command line */
+	if (grep.icase && !grep.extended) {
+		pattern = strcpy(GETBUF(strlen(pattern) + 1), pattern);
+		for (p = pattern; *p; p++)
+			*p = tolower((unsigned char)*p);
+	}
+
+	grep.patterns[grep.nr_patterns] = pattern;
+	grep.lens[grep.nr_patterns] = strlen(pattern);
+	grep.nr_patterns++;
+}
+
+static void
+cmd_cgrep(void)
+{
+	int c, i, n, nr, ret;
+	ulong value;
+	char errbuf[BUFSIZE];
+	struct task_context **tasks;
+
+	flags = GREP_CONTENTS;
+	tc = NULL;
+
+	/* In case that the last command was interrupted. */
+	grep_reset();
+	grep.extended = grep.icase = grep.list = grep.count = FALSE;
+	rec_init();
+
+	while ((c = getopt(argcnt, args, "ce:Eiln:")) != EOF) {
+		switch(c) {
+		case 'c':
+			grep.count = TRUE;
+			break;
+		case 'e':
+			if (grep.nr_patterns == GREP_MAX_PATTERNS)
+				error(FATAL, "too many patterns (max %d)\n",
+					GREP_MAX_PATTERNS);
+			grep.patterns[grep.nr_patterns++] = optarg;
+			break;
+		case 'E':
+			grep.extended = TRUE;
+			break;
+		case 'i':
+			grep.icase = TRUE;
+			break;
+		case 'l':
+			grep.list = TRUE;
+			break;
+		case 'n':
+			if (STREQ(optarg, "all")) {
+				flags |= ALL_MNT_NS;
+				break;
+			}
+			switch (str_to_context(optarg, &value, &tc)) {
+			case STR_PID:
+			case STR_TASK:
+				break;
+			case STR_INVALID:
+				error(FATAL, "invalid task or pid value: %s\n",
+					optarg);
+				break;
+			}
+			break;
+		default:
+			argerrs++;
+			break;
+		}
+	}
+
+	if (!grep.nr_patterns && args[optind])
+		grep.patterns[grep.nr_patterns++] = args[optind++];
+
+	if (argerrs || !grep.nr_patterns || !args[optind] || args[optind+1])
+		cmd_usage(pc->curcmd, SYNOPSIS);
+
+	/* The options can follow -e, so check the patterns here. */
+	c = grep.nr_patterns;
+	grep.nr_patterns = 0;
+	for (i = 0; i < c; i++)
+		grep_add_pattern(grep.patterns[i]);
+
+	if (grep.extended) {
+		for (i = 0; i < grep.nr_patterns; i++) {
+			ret = regcomp(&grep.regex[i], grep.patterns[i],
+				REG_EXTENDED|REG_NEWLINE|
+				(grep.icase ? REG_ICASE : 0));
+			if (ret) {
+				regerror(ret, &grep.regex[i], errbuf, BUFSIZE);
+				error(FATAL, "%s: %s\n", grep.patterns[i],
+					errbuf);
+			}
+			grep.nr_regex++;
+		}
+	}
+
+	if (flags & ALL_MNT_NS)
+		tasks = get_mnt_ns_tasks(&nr);
+	else {
+		if (!tc)
+			set_default_task_context();
+		tasks = &tc;
+		nr = 1;
+	}
+
+	if (grep.icase && !grep.extended)
+		grep.lbuf = GETBUF(EXTENT_BUFSIZE);
+	grep.total_matches = grep.total_files = 0;
+
+	for (n = 0; n < nr; n++) {
+		tc = tasks[n];
+		if (flags & ALL_MNT_NS)
+			show_mnt_ns(n == 0);
+
+		init_cache();
+		do_command(args[optind], NULL);
+		clear_cache();
+	}
+
+	if (CRASHDEBUG(1))
+		error(INFO, "%lu lines matched in %lu files\n",
+			grep.total_matches, grep.total_files);
+
+	if (grep.lbuf)
+		FREEBUF(grep.lbuf);
+	grep_reset();
+	if (flags & ALL_MNT_NS)
+		FREEBUF(tasks);
+}
+
+static char *help_cgrep[] = {
+"cgrep",
+"search the cached contents of files for patterns",
+"[-cEil] [-n pid|task|all] {pattern | -e pattern ...} abspath",
+
+"  This command searches the cached pages of a file, or the files in a",
+"  directory hierarchy across mounted file systems, for lines that match",
+"  any of the patterns, without extracting them.  A matching line is shown",
+"  as \"path:offset:line\", where offset is the file offset of the line.",
+"",
+"    -e pattern  a pattern.  This option can be repeated up to 32 times.",
+"    -E  interpret the patterns as POSIX extended regular expressions.",
+"        Otherwise they are fixed strings.",
+"    -i  ignore case.",
+"    -l  display only the paths of the files that have a matching line.",
+"    -c  display only the number of matching lines of each file that has",
+"        a matching line, as \"path:count\".",
+"",
+"  The pages are searched in order with the incomplete last line of the",
+"  previous pages, so a match across page boundaries is found.  A line",
+"  is cut at a page that is not cached or excluded from the dumpfile.",
+"",
+"  For kernels supporting mount namespaces, the -n option may be used to",
+"  specify a task that has the target namespace:",
+"",
+"    -n pid   a process PID.",
+"    -n task  a hexadecimal task_struct pointer.",
+"    -n all   every mount namespace in turn, each after a line with the",
+"             namespace and the task of the lowest PID in it.",
+"",
+"EXAMPLES",
+"  Search the cached logs for an error message:",
+"",
+"    %s> cgrep \"I/O error\" /var/log",
+"    /var/log/messages:1834219:Mar  2 04:11:52 host kernel: blk_update_request: I/O error, dev sdb, sector 2048",
+"",
+"  List the files that have either of the patterns, ignoring case:",
+"",
+"    %s> cgrep -il -e panic -e oops /var/log",
+"    /var/log/messages",
+"    /var/log/kern.log",
+"",
+"  Search with a regular expression:",
+"",
+"    %s> cgrep -E \"^Mar  2 04:1[0-9]:.*segfault\" /var/log/messages",
+"    /var/log/messages:1829977:Mar  2 04:10:03 host kernel: httpd[4411]: segfault at 0 ip 00007f3e...",
+NULL
+};
+
+static void
+cmd_ccache(void)
+{
+	int c, i;
+	ulong ents, hits, misses;
+
+	while ((c = getopt(argcnt, args, "cs:")) != EOF) {
+		switch(c) {
+		case 'c':
+			cc_clear();
+			BZERO(cc.hits, sizeof(cc.hits));
+			BZERO(cc.misses, sizeof(cc.misses));
+			break;
+		case 's':
+			cc.limit = str_to_bytes(optarg);
+			while (cc.tail && cc.bytes > cc.limit)
+				cc_remove(cc.tail);
+			break;
+		default:
+			argerrs++;
+			break;
+		}
+	}
+
+	if (argerrs || args[optind])
+		cmd_usage(pc->curcmd, SYNOPSIS);
+
+	if (ACTIVE())
+		fprintf(fp, "Not used on a live system\n");
+
+	fprintf(fp, "%-8s %9s %9s %9s\n", "TYPE", "ENTRIES", "HITS", "MISSES");
+	ents = hits = misses = 0;
+	for (i = 0; i < NR_CC_TYPES; i++) {
+		fprintf(fp, "%-8s %9lu %9lu %9lu\n", cc_type_names[i],
+			cc.ents[i], cc.hits[i], cc.misses[i]);
+		ents += cc.ents[i];
+		hits += cc.hits[i];
+		misses += cc.misses[i];
+	}
+	fprintf(fp, "%-8s %9lu %9lu %9lu\n", "TOTAL", ents, hits, misses);
+	fprintf(fp, "Using %lu KiB of %lu KiB\n", cc.bytes >> 10,
+		cc.limit >> 10);
+}
+
+static char *help_ccache[] = {
+"ccache",
+"manage the cache of file system data",
+"[-c] [-s size]",
+
+"  The commands keep the dentries, names, inodes, lists of child dentries",
+"  and mount lists that they read from the dumpfile in a cache, and use",
+"  them in the later commands of the session.  The least recently used",
+"  ones are dropped when the cache exceeds its size limit.  The mount lists",
+"  are kept for each mount namespace.  Nothing is cached on a live system.",
+"",
+"  This command displays the number of entries, hits and misses of each",
+"  type, and the memory used.",
+"",
+"    -c       clear the cache and the statistics.",
+"    -s size  set the size limit of the cache, with an optional K, M or G",
+"             suffix.  The default is 64M, and 0 disables the cache.",
+"",
+"EXAMPLE",
+"  Display the cache after some commands:",
+"",
+"    %s> ccache",
+"    TYPE       ENTRIES      HITS    MISSES",
+"    dentry       48163     96880     48163",
+"    name           211       402       211",
+"    inode        47936    143395     47936",
+"    subdirs       3102      6210      3102",
+"    mounts           1        11         1",
+"    TOTAL        99413    246898     99413",
+"    Using 40961 KiB of 65536 KiB",
+NULL
+};
+
+/*
+ * For "cindex build".
+ */
+static struct {
+	cindex_node_t *nodes;
+	ulong *mnts;		/* the mounts of the nodes */
+	ulong nr_nodes, max_nodes;
+	char *strtab;
+	ulong strtab_size, max_strtab;
+} cib;
+
+static void
+cindex_build_free(void)
+{
+	free(cib.nodes);
+	free(cib.mnts);
+	free(cib.strtab);
+	BZERO(&cib, sizeof(cib));
+}
+
+static uint
+cindex_add_node(ulong dentry, uint parent, char *name)
+{
+	cindex_node_t *n;
+	ulong len = strlen(name) + 1;
+
+	if (cib.nr_nodes == cib.max_nodes) {
+		cib.max_nodes = cib.max_nodes ? cib.max_nodes * 2 : 65536;
+		cib.nodes = realloc(cib.nodes,
+			sizeof(cindex_node_t) * cib.max_nodes);
+		cib.mnts = realloc(cib.mnts, sizeof(ulong) * cib.max_nodes);
+	}
+	while (cib.strtab_size + len > cib.max_strtab) {
+		cib.max_strtab = cib.max_strtab ? cib.max_strtab * 2 : 1 << 20;
+		cib.strtab = realloc(cib.strtab, cib.max_strtab);
+	}
+	if (!cib.nodes || !cib.mnts || !cib.strtab ||
+	    cib.nr_nodes >= UINT_MAX ||
+	    cib.strtab_size + len > UINT_MAX)
+		error(FATAL, "cannot allocate index\n");
+
+	n = &cib.nodes[cib.nr_nodes];
+	BZERO(n, sizeof(cindex_node_t));
+	n->dentry = dentry;
+	n->parent = parent;
+	n->name = cib.strtab_size;
+	cib.mnts[cib.nr_nodes] = cib.nr_nodes ? cib.mnts[parent] : 0;
+	memcpy(cib.strtab + cib.strtab_size, name, len);
+	cib.strtab_size += len;
+
+	return cib.nr_nodes++;
+}
+
+/*
+ * Fill a node with the dentry and inode, with dentry_buf read.
+ */
+static void
+cindex_fill_node(uint idx, char *dentry_buf)
+{
+	cindex_node_t *n = &cib.nodes[idx];
+	ulong inode, i_mapping, nrpages;
+	ulonglong i_size;
+	uint i_mode;
+	struct timespec i_mtime;
+
+	if (!ULONG(dentry_buf + CU_OFFSET(dentry_d_hash) +
+	    CU_OFFSET(hlist_bl_node_pprev)))
+		n->flags |= CI_UNHASHED;
+
+	n->inode = inode = ULONG(dentry_buf + OFFSET(dentry_d_inode));
+	if (!inode || !get_inode_info(inode, &i_mode, &i_mapping, &i_size,
+	    &nrpages, &i_mtime)) {
+		n->flags |= CI_NEGATIVE;
+		return;
+	}
+
+	n->i_mode = i_mode;
+	n->i_mapping = i_mapping;
+	n->i_size = i_size;
+	n->nrpages = nrpages;
+	n->mtime_sec = i_mtime.tv_sec;
+	n->mtime_nsec = i_mtime.tv_nsec;
+}
+
+/*
+ * The path of a node, where the root node of a mount has the same name
+ * as its mount point.
+ */
+static void
+cindex_node_path(uint idx, char *buf)
+{
+	char tmp[PATH_MAX];
+	char *p = tmp + PATH_MAX - 1;
+	ulong len;
 
-	} else if (flags & DUMP_DIRECTORY) {
-		if (!S_ISDIR(i_mode)) {
-			error(INFO, "%s: not directory\n", src);
-			return;
-		}
+	*p = '\0';
+	for (; idx > 1; idx = cib.nodes[idx].parent) {
+		if (cib.nodes[idx].flags & CI_MOUNT_ROOT)
+			continue;
+		len = strlen(cib.strtab + cib.nodes[idx].name);
+		if (p - tmp < len + 1)
+			break;
+		p -= len;
+		memcpy(p, cib.strtab + cib.nodes[idx].name, len);
+		*--p = '/';
+	}
+	if (*p == '\0')
+		*--p = '/';
 
-		if (flags & DUMP_COUNT_ONLY)
-			fprintf(fp, "Estimating %s...\n", src);
-		else
-			fprintf(fp, "Extracting %s to %s...\n", src, dst);
+	strcpy(buf, p);
+}
 
-		total_pages = 0;
+static void
+cindex_build(char *path)
+{
+	cindex_header_t hdr;
+	subdirs_iter_t it;
+	ulong root, mnt, i, n, m, d;
+	int ok, count;
+	char sub[PATH_MAX], tmp[PATH_MAX], mname[BUFSIZE];
+	char *name;
+	FILE *ofp;
 
-		recursive_dump_dir(src, dst, dentry, i_mtime);
+	BZERO(&hdr, sizeof(hdr));
+	memcpy(hdr.magic, CINDEX_MAGIC, sizeof(hdr.magic));
+	hdr.node_size = sizeof(cindex_node_t);
+	if (!cindex_identity(hdr.id)) {
+		error(INFO, "cannot identify the dumpfile\n");
+		return;
+	}
+	hdr.mnt_ns = get_mnt_ns();
 
-		fprintf(fp, "Total %lu pages (%lu KiB)\n",
-			total_pages, PAGESIZE() * total_pages >> 10);
+	if (!(root = get_root_dentry(&mnt))) {
+		error(INFO, "root mount not found\n");
+		return;
+	}
 
-	} else if (flags & SHOW_INFO) {
-		int pct = calc_cached_percent(nrpages, i_size);
-		char *name = src;
+	snprintf(tmp, PATH_MAX, "%s.tmp", path);
+	if ((ofp = fopen(tmp, "w")) == NULL) {
+		error(INFO, "%s: cannot open: %s\n", tmp, strerror(errno));
+		return;
+	}
 
-		if (S_ISDIR(i_mode) && !(flags & SHOW_INFO_DIRS))
-			name = ".";
+	fprintf(fp, "Indexing / to %s...\n", path);
 
-		if (flags & SHOW_INFO_LONG) {
-			fprintf(fp, header_lfmt, "DENTRY", "INODE", "NRPAGES",
-				"%", "MODE", "SIZE", "MTIME", "PATH");
-			fprintf(fp, dentry_lfmt, dentry, inode, nrpages,
-				pct, i_mode, i_size, get_strtime(&i_mtime),
-				name, get_type_indicator(i_mode, inode));
-			if (CRASHDEBUG(1))
-				fprintf(fp,
-				    "  i_mapping:%-16lx i_mtime:%ld.%09ld\n",
-					i_mapping, i_mtime.tv_sec,
-					i_mtime.tv_nsec);
-		} else {
-			fprintf(fp, header_fmt, "DENTRY", "INODE", "NRPAGES",
-				"%", "PATH");
-			fprintf(fp, dentry_fmt, dentry, inode, nrpages,
-				pct, name, get_type_indicator(i_mode, inode));
-			if (CRASHDEBUG(1))
-				fprintf(fp, "  i_mapping:%-16lx\n", i_mapping);
-		}
+	cindex_build_free();
+	cindex_add_node(0, 0, "");	/* unused */
+	cindex_add_node(root, 0, "");
+	cib.mnts[1] = mnt;
+	if (read_dentry(root, dentry_data, RETURN_ON_ERROR))
+		cindex_fill_node(1, dentry_data);
 
-		if (S_ISDIR(i_mode) && !(flags & SHOW_INFO_DIRS))
-			show_subdirs_info(dentry, src);
+	for (i = 1; i < cib.nr_nodes; i++) {
+		if (!S_ISDIR(cib.nodes[i].i_mode) ||
+		    (cib.nodes[i].flags & CI_NEGATIVE) || cib.nodes[i].mnt)
+			continue;
 
-	} else if (flags & FIND_FILES) {
-		if (flags & FIND_COUNT_DENTRY) {
-			fprintf(fp, count_header_fmt,
-				"TOTAL", "DENTRY", "N_DENT", "PATH");
-			total_dentry = total_negdent = 0;
+		count = 0;
+		for (ok = subdirs_first(&it, cib.nodes[i].dentry); ok;
+		     ok = subdirs_next(&it)) {
+			name = get_dentry_name(it.dentry, it.buf, 0);
+			n = cindex_add_node(it.dentry, i, name);
+			cindex_fill_node(n, it.buf);
+			if (it.mounted)
+				cib.nodes[n].flags |= CI_MOUNTPOINT;
+			if (!count++)
+				cib.nodes[i].child = n;
 		}
+		subdirs_end(&it);
+		if (!count)
+			continue;
+		cib.nodes[i].nr_children = count;
 
-		recursive_list_dir(src, dentry, inode, i_mode);
+		/* the mounts on the subdirectories */
+		for (n = cib.nodes[i].child; n < cib.nodes[i].child + count;
+		     n++) {
+			if (!S_ISDIR(cib.nodes[n].i_mode) ||
+			    !(cib.nodes[n].flags & CI_MOUNTPOINT))
+				continue;
+			mnt = cib.mnts[n];
+			if ((d = follow_mount(&mnt, cib.nodes[n].dentry)) ==
+			    cib.nodes[n].dentry ||
+			    !read_dentry(d, dentry_data, RETURN_ON_ERROR))
+				continue;
 
-		if (flags & FIND_COUNT_DENTRY) {
-			fprintf(fp, count_dentry_fmt,
-				total_dentry, total_dentry - total_negdent,
-				total_negdent, "TOTAL");
+			/* strtab can be moved by cindex_add_node() */
+			snprintf(mname, BUFSIZE, "%s",
+				cib.strtab + cib.nodes[n].name);
+			m = cindex_add_node(d, n, mname);
+			cib.mnts[m] = mnt;
+			cib.nodes[m].flags |= CI_MOUNT_ROOT;
+			cindex_fill_node(m, dentry_data);
+			if (cib.nodes[m].flags & CI_NEGATIVE) {
+				cindex_node_path(n, sub);
+				error(INFO, "%s: invalid inode\n", sub);
+				continue;
+			}
+			cib.nodes[n].mnt = m;
 		}
 	}
-}
 
-static void
-init_cache(void) {
-	/* In case that the last command was interrupted. */
-	if (mount_data) {
-		mount_data = NULL;
-		mount_path = NULL;
-		mount_count = 0;
+	hdr.nr_nodes = cib.nr_nodes;
+	hdr.strtab_size = cib.strtab_size;
+	if (fwrite(&hdr, sizeof(hdr), 1, ofp) != 1 ||
+	    fwrite(cib.nodes, sizeof(cindex_node_t), cib.nr_nodes, ofp) !=
+	    cib.nr_nodes ||
+	    fwrite(cib.strtab, 1, cib.strtab_size, ofp) != cib.strtab_size ||
+	    fclose(ofp) != 0) {
+		error(INFO, "%s: write error: %s\n", tmp, strerror(errno));
+		unlink(tmp);
+		cindex_build_free();
+		return;
 	}
-	dentry_data = GETBUF(SIZE(dentry));
-	pgbuf = GETBUF(PAGESIZE());
-}
+	cindex_build_free();
 
-static void
-clear_cache(void)
-{
-	int i;
-
-	if (mount_data) {
-		FREEBUF(mount_data);
-		for (i = 0; i < mount_count; i++) {
-			FREEBUF(mount_path[i]);
-		}
-		FREEBUF(mount_path);
-		mount_data = NULL;
-		mount_path = NULL;
-		mount_count = 0;
+	if (rename(tmp, path) < 0) {
+		error(INFO, "%s: cannot rename: %s\n", tmp, strerror(errno));
+		unlink(tmp);
+		return;
 	}
-	FREEBUF(dentry_data);
-	FREEBUF(pgbuf);
-}
-
-static void
-set_default_task_context(void)
-{
-	ulong pid = 0;
 
-	while ((tc = pid_to_context(pid)) == NULL)
-		pid++;
+	if (cindex_load(path, TRUE))
+		fprintf(fp, "%u dentries indexed (%lu KiB)\n",
+			cindex.hdr->nr_nodes - 1, cindex.map_size >> 10);
 }
 
 static void
-cmd_ccat(void)
+cmd_cindex(void)
 {
 	int c;
-	char *src, *dst;
 	ulong value;
+	char *file, *subcmd, path[PATH_MAX];
 
-	flags = DUMP_FILE;
+	file = NULL;
 	tc = NULL;
+	flags = 0;
 
-	while ((c = getopt(argcnt, args, "cdn:S")) != EOF) {
+	while ((c = getopt(argcnt, args, "f:n:")) != EOF) {
 		switch(c) {
-		case 'c':
-			flags |= DUMP_COUNT_ONLY;
-			break;
-		case 'd':
-			flags &= ~DUMP_FILE; /* exclusive */
-			flags |= DUMP_DIRECTORY;
+		case 'f':
+			file = optarg;
 			break;
 		case 'n':
 			switch (str_to_context(optarg, &value, &tc)) {
@@ -1128,63 +8770,80 @@ cmd_ccat(void)
 				break;
 			}
 			break;
-		case 'S':
-			flags |= DUMP_DONT_SEEK;
-			break;
 		default:
 			argerrs++;
 			break;
 		}
 	}
 
-	if (argerrs || !args[optind])
+	subcmd = args[optind];
+	if (argerrs || (subcmd && args[optind+1]))
 		cmd_usage(pc->curcmd, SYNOPSIS);
 
-	src = args[optind++];
-	dst = args[optind];
-
-	if (dst) {
-		if (dst[0] == '\0')
-			cmd_usage(pc->curcmd, SYNOPSIS);
-
-		normalize_path(dst);
+	if (ACTIVE())
+		error(FATAL, "not supported on a live system\n");
 
-		if (access(dst, F_OK) == 0) {
-			error(INFO, "%s: %s\n", dst, strerror(EEXIST));
-			return;
-		}
-	} else if (flags & DUMP_DIRECTORY)
-		cmd_usage(pc->curcmd, SYNOPSIS);
+	if (file)
+		snprintf(path, PATH_MAX, "%s", file);
+	else if (pc->dumpfile)
+		snprintf(path, PATH_MAX, "%s%s", pc->dumpfile, CINDEX_SUFFIX);
+	else
+		error(FATAL, "no dumpfile\n");
 
 	if (!tc)
 		set_default_task_context();
 
-	init_cache();
-
-	do_command(src, dst);
+	/* Load the default file like the other commands at the first. */
+	cindex_enabled();
 
-	clear_cache();
+	if (!subcmd) {
+		if (!cindex.map) {
+			fprintf(fp, "No index loaded\n");
+			return;
+		}
+		fprintf(fp, "%s: %u dentries (%lu KiB), mnt_ns %llx%s\n",
+			cindex.path, cindex.hdr->nr_nodes - 1,
+			cindex.map_size >> 10, cindex.hdr->mnt_ns,
+			cindex.hdr->mnt_ns == get_mnt_ns() ?
+			"" : " (not used for this task)");
+	} else if (STREQ(subcmd, "build")) {
+		cindex_close();
+		init_cache();
+		cindex_build(path);
+		clear_cache();
+	} else if (STREQ(subcmd, "load")) {
+		if (cindex_load(path, TRUE))
+			fprintf(fp, "%s: %u dentries\n", path,
+				cindex.hdr->nr_nodes - 1);
+	} else if (STREQ(subcmd, "unload"))
+		cindex_close();
+	else
+		cmd_usage(pc->curcmd, SYNOPSIS);
 }
 
-static char *help_ccat[] = {
-"ccat",				/* command name */
-"dump page caches",		/* short description */
-"   [-cS] [-n pid|task] abspath|inode [outfile]\n"
-"  ccat -d [-cS] [-n pid|task] abspath outdir",
-				/* argument synopsis, or " " if none */
-"  This command dumps the page caches of a specified inode or path like",
-"  \"cat\" command.",
+static char *help_cindex[] = {
+"cindex",
+"build or load a dcache index file",
+"[-f file] [-n pid|task] [build | load | unload]",
+
+"  This command builds an index of the dentry tree across mounted file",
+"  systems, and writes it to a file next to the dumpfile, or the file",
+"  specified with -f.  The index has the names, dentries, inodes and the",
+"  inode fields shown by cls.  cls, cfind and the path lookup of the",
+"  commands use the index when it is loaded and built in the same mount",
+"  namespace, instead of reading the dentries from the dumpfile.",
 "",
-"       -c  only count the total pages to be written without creating any",
-"           files or directories.",
-"       -d  extract a directory and its contents to outdir.",
-"       -S  do not fseek() and ftruncate() to outfile in order to",
-"           create a non-sparse file.",
-"    inode  a hexadecimal inode pointer.",
-"  abspath  the absolute path of a file (or directory with the -d option).",
-"  outfile  a file path to be written. If a file already exists there,",
-"           the command fails.",
-"   outdir  a directory path to be created by the -d option.",
+"  The file is mapped with mmap(), and the file next to the dumpfile is",
+"  loaded by the first command of a session if it was built from the same",
+"  dumpfile.  Without a subcommand, the loaded index is displayed.",
+"",
+"    build   walk the dentry tree from the root directory and write the",
+"            index, then load it.",
+"    load    load the index file.",
+"    unload  stop using the index.",
+"",
+"    -f file  the index file.  The default is the dumpfile path with",
+"             \".cindex\" appended.",
 "",
 "  For kernels supporting mount namespaces, the -n option may be used to",
 "  specify a task that has the target namespace:",
@@ -1192,97 +8851,449 @@ static char *help_ccat[] = {
 "    -n pid   a process PID.",
 "    -n task  a hexadecimal task_struct pointer.",
 "",
-"EXAMPLE",
-"  Dump the existing page caches of the \"/var/log/messages\" file:",
-"",
-"    %s> ccat /var/log/messages",
-"    Sep 16 03:13:01 host systemd: Started Session 559694 of user root.",
-"    Sep 16 03:13:01 host systemd: Starting Session 559694 of user root.",
-"    Sep 16 03:13:39 host dnsmasq-dhcp[24341]: DHCPREQUEST(virbr0) 192.168",
-"    Sep 16 03:13:39 host dnsmasq-dhcp[24341]: DHCPACK(virbr0) 192.168.122",
-"    ...",
-"",
-"  Restore the size and data offset of the \"messages\" file as well to the",
-"  \"messages.sparse\" file even if some of its page caches don't exist, so",
-"  it could become sparse:",
-"",
-"    %s> ccat /var/log/messages messages.sparse",
+"  A path not found in the index is looked up in the dumpfile as before.",
 "",
-"  Create the non-sparse \"messages.non-sparse\" file:",
+"EXAMPLE",
+"  Build the index once, and use it in the later sessions:",
 "",
-"    %s> ccat -S /var/log/messages messages.non-sparse",
+"    %s> cindex build",
+"    Indexing / to /var/crash/127.0.0.1-2024-03-02-04:12:33/vmcore.cindex...",
+"    1843007 dentries indexed (193820 KiB)",
+"    %s> cfind / | wc -l",
+"    1521384",
+NULL
+};
+
+/*
+ * For cinodes: the inodes of every super block are walked through
+ * s_inodes, including the ones whose dentries have been reclaimed and
+ * the unlinked ones still open.  The inodes with the most cached pages
+ * are kept in a min-heap of the requested size.
+ */
+#define CINODES_DEFAULT_COUNT	(20)
+#define SB_ID_LEN		(32)
+
+typedef struct {
+	ulong inode;
+	ulong nrpages;
+	ulonglong i_size;
+	ulong sb;
+} cinode_t;
+
+typedef struct {
+	ulong sb;
+	char id[SB_ID_LEN+1];
+	char type[SB_ID_LEN+1];
+	ulong nr_inodes, nr_cached, nrpages;
+} csb_t;
+
+static struct {
+	cinode_t *heap;
+	int nr, max;
+	csb_t *sbs;
+	int nr_sbs;
+} cinodes;
+
+static void
+cinodes_heap_down(int i)
+{
+	cinode_t *h = cinodes.heap, tmp;
+	int c;
+
+	while ((c = i * 2 + 1) < cinodes.nr) {
+		if (c + 1 < cinodes.nr && h[c + 1].nrpages < h[c].nrpages)
+			c++;
+		if (h[i].nrpages <= h[c].nrpages)
+			break;
+		tmp = h[i];
+		h[i] = h[c];
+		h[c] = tmp;
+		i = c;
+	}
+}
+
+static void
+cinodes_heap_add(cinode_t *ent)
+{
+	cinode_t *h = cinodes.heap, tmp;
+	int i, p;
+
+	if (cinodes.nr < cinodes.max) {
+		i = cinodes.nr++;
+		h[i] = *ent;
+		for (; i && h[p = (i - 1) / 2].nrpages > h[i].nrpages; i = p) {
+			tmp = h[i];
+			h[i] = h[p];
+			h[p] = tmp;
+		}
+	} else if (cinodes.max && ent->nrpages > h[0].nrpages) {
+		h[0] = *ent;
+		cinodes_heap_down(0);
+	}
+}
+
+static int
+sort_by_nrpages(const void *arg1, const void *arg2)
+{
+	ulong p = ((cinode_t *)arg1)->nrpages;
+	ulong q = ((cinode_t *)arg2)->nrpages;
+
+	return (q > p) - (q < p);
+}
+
+static int
+sort_sb_by_nrpages(const void *arg1, const void *arg2)
+{
+	ulong p = ((csb_t *)arg1)->nrpages;
+	ulong q = ((csb_t *)arg2)->nrpages;
+
+	return (q > p) - (q < p);
+}
+
+/*
+ * A path of the inode from the root of its file system, through the first
+ * dentry in i_dentry, or "-" if it has none.
+ */
+static void
+get_inode_path(ulong inode, char *buf)
+{
+	char tmp[PATH_MAX], *p, *name;
+	ulong first, dentry, parent;
+	int len, depth, unlinked;
+
+	strcpy(buf, "-");
+	if (!readmem(inode + CU_OFFSET(inode_i_dentry), KVADDR, &first,
+	    sizeof(ulong), "inode.i_dentry", RETURN_ON_ERROR|QUIET) ||
+	    !first || first == inode + CU_OFFSET(inode_i_dentry))
+		return;		/* empty hlist or list */
+
+	dentry = first - CU_OFFSET(dentry_d_alias);
+	if (!read_dentry(dentry, dentry_data, RETURN_ON_ERROR|QUIET))
+		return;
+	parent = ULONG(dentry_data + OFFSET(dentry_d_parent));
+	unlinked = (parent != dentry) &&
+		!ULONG(dentry_data + CU_OFFSET(dentry_d_hash) +
+			CU_OFFSET(hlist_bl_node_pprev));
+
+	p = tmp + PATH_MAX - 1;
+	*p = '\0';
+	for (depth = 0; parent && parent != dentry && depth < PATH_MAX / 2;
+	     depth++) {
+		name = get_dentry_name(dentry, dentry_data, 0);
+		len = strlen(name);
+		if (p - tmp < len + 1)
+			break;
+		p -= len;
+		memcpy(p, name, len);
+		*--p = '/';
+
+		dentry = parent;
+		if (!read_dentry(dentry, dentry_data, RETURN_ON_ERROR|QUIET))
+			break;
+		parent = ULONG(dentry_data + OFFSET(dentry_d_parent));
+	}
+	if (*p == '\0')
+		*--p = '/';
+
+	snprintf(buf, PATH_MAX, "%s%s", p, unlinked ? " (deleted)" : "");
+}
+
+static void
+cinodes_walk_sb(ulong sb)
+{
+	csb_t *s;
+	cinode_t ent;
+	ulong head, next, type, nrpages;
+	ulonglong i_size;
+	char *id;
+	loop_check_t loop;
+
+	if (!(cinodes.nr_sbs & (cinodes.nr_sbs - 1))) {
+		RESIZEBUF(cinodes.sbs, sizeof(csb_t) * cinodes.nr_sbs,
+			sizeof(csb_t) * MAX(cinodes.nr_sbs * 2, 1));
+	}
+	s = &cinodes.sbs[cinodes.nr_sbs];
+	BZERO(s, sizeof(csb_t));
+	s->sb = sb;
+
+	id = s->id;
+	if (!readmem(sb + CU_OFFSET(super_block_s_id), KVADDR, id, SB_ID_LEN,
+	    "super_block.s_id", RETURN_ON_ERROR))
+		return;
+	id[SB_ID_LEN] = '\0';
+	if (!readmem(sb + CU_OFFSET(super_block_s_type), KVADDR, &type,
+	    sizeof(ulong), "super_block.s_type", RETURN_ON_ERROR|QUIET) ||
+	    !type || !readmem(type + CU_OFFSET(file_system_type_name), KVADDR,
+	    &type, sizeof(ulong), "file_system_type.name",
+	    RETURN_ON_ERROR|QUIET) ||
+	    !read_string(type, s->type, SB_ID_LEN))
+		strcpy(s->type, "?");
+	cinodes.nr_sbs++;
+
+	head = sb + CU_OFFSET(super_block_s_inodes);
+	if (!readmem(head, KVADDR, &next, sizeof(ulong),
+	    "super_block.s_inodes", RETURN_ON_ERROR))
+		return;
+
+	BZERO(&loop, sizeof(loop));
+	while (next && next != head) {
+		if (loop_seen(&loop, next)) {
+			error(INFO, "%s: s_inodes list loops\n", id);
+			break;
+		}
+		ent.inode = next - CU_OFFSET(inode_i_sb_list);
+		if (!readmem(next, KVADDR, &next, sizeof(ulong),
+		    "inode.i_sb_list", RETURN_ON_ERROR))
+			break;
+
+		s->nr_inodes++;
+		if (!read_inode_info(ent.inode, NULL, NULL, &i_size, &nrpages,
+		    NULL, FALSE) || !nrpages)
+			continue;
+
+		s->nr_cached++;
+		s->nrpages += nrpages;
+		ent.nrpages = nrpages;
+		ent.i_size = i_size;
+		ent.sb = sb;
+		cinodes_heap_add(&ent);
+	}
+}
+
+static void
+cmd_cinodes(void)
+{
+	int c, i, j, all, sbs_only;
+	ulong head, next, total_inodes, total_cached, total_pages;
+	char path[PATH_MAX], *id;
+	cinode_t *ent;
+	csb_t *s;
+	loop_check_t loop;
+
+	all = sbs_only = FALSE;
+	cinodes.max = CINODES_DEFAULT_COUNT;
+	rec_init();
+
+	while ((c = getopt(argcnt, args, "ac:F:f:s")) != EOF) {
+		switch(c) {
+		case 'a':
+			all = TRUE;
+			break;
+		case 'c':
+			cinodes.max = dtol(optarg, FAULT_ON_ERROR, NULL);
+			if (cinodes.max < 0)
+				argerrs++;
+			break;
+		case 'F':
+		case 'f':
+			rec_option(c, optarg);
+			break;
+		case 's':
+			sbs_only = TRUE;
+			break;
+		default:
+			argerrs++;
+			break;
+		}
+	}
+
+	if (argerrs || args[optind])
+		cmd_usage(pc->curcmd, SYNOPSIS);
+
+	if (!symbol_exists("super_blocks") ||
+	    CU_INVALID_MEMBER(super_block_s_list) ||
+	    CU_INVALID_MEMBER(super_block_s_inodes) ||
+	    CU_INVALID_MEMBER(inode_i_sb_list))
+		error(FATAL, "super_block.s_inodes not available\n");
+
+	if (sbs_only)
+		cinodes.max = 0;
+
+	flags = 0;
+	rec_open("super_block,fstype,device,inodes,cached,inode,nrpages,"
+		"percent,size,path");
+	init_cache();
+	cinodes.heap = (cinode_t *)GETBUF(sizeof(cinode_t) *
+				MAX(cinodes.max, 1));
+	cinodes.sbs = (csb_t *)GETBUF(sizeof(csb_t));
+	cinodes.nr = cinodes.nr_sbs = 0;
+
+	head = symbol_value("super_blocks");
+	BZERO(&loop, sizeof(loop));
+	if (readmem(head, KVADDR, &next, sizeof(ulong), "super_blocks",
+	    RETURN_ON_ERROR)) {
+		while (next && next != head) {
+			if (loop_seen(&loop, next)) {
+				error(INFO, "super_blocks list loops\n");
+				break;
+			}
+			cinodes_walk_sb(next - CU_OFFSET(super_block_s_list));
+			if (!readmem(next, KVADDR, &next, sizeof(ulong),
+			    "super_block.s_list", RETURN_ON_ERROR))
+				break;
+		}
+	}
+
+	qsort(cinodes.sbs, cinodes.nr_sbs, sizeof(csb_t), sort_sb_by_nrpages);
+
+	if (!rec.format)
+		fprintf(fp, "%-16s %-12s %-16s %9s %9s %10s\n", "SUPER_BLOCK",
+			"TYPE", "DEVICE", "INODES", "CACHED", "NRPAGES");
+	total_inodes = total_cached = total_pages = 0;
+	for (i = 0, s = cinodes.sbs; i < cinodes.nr_sbs; i++, s++) {
+		total_inodes += s->nr_inodes;
+		total_cached += s->nr_cached;
+		total_pages += s->nrpages;
+		if (!s->nrpages && !all)
+			continue;
+		if (rec.format) {
+			rec_begin("super_block");
+			rec_hex("super_block", s->sb);
+			rec_str("fstype", s->type);
+			rec_str("device", s->id);
+			rec_num("inodes", s->nr_inodes);
+			rec_num("cached", s->nr_cached);
+			rec_num("nrpages", s->nrpages);
+			rec_end();
+			continue;
+		}
+		fprintf(fp, "%16lx %-12s %-16s %9lu %9lu %10lu\n", s->sb,
+			s->type, s->id, s->nr_inodes, s->nr_cached, s->nrpages);
+	}
+	if (!rec.format) {
+		fprintf(fp, "%-16s %-12s %-16s %9lu %9lu %10lu\n", "TOTAL", "",
+			"", total_inodes, total_cached, total_pages);
+		fprintf(fp, "Total %lu pages (%lu KiB) in %d super blocks\n",
+			total_pages, PAGESIZE() * total_pages >> 10,
+			cinodes.nr_sbs);
+	}
+
+	if (!cinodes.nr)
+		goto out;
+
+	qsort(cinodes.heap, cinodes.nr, sizeof(cinode_t), sort_by_nrpages);
+
+	if (!rec.format)
+		fprintf(fp, "\n%-16s %7s %3s %11s %-16s %s\n", "INODE",
+			"NRPAGES", "%", "SIZE", "DEVICE", "PATH");
+	for (i = 0, ent = cinodes.heap; i < cinodes.nr; i++, ent++) {
+		id = "?";
+		for (j = 0; j < cinodes.nr_sbs; j++) {
+			if (cinodes.sbs[j].sb == ent->sb) {
+				id = cinodes.sbs[j].id;
+				break;
+			}
+		}
+		get_inode_path(ent->inode, path);
+		if (rec.format) {
+			rec_begin("cached_inode");
+			rec_hex("inode", ent->inode);
+			rec_num("nrpages", ent->nrpages);
+			rec_num("percent", calc_cached_percent(ent->nrpages,
+				ent->i_size));
+			rec_num("size", ent->i_size);
+			rec_str("device", id);
+			rec_str("path", path);
+			rec_end();
+			continue;
+		}
+		fprintf(fp, "%16lx %7lu %3d %11llu %-16s %s\n", ent->inode,
+			ent->nrpages, calc_cached_percent(ent->nrpages,
+			ent->i_size), ent->i_size, id, path);
+	}
+out:
+	FREEBUF(cinodes.heap);
+	FREEBUF(cinodes.sbs);
+	clear_cache();
+	rec_close();
+}
+
+static char *help_cinodes[] = {
+"cinodes",
+"display the inodes with the most cached pages",
+"[-as] [-c count] [-F json|csv [-f file]]",
+
+"  This command walks the inode lists of all super blocks, and displays the",
+"  number of inodes and cached pages of each file system, then the inodes",
+"  with the most cached pages.  Unlike cls and cfind, this also finds the",
+"  inodes whose dentries have been reclaimed, and the unlinked files still",
+"  open.",
 "",
-"  NOTE: Redirecting to a file will also works, but it can contain crash's",
-"  messages, so specifying an outfile is recommended for restoring a file.",
+"  The path of an inode is from the root of its file system, through one of",
+"  its dentries.  It is \"-\" if the inode has no dentry, and is followed by",
+"  \"(deleted)\" if the file has been unlinked.",
 "",
-"  Extract the \"/var/log\" directory and its contents to the new \"/tmp/log\"",
-"  directory with one command:",
+"    -a        also display the file systems without cached pages.",
+"    -c count  display the count inodes with the most pages.  The default",
+"              is 20.",
+"    -s        display the file systems only.",
+"    -F json|csv",
+"              display a record per line in NDJSON or CSV without the",
+"              totals.",
+"    -f file   with -F, write the records to file directly instead of",
+"              through the output pager.",
 "",
-"    %s> ccat -d /var/log /tmp/log",
-"    Extracting /var/log to /tmp/log...",
-"    Total 127034 pages (508136 KiB)",
+"EXAMPLE",
+"  Find what fills memory with page cache:",
 "",
-"  Count the total pages to be written in advance without creating any",
-"  files or directories:",
+"    %s> cinodes -c 5",
+"    SUPER_BLOCK      TYPE         DEVICE              INODES    CACHED    NRPAGES",
+"    ffff8d1a41f9c000 xfs          dm-0                 98121     41330    3817291",
+"    ffff8d1a4cc3b800 tmpfs        tmpfs                  212       198     524416",
+"    ffff8d1a41f99800 xfs          vda1                   352        31      11053",
+"    ffff8d1a40e5e000 proc         proc                 30714        12         12",
+"    TOTAL                                             211547     41571    4352772",
+"    Total 4352772 pages (17411088 KiB) in 63 super blocks",
 "",
-"    %s> ccat -c -d /var/log /tmp/log",
-"    Estimating /var/log...",
-"    Total 127034 pages (508136 KiB)",
+"    INODE            NRPAGES   %        SIZE DEVICE           PATH",
+"    ffff8d1a2e0c31e8 2097152 100  8589934592 dm-0             /var/lib/pgsql/data/base/16384/16412",
+"    ffff8d19f18a4a38  524288 100  2147483648 tmpfs            /dev/shm/PostgreSQL.1804289383",
+"    ffff8d1a0c2b5438  262144 100  1073741824 dm-0             /var/log/app/debug.log (deleted)",
+"    ffff8d1a0d7e2a38  131072  50  1073741824 dm-0             -",
+"    ffff8d1a2e0c4a38   65536 100   268435456 dm-0             /var/lib/pgsql/data/base/16384/16415",
 NULL
 };
 
-static void
-print_debug_data(void)
+static int
+sort_cdu_by_nrpages(const void *arg1, const void *arg2)
 {
-	ulonglong data_debug = pc->flags & DATADEBUG;
-	pc->flags &= ~DATADEBUG;
+	cdu_ent_t *e1 = (cdu_ent_t *)arg1;
+	cdu_ent_t *e2 = (cdu_ent_t *)arg2;
 
-	fprintf(fp, "          env_flags: 0x%x", env_flags);
-	fprintf(fp, " %s", (env_flags & XARRAY) ? "XARRAY" : "RADIX_TREE");
-	if (CU_VALID_MEMBER(inode_i_mtime))
-		fprintf(fp, " %s", (env_flags & TIMESPEC64) ? "TIMESPEC64" : "TIMESPEC");
-	fprintf(fp, "\n");
-
-	fprintf(fp, "       inode_i_size: %ld\n", CU_OFFSET(inode_i_size));
-	fprintf(fp, "      inode_i_mtime: %ld\n", CU_OFFSET(inode_i_mtime));
-	fprintf(fp, "  inode_i_mtime_sec: %ld\n", CU_OFFSET(inode_i_mtime_sec));
-	fprintf(fp, " inode_i_mtime_nsec: %ld\n", CU_OFFSET(inode_i_mtime_nsec));
-	fprintf(fp, "       inode_i_link: %ld\n", CU_OFFSET(inode_i_link));
-	fprintf(fp, "  vfsmount_mnt_root: %ld\n", CU_OFFSET(vfsmount_mnt_root));
-	fprintf(fp, "      dentry_d_hash: %ld\n", CU_OFFSET(dentry_d_hash));
-	fprintf(fp, "       dentry_d_sib: %ld\n", CU_OFFSET(dentry_d_sib));
-	fprintf(fp, "  dentry_d_children: %ld\n", CU_OFFSET(dentry_d_children));
-	fprintf(fp, "     dentry_d_child: %ld\n", CU_OFFSET(dentry_d_child));
-	fprintf(fp, "   dentry_d_subdirs: %ld\n", CU_OFFSET(dentry_d_subdirs));
-	fprintf(fp, "hlist_bl_node_pprev: %ld\n", CU_OFFSET(hlist_bl_node_pprev));
+	if (e1->sum.nrpages != e2->sum.nrpages)
+		return e1->sum.nrpages < e2->sum.nrpages ? 1 : -1;
 
-	pc->flags |= data_debug;
+	return strcmp(e1->path, e2->path);
 }
 
 static void
-cmd_cls(void)
+cmd_cdu(void)
 {
-	int c;
+	int c, i, n, nr;
 	ulong value;
+	struct task_context **tasks;
 
-	flags = SHOW_INFO;
+	flags = SHOW_DU;
 	tc = NULL;
+	BZERO(&cdu, sizeof(cdu));
+	cdu.depth = -1;
+	rec_init();
 
-	while ((c = getopt(argcnt, args, "aDdln:RtU")) != EOF) {
+	while ((c = getopt(argcnt, args, "ad:F:f:n:s")) != EOF) {
 		switch(c) {
 		case 'a':
-			flags |= SHOW_INFO_NEG_DENTS;
+			cdu.all = TRUE;
 			break;
-		case 'D':
-			print_debug_data();
-			return;
 		case 'd':
-			flags |= SHOW_INFO_DIRS;
-			break;
-		case 'l':
-			flags |= SHOW_INFO_LONG;
+			cdu.depth = dtol(optarg, FAULT_ON_ERROR, NULL);
+			if (cdu.depth < 0)
+				argerrs++;
 			break;
 		case 'n':
+			if (STREQ(optarg, "all")) {
+				flags |= ALL_MNT_NS;
+				break;
+			}
 			switch (str_to_context(optarg, &value, &tc)) {
 			case STR_PID:
 			case STR_TASK:
@@ -1293,14 +9304,12 @@ cmd_cls(void)
 				break;
 			}
 			break;
-		case 'R':
-			flags |= SHOW_INFO_RECURSIVE;
-			break;
-		case 't':
-			flags |= SHOW_INFO_SORT_MTIME;
+		case 's':
+			cdu.sort = TRUE;
 			break;
-		case 'U':
-			flags |= SHOW_INFO_DONT_SORT;
+		case 'F':
+		case 'f':
+			rec_option(c, optarg);
 			break;
 		default:
 			argerrs++;
@@ -1311,125 +9320,248 @@ cmd_cls(void)
 	if (argerrs || !args[optind])
 		cmd_usage(pc->curcmd, SYNOPSIS);
 
-	if (!tc)
-		set_default_task_context();
+	rec_open("nrpages,size,pages,percent,path");
 
-	init_cache();
+	if (flags & ALL_MNT_NS)
+		tasks = get_mnt_ns_tasks(&nr);
+	else {
+		if (!tc)
+			set_default_task_context();
+		tasks = &tc;
+		nr = 1;
+	}
+
+	if (cdu.sort) {
+		cdu.max_ents = 64;
+		cdu.ents = (cdu_ent_t *)GETBUF(sizeof(cdu_ent_t) *
+					cdu.max_ents);
+	}
+
+	for (n = 0; n < nr; n++) {
+		tc = tasks[n];
+		if (flags & ALL_MNT_NS)
+			show_mnt_ns(n == 0);
 
-	do_command(args[optind++], NULL);
+		init_cache();
+		do_command(args[optind], NULL);
+		clear_cache();
 
-	while (args[optind]) {
-		fprintf(fp, "\n");
-		do_command(args[optind++], NULL);
+		if (!cdu.sort)
+			continue;
+		qsort(cdu.ents, cdu.nr_ents, sizeof(cdu_ent_t),
+			sort_cdu_by_nrpages);
+		for (i = 0; i < cdu.nr_ents; i++) {
+			cdu_print(cdu.ents[i].path, &cdu.ents[i].sum);
+			free(cdu.ents[i].path);
+		}
+		cdu.nr_ents = 0;
 	}
 
-	clear_cache();
+	rec_close();
+	if (cdu.sort)
+		FREEBUF(cdu.ents);
+	if (flags & ALL_MNT_NS)
+		FREEBUF(tasks);
 }
 
-static char *help_cls[] = {
-"cls",				/* command name */
-"list dentry and inode caches",	/* short description */
-"[-adlRU] [-n pid|task] abspath...",	/* argument synopsis, or " " if none */
+static char *help_cdu[] = {
+"cdu",
+"summarize cached pages of directory hierarchies",
+"[-as] [-d depth] [-n pid|task|all] [-F json|csv [-f file]] abspath",
 
-"  This command displays the addresses of dentry, inode and nrpages of a",
-"  specified absolute path and its subdirs if they exist in dentry cache.",
+"  This command displays the number of cached pages and the size of the",
+"  regular files under each directory of a hierarchy across mounted file",
+"  systems like a \"du\" command.  The totals are summed up from the files",
+"  in a single walk, and each directory is displayed after its",
+"  subdirectories.",
 "",
-"    -a  also display negative dentries in the subdirs list.",
-"    -d  display the directory itself only, without its contents.",
-"    -l  use a long format to display mode, size and mtime additionally.",
-"    -R  display subdirs recursively.",
-"    -t  sort subdirs by modification time, newest first.",
-"    -U  do not sort, list dentries in directory order.",
+"  CACHED(KiB) and SIZE(KiB) are the cached pages and the file sizes in",
+"  KiB, and % is the cached pages in the pages of the file sizes.  Unlike",
+"  \"du\", a file with hard links in the hierarchy is summed up at each",
+"  link, as the inodes are not remembered during the walk.",
+"",
+"    -a        also display the regular files.",
+"    -d depth  display the directories (and files with -a) only up to depth",
+"              levels below abspath, while all levels are summed up.",
+"    -s        sort by the cached pages, the largest first.",
+"    -F json|csv",
+"              display a record per line in NDJSON or CSV, with the sizes",
+"              in bytes and pages.",
+"    -f file   with -F, write the records to file directly instead of",
+"              through the output pager.",
 "",
 "  For kernels supporting mount namespaces, the -n option may be used to",
 "  specify a task that has the target namespace:",
 "",
 "    -n pid   a process PID.",
 "    -n task  a hexadecimal task_struct pointer.",
-"",
-"  These are file type indicators, which are appended to entries:",
-"",
-"    / : directory",
-"    * : executable",
-"    @ : symbolic link",
-"    | : named pipe",
-"    = : socket",
-"    (name) : unfinished dentry",
+"    -n all   every mount namespace in turn, each after a line with the",
+"             namespace and the task of the lowest PID in it.",
 "",
 "EXAMPLE",
-"  Display the \"/var/log/messages\" regular file's information:",
-"",
-"    %s> cls /var/log/messages",
-"    DENTRY           INODE            NRPAGES   % PATH",
-"    ffff9c0c28fda480 ffff9c0c22c675b8     220 100 /var/log/messages",
-"",
-"  The '\%' column shows the percentage of cached pages in the file.",
-"",
-"  Display the \"/var/log\" directory and its subdirs information:",
-"",
-"    %s> cls /var/log",
-"    DENTRY           INODE            NRPAGES   % PATH",
-"    ffff9c0c3eabe300 ffff9c0c3e875b78       0   0 ./",
-"    ffff9c0c16a22900 ffff9c0c16ada2f8       0   0 anaconda/",
-"    ffff9c0c37611000 ffff9c0c3759f5b8       0   0 audit/",
-"    ffff9c0c375ccc00 ffff9c0c3761c8b8       1 100 btmp",
-"    ffff9c0c28fda240 ffff9c0c22c713f8       6 100 cron",
-"    ffff9c0c3eb7f180 ffff9c0bfd402a78      36   7 dnf.librepo.log",
-"    ...",
-"",
-"  In addition to the same information, display their mode, size and mtime:",
-"",
-"    %s> cls -l /var/log",
-"    DENTRY           INODE            NRPAGES   %   MODE        SIZE MTIME                         PATH",
-"    ffff9c0c3eabe300 ffff9c0c3e875b78       0   0  40755        4096 2018-11-25.03:39:01.479315763 ./",
-"    ffff9c0c16a22900 ffff9c0c16ada2f8       0   0  40755         250 2018-03-21.13:18:38.816000000 anaconda/",
-"    ffff9c0c37611000 ffff9c0c3759f5b8       0   0  40700          80 2018-10-25.19:02:13.968692776 audit/",
-"    ffff9c0c375ccc00 ffff9c0c3761c8b8       1 100 100660         384 2018-11-28.16:39:34.538315763 btmp",
-"    ffff9c0c28fda240 ffff9c0c22c713f8       6 100 100600       23435 2018-11-28.16:01:01.667315763 cron",
-"    ffff9c0c3eb7f180 ffff9c0bfd402a78      36   7 100600     1921580 2018-11-28.16:41:24.073315763 dnf.librepo.log",
-"    ...",
-"",
-"  Display the \"/var/log\" directory itself only:",
-"",
-"    %s> cls -d /var/log",
-"    DENTRY           INODE            NRPAGES   % PATH",
-"    ffff9c0c3eabe300 ffff9c0c3e875b78       0   0 /var/log/",
-"",
-"  Display the \"/var/log\" directory and its subdirs recursively:",
-"",
-"    crash> cls -R /var/log",
-"    DENTRY           INODE            NRPAGES   % PATH",
-"    ffff9c0c3eabe300 ffff9c0c3e875b78       0   0 ./",
-"    ffff9c0c16a22900 ffff9c0c16ada2f8       0   0 anaconda/",
-"    ffff9c0c37611000 ffff9c0c3759f5b8       0   0 audit/",
-"    ...",
+"  Find the directories under /var with the most cached pages:",
 "",
-"    /var/log/anaconda:",
-"",
-"    /var/log/audit:",
-"    ffff9c0c37582e40 ffff9c0c3759d038     208  19 audit.log",
-"    ...",
+"    %s> cdu -s -d 2 /var",
+"       NRPAGES  CACHED(KiB)    SIZE(KiB)   % PATH",
+"        524735      2098940      4823165  43 /var",
+"        524288      2097152      4194304  50 /var/lib",
+"        524288      2097152      4194304  50 /var/lib/pgsql",
+"           421         1684       628340   0 /var/log",
+"           388         1552        12710  12 /var/log/journal",
+"            26          104          521  19 /var/cache",
+"            26          104          495  20 /var/cache/dnf",
+"             0            0            0   0 /var/lib/misc",
 NULL
 };
 
+static int
+sort_dstat_by_key(const void *arg1, const void *arg2)
+{
+	dstat_ent_t *e1 = (dstat_ent_t *)arg1;
+	dstat_ent_t *e2 = (dstat_ent_t *)arg2;
+
+	if (e1->key != e2->key)
+		return e1->key < e2->key ? 1 : -1;
+
+	return strcmp(e1->path, e2->path);
+}
+
+static int
+sort_pattern_by_nr(const void *arg1, const void *arg2)
+{
+	dstat_pattern_t *p1 = (dstat_pattern_t *)arg1;
+	dstat_pattern_t *p2 = (dstat_pattern_t *)arg2;
+
+	if (p1->nr != p2->nr)
+		return p1->nr < p2->nr ? 1 : -1;
+
+	return strcmp(p1->name, p2->name);
+}
+
+static char *dstat_header_fmt = "%10s %10s %10s %10s %12s %s\n";
+static char *dstat_fmt        = "%10lu %10lu %10lu %10lu %12llu %s\n";
+
 static void
-cmd_cfind(void)
+dstat_print(char *type, char *path, dstat_sum_t *sum)
 {
-	int c;
+	if (rec.format) {
+		rec_begin(type);
+		rec_num("dentries", sum->nr);
+		rec_num("negative", sum->negative);
+		rec_num("unhashed", sum->unhashed);
+		rec_num("ext_names", sum->ext_names);
+		rec_num("bytes", sum->bytes);
+		rec_str("path", path);
+		rec_end();
+		return;
+	}
+
+	fprintf(fp, dstat_fmt, sum->nr, sum->negative, sum->unhashed,
+		sum->ext_names, (sum->bytes + 1023) >> 10, path);
+}
+
+static void
+dstat_print_heap(char *type, char *title, dstat_heap_t *heap)
+{
+	int i;
+
+	qsort(heap->ents, heap->nr, sizeof(dstat_ent_t), sort_dstat_by_key);
+
+	if (!rec.format && heap->nr) {
+		fprintf(fp, "\n%s\n", title);
+		fprintf(fp, dstat_header_fmt, "DENTRIES", "NEGATIVE",
+			"UNHASHED", "EXT_NAMES", "EST(KiB)", "PATH");
+	}
+	for (i = 0; i < heap->nr; i++) {
+		dstat_print(type, heap->ents[i].path, &heap->ents[i].sum);
+		free(heap->ents[i].path);
+	}
+	heap->nr = 0;
+}
+
+static void
+dstat_print_pattern(dstat_pattern_t *p, char *name)
+{
+	if (rec.format) {
+		rec_begin("dentry_pattern");
+		rec_num("dentries", p->nr);
+		rec_num("negative", p->negative);
+		rec_str("pattern", name);
+		rec_end();
+		return;
+	}
+
+	fprintf(fp, "%10lu %10lu %s\n", p->nr, p->negative, name);
+}
+
+static void
+dstat_report(char *path)
+{
+	dstat_pattern_t *p;
+	int i, nr;
+
+	if (!rec.format)
+		fprintf(fp, dstat_header_fmt, "DENTRIES", "NEGATIVE",
+			"UNHASHED", "EXT_NAMES", "EST(KiB)", "PATH");
+	dstat_print("dentry_total", path, &cdstat.total);
+
+	dstat_print_heap("negative_dir", "Directories with the most negative "
+		"dentries:", &cdstat.negs);
+	dstat_print_heap("subtree", "Subtrees with the most estimated "
+		"bytes:", &cdstat.trees);
+
+	/* the used entries to the front */
+	for (i = nr = 0, p = cdstat.patterns; i < CDSTAT_PATTERNS; i++)
+		if (p[i].nr)
+			p[nr++] = p[i];
+	qsort(p, nr, sizeof(dstat_pattern_t), sort_pattern_by_nr);
+
+	if (!rec.format && nr && cdstat.max) {
+		fprintf(fp, "\nNames with the most dentries by pattern:\n");
+		fprintf(fp, "%10s %10s %s\n", "DENTRIES", "NEGATIVE", "PATTERN");
+	}
+	for (i = 0; i < MIN(nr, cdstat.max); i++)
+		dstat_print_pattern(&p[i], p[i].name);
+	if (cdstat.other.nr && cdstat.max)
+		dstat_print_pattern(&cdstat.other, "(other patterns)");
+
+	BZERO(cdstat.patterns, sizeof(dstat_pattern_t) * CDSTAT_PATTERNS);
+	BZERO(&cdstat.other, sizeof(dstat_pattern_t));
+	BZERO(&cdstat.total, sizeof(dstat_sum_t));
+	cdstat.nr_patterns = 0;
+}
+
+static void
+cmd_cdstat(void)
+{
+	int c, n, nr;
 	ulong value;
+	struct task_context **tasks;
 
-	flags = FIND_FILES;
+	flags = SHOW_DSTAT;
 	tc = NULL;
+	BZERO(&cdstat, sizeof(cdstat));
+	cdstat.max = CDSTAT_DEFAULT_COUNT;
+	cdstat.depth = -1;
+	rec_init();
 
-	while ((c = getopt(argcnt, args, "acn:")) != EOF) {
+	while ((c = getopt(argcnt, args, "c:d:F:f:n:")) != EOF) {
 		switch(c) {
-		case 'a':
-			flags |= SHOW_INFO_NEG_DENTS;
-			break;
 		case 'c':
-			flags |= FIND_COUNT_DENTRY;
+			cdstat.max = dtol(optarg, FAULT_ON_ERROR, NULL);
+			if (cdstat.max < 0)
+				argerrs++;
+			break;
+		case 'd':
+			cdstat.depth = dtol(optarg, FAULT_ON_ERROR, NULL);
+			if (cdstat.depth < 0)
+				argerrs++;
 			break;
 		case 'n':
+			if (STREQ(optarg, "all")) {
+				flags |= ALL_MNT_NS;
+				break;
+			}
 			switch (str_to_context(optarg, &value, &tc)) {
 			case STR_PID:
 			case STR_TASK:
@@ -1440,6 +9572,10 @@ cmd_cfind(void)
 				break;
 			}
 			break;
+		case 'F':
+		case 'f':
+			rec_option(c, optarg);
+			break;
 		default:
 			argerrs++;
 			break;
@@ -1449,55 +9585,115 @@ cmd_cfind(void)
 	if (argerrs || !args[optind])
 		cmd_usage(pc->curcmd, SYNOPSIS);
 
-	if (!tc)
-		set_default_task_context();
-
-	init_cache();
+	/* DNAME_INLINE_LEN */
+	if ((cdstat.inline_len = MEMBER_SIZE("dentry", "d_iname")) <= 0 &&
+	    (cdstat.inline_len = MEMBER_SIZE("dentry", "d_shortname")) <= 0)
+		cdstat.inline_len = 32;
+	cdstat.ext_header = CU_VALID_MEMBER(external_name_name) ?
+		CU_OFFSET(external_name_name) : sizeof(ulong) * 2;
+
+	rec_open("dentries,negative,unhashed,ext_names,bytes,pattern,path");
+
+	if (flags & ALL_MNT_NS)
+		tasks = get_mnt_ns_tasks(&nr);
+	else {
+		if (!tc)
+			set_default_task_context();
+		tasks = &tc;
+		nr = 1;
+	}
 
-	do_command(args[optind], NULL);
+	cdstat.negs.ents = (dstat_ent_t *)GETBUF(sizeof(dstat_ent_t) *
+				MAX(cdstat.max, 1));
+	cdstat.trees.ents = (dstat_ent_t *)GETBUF(sizeof(dstat_ent_t) *
+				MAX(cdstat.max, 1));
+	cdstat.patterns = (dstat_pattern_t *)GETBUF(sizeof(dstat_pattern_t) *
+				CDSTAT_PATTERNS);
+
+	for (n = 0; n < nr; n++) {
+		tc = tasks[n];
+		if (flags & ALL_MNT_NS)
+			show_mnt_ns(n == 0);
+
+		init_cache();
+		do_command(args[optind], NULL);
+		clear_cache();
+
+		if (cdstat.walked)
+			dstat_report(args[optind]);
+		cdstat.walked = FALSE;
+	}
 
-	clear_cache();
+	rec_close();
+	FREEBUF(cdstat.negs.ents);
+	FREEBUF(cdstat.trees.ents);
+	FREEBUF(cdstat.patterns);
+	if (flags & ALL_MNT_NS)
+		FREEBUF(tasks);
 }
 
-static char *help_cfind[] = {
-"cfind",
-"search for files in a directory hierarchy",
-"[-ac] [-n pid|task] abspath",
+static char *help_cdstat[] = {
+"cdstat",
+"display statistics of the dentry cache under a directory",
+"[-c count] [-d depth] [-n pid|task|all] [-F json|csv [-f file]] abspath",
 
-"  This command searches for files in a directory hierarchy across mounted",
-"  file systems like a \"find\" command.",
+"  This command counts the dentries under a directory in a single walk,",
+"  to find what bloats the dentry cache, and displays:",
 "",
-"    -a  also display negative dentries.",
-"    -c  count dentries in each directory.",
+"    - the total of the dentries, the negative ones, the unhashed ones that",
+"      \"cls -a\" displays in parentheses, and the names too long to be",
+"      embedded in the dentries,",
+"    - the directories with the most negative dentries as the children,",
+"    - the subtrees below abspath with the most estimated bytes,",
+"    - the patterns of the names with the most dentries, where a word of",
+"      letters and digits is replaced with \"*\" if it has digits and 6 or",
+"      more characters, like a random suffix, and otherwise its runs of",
+"      digits with \"#\".",
+"",
+"  EST(KiB) is estimated as SIZE(dentry) per dentry and the kmalloc size",
+"  of an external_name per long name, without the slab overhead.  The",
+"  memory used does not grow with the number of dentries.",
+"",
+"    -c count  display the count entries of each list.  The default is 10.",
+"    -d depth  consider the subtrees only up to depth levels below abspath.",
+"    -F json|csv",
+"              display a record per line in NDJSON or CSV, with the sizes",
+"              in bytes.",
+"    -f file   with -F, write the records to file directly instead of",
+"              through the output pager.",
 "",
 "  For kernels supporting mount namespaces, the -n option may be used to",
 "  specify a task that has the target namespace:",
 "",
 "    -n pid   a process PID.",
 "    -n task  a hexadecimal task_struct pointer.",
+"    -n all   every mount namespace in turn, each after a line with the",
+"             namespace and the task of the lowest PID in it.",
 "",
 "EXAMPLE",
-"  Search for \"messages\" files through the root file system with the grep",
-"  command:",
+"  Find what fills the dentry cache with negative dentries:",
 "",
-"    %s> cfind / | grep messages",
-"    ffff9dc4df288c00 ffff9dc24dbb6308 /var/log/messages",
+"    %s> cdstat -c 3 /",
+"      DENTRIES   NEGATIVE   UNHASHED  EXT_NAMES     EST(KiB) PATH",
+"       8723411    8519034        112     305126      1650431 /",
 "",
-"  The addresses are the file's dentry and inode respectively.",
+"    Directories with the most negative dentries:",
+"      DENTRIES   NEGATIVE   UNHASHED  EXT_NAMES     EST(KiB) PATH",
+"       8402118    8401905          3     301877      1591830 /var/lib/app/cache",
+"         61272      61183          0          0        11489 /usr/lib64",
+"         20511      20480          0       2044         4187 /tmp",
 "",
-"  Count dentries in the /boot directory and its subdirectories:",
+"    Subtrees with the most estimated bytes:",
+"      DENTRIES   NEGATIVE   UNHASHED  EXT_NAMES     EST(KiB) PATH",
+"       8402391    8401905          3     301877      1591882 /var",
+"       8402254    8401905          3     301877      1591856 /var/lib",
+"       8402137    8401905          3     301877      1591834 /var/lib/app",
 "",
-"    %s> cfind -c /boot",
-"      TOTAL DENTRY N_DENT PATH",
-"         18     12      6 /boot",
-"          8      6      2 /boot/grub2",
-"         34     34      0 /boot/grub2/locale",
-"        268    268      0 /boot/grub2/i386-pc",
-"          1      1      0 /boot/grub2/fonts",
-"          1      1      0 /boot/efi",
-"          2      1      1 /boot/efi/EFI",
-"          3      0      3 /boot/efi/EFI/redhat",
-"        335    323     12 TOTAL",
+"    Names with the most dentries by pattern:",
+"      DENTRIES   NEGATIVE PATTERN",
+"       8400012    8400000 obj_*.tmp",
+"         20480      20480 tmp.*",
+"          4096       4020 core.#",
 NULL
 };
 
@@ -1505,15 +9701,106 @@ static struct command_table_entry command_table[] = {
 	{ "ccat", cmd_ccat, help_ccat, 0},
 	{ "cls", cmd_cls, help_cls, 0},
 	{ "cfind", cmd_cfind, help_cfind, 0},
+	{ "cstore", cmd_cstore, help_cstore, 0},
+	{ "cdiff", cmd_cdiff, help_cdiff, 0},
+	{ "cgrep", cmd_cgrep, help_cgrep, 0},
+	{ "ccache", cmd_ccache, help_ccache, 0},
+	{ "cindex", cmd_cindex, help_cindex, 0},
+	{ "cinodes", cmd_cinodes, help_cinodes, 0},
+	{ "cdu", cmd_cdu, help_cdu, 0},
+	{ "cdstat", cmd_cdstat, help_cdstat, 0},
 	{ NULL },
 };
 
+static void
+plan_add(long *start, long *end, long offset, long size, long struct_size)
+{
+	if (offset < 0)
+		return;
+	if (size <= 0)		/* unknown, up to the end */
+		size = struct_size - offset;
+	if (*start < 0 || offset < *start)
+		*start = offset;
+	if (offset + size > *end)
+		*end = offset + size;
+}
+
+static void
+init_field_plan(void)
+{
+	long d_iname_size, d_link, d_name_size, i_mtime_size, umode_size;
+
+	d_link = CU_INVALID_MEMBER(dentry_d_child) ?
+		CU_OFFSET(dentry_d_sib) : CU_OFFSET(dentry_d_child);
+	d_name_size = MEMBER_SIZE("dentry", "d_name");
+	if ((d_iname_size = MEMBER_SIZE("dentry", "d_iname")) <= 0)
+		d_iname_size = MEMBER_SIZE("dentry", "d_shortname"); /* 6.14 */
+
+	plan.dentry_start = plan.inode_start = -1;
+	plan_add(&plan.dentry_start, &plan.dentry_end, OFFSET(dentry_d_inode),
+		sizeof(ulong), SIZE(dentry));
+	plan_add(&plan.dentry_start, &plan.dentry_end, OFFSET(dentry_d_parent),
+		sizeof(ulong), SIZE(dentry));
+	plan_add(&plan.dentry_start, &plan.dentry_end, OFFSET(dentry_d_name),
+		d_name_size, SIZE(dentry));
+	plan_add(&plan.dentry_start, &plan.dentry_end, OFFSET(dentry_d_iname),
+		d_iname_size, SIZE(dentry));
+	plan_add(&plan.dentry_start, &plan.dentry_end, CU_OFFSET(dentry_d_hash),
+		MEMBER_SIZE("dentry", "d_hash"), SIZE(dentry));
+	plan_add(&plan.dentry_start, &plan.dentry_end, d_link,
+		sizeof(ulong), SIZE(dentry));
+	plan_add(&plan.dentry_start, &plan.dentry_end,
+		CU_INVALID_MEMBER(dentry_d_subdirs) ?
+		CU_OFFSET(dentry_d_children) : CU_OFFSET(dentry_d_subdirs),
+		sizeof(ulong), SIZE(dentry));
+	/* either may be invalid */
+	plan_add(&plan.dentry_start, &plan.dentry_end,
+		cu_offset_table.dentry_d_flags, sizeof(uint), SIZE(dentry));
+	plan_add(&plan.dentry_start, &plan.dentry_end,
+		cu_offset_table.dentry_d_mounted, sizeof(int), SIZE(dentry));
+
+	if (CU_VALID_MEMBER(inode_i_mtime_sec)) {
+		plan.mtime = MTIME_SEC_NSEC;
+		plan_add(&plan.inode_start, &plan.inode_end,
+			CU_OFFSET(inode_i_mtime_sec), sizeof(long long),
+			SIZE(inode));
+		plan_add(&plan.inode_start, &plan.inode_end,
+			CU_OFFSET(inode_i_mtime_nsec), sizeof(uint),
+			SIZE(inode));
+	} else {
+		plan.mtime = (env_flags & TIMESPEC64) ?
+			MTIME_TIMESPEC64 : MTIME_TIMESPEC;
+		i_mtime_size = (env_flags & TIMESPEC64) ?
+			sizeof(long long) + sizeof(long) : sizeof(long) * 2;
+		plan_add(&plan.inode_start, &plan.inode_end,
+			CU_OFFSET(inode_i_mtime), i_mtime_size, SIZE(inode));
+	}
+	umode_size = SIZE(umode_t);
+	plan.umode_32bit = (umode_size == SIZEOF_32BIT);
+	plan_add(&plan.inode_start, &plan.inode_end, OFFSET(inode_i_mode),
+		umode_size, SIZE(inode));
+	plan_add(&plan.inode_start, &plan.inode_end, OFFSET(inode_i_mapping),
+		sizeof(ulong), SIZE(inode));
+	plan_add(&plan.inode_start, &plan.inode_end, CU_OFFSET(inode_i_size),
+		sizeof(long long), SIZE(inode));
+
+	plan.i_data_nrpages = -1;
+	if (CU_VALID_MEMBER(inode_i_data) && VALID_MEMBER(address_space_nrpages)) {
+		plan.i_data_nrpages = CU_OFFSET(inode_i_data) +
+			OFFSET(address_space_nrpages);
+		plan_add(&plan.inode_start, &plan.inode_end,
+			plan.i_data_nrpages, sizeof(ulong), SIZE(inode));
+	}
+}
+
 #define DL_EXCLUDE_CACHE_PRI	(0x04)
 
 static void __attribute__((constructor))
 cacheutils_init(void)
 {
 	int dump_level;
+	long value;
+	char *node;
 
 	register_extension(command_table);
 
@@ -1535,6 +9822,7 @@ cacheutils_init(void)
 			env_flags |= TIMESPEC64;
 	}
 	CU_OFFSET_INIT(inode_i_link, "inode", "i_link"); /* 4.2 and later: 61ba64fc0768 */
+	CU_OFFSET_INIT(inode_i_data, "inode", "i_data");
 	CU_OFFSET_INIT(vfsmount_mnt_root, "vfsmount", "mnt_root");
 	CU_OFFSET_INIT(dentry_d_children, "dentry", "d_children"); /* 6.8 and later */
 	if (CU_INVALID_MEMBER(dentry_d_children))
@@ -1547,14 +9835,71 @@ cacheutils_init(void)
 			CU_OFFSET_INIT(dentry_d_child, "dentry", "d_u");
 	}
 	CU_OFFSET_INIT(dentry_d_hash, "dentry", "d_hash");
+	CU_OFFSET_INIT(dentry_d_flags, "dentry", "d_flags");
+	CU_OFFSET_INIT(dentry_d_mounted, "dentry", "d_mounted");
+	CU_OFFSET_INIT(dentry_d_alias, "dentry", "d_alias");
+	if (CU_INVALID_MEMBER(dentry_d_alias))	/* 3.19 and later */
+		CU_OFFSET_INIT(dentry_d_alias, "dentry", "d_u");
+	CU_OFFSET_INIT(inode_i_dentry, "inode", "i_dentry");
+	CU_OFFSET_INIT(inode_i_sb_list, "inode", "i_sb_list");
+	CU_OFFSET_INIT(super_block_s_list, "super_block", "s_list");
+	CU_OFFSET_INIT(super_block_s_inodes, "super_block", "s_inodes");
+	CU_OFFSET_INIT(super_block_s_id, "super_block", "s_id");
+	CU_OFFSET_INIT(super_block_s_type, "super_block", "s_type");
+	CU_OFFSET_INIT(file_system_type_name, "file_system_type", "name");
+	CU_OFFSET_INIT(external_name_name, "external_name", "name");
+	/* 0x10000 from 2.6.38, an enum dentry_flags in 6.15 and later */
+	if (enumerator_value("DCACHE_MOUNTED", &value))
+		dcache_mounted = value;
+	CU_OFFSET_INIT(qstr_hash, "qstr", "hash");
+	if (CU_INVALID_MEMBER(qstr_hash)) /* 3.11 and later: HASH_LEN_DECLARE */
+		CU_ANON_OFFSET_INIT(qstr_hash, "qstr", "hash");
+	if (CU_INVALID_MEMBER(qstr_hash)) {
+		/* the hash is the half of hash_len in the byte order */
+		CU_ANON_OFFSET_INIT(qstr_hash, "qstr", "hash_len");
+		if (CU_VALID_MEMBER(qstr_hash) && __BYTE_ORDER == __BIG_ENDIAN)
+			cu_offset_table.qstr_hash += sizeof(uint);
+	}
 	CU_OFFSET_INIT(hlist_bl_node_pprev, "hlist_bl_node", "pprev");
 	if (CU_INVALID_MEMBER(hlist_bl_node_pprev)) /* 2.6.37 and older */
 		CU_OFFSET_INIT(hlist_bl_node_pprev, "hlist_node", "pprev");
+	/* for THP and large folios in page cache */
+	CU_OFFSET_INIT(page_compound_head, "page", "compound_head"); /* 4.4 and later */
+	CU_OFFSET_INIT(page_compound_order, "page", "compound_order");
+	CU_OFFSET_INIT(folio_folio_order, "folio", "_folio_order");
+	CU_OFFSET_INIT(folio_flags_1, "folio", "_flags_1"); /* 6.6 and later */
+	/* all of them are in anonymous unions and structs */
+	if (CU_INVALID_MEMBER(page_compound_head))
+		CU_ANON_OFFSET_INIT(page_compound_head, "page", "compound_head");
+	if (CU_INVALID_MEMBER(page_compound_order))
+		CU_ANON_OFFSET_INIT(page_compound_order, "page", "compound_order");
+	if (CU_INVALID_MEMBER(folio_folio_order))
+		CU_ANON_OFFSET_INIT(folio_folio_order, "folio", "_folio_order");
+	if (CU_INVALID_MEMBER(folio_flags_1))
+		CU_ANON_OFFSET_INIT(folio_flags_1, "folio", "_flags_1");
+	if (enumerator_value("PG_head", &value))
+		pg_head_bit = value;
 
 	if (MEMBER_EXISTS("address_space", "i_pages") &&
 	    STREQ(MEMBER_TYPE_NAME("address_space", "i_pages"), "xarray"))
 		env_flags |= XARRAY;
 
+	/* for the range-limited walk */
+	node = (env_flags & XARRAY) ? "xa_node" : "radix_tree_node";
+	if (env_flags & XARRAY)
+		CU_OFFSET_INIT(xarray_xa_head, "xarray", "xa_head");
+	else
+		CU_OFFSET_INIT(xarray_xa_head, "radix_tree_root", "rnode");
+	CU_OFFSET_INIT(xa_node_shift, node, "shift"); /* 4.7 and later */
+	CU_OFFSET_INIT(xa_node_slots, node, "slots");
+	if (CU_VALID_MEMBER(xarray_xa_head) && CU_VALID_MEMBER(xa_node_shift) &&
+	    CU_VALID_MEMBER(xa_node_slots)) {
+		walk.node_size = STRUCT_SIZE(node);
+		walk.nr_slots = MEMBER_SIZE(node, "slots") / sizeof(ulong);
+	}
+
+	init_field_plan();
+
 	if (CRASHDEBUG(1))
 		print_debug_data();
 
@@ -1569,4 +9914,15 @@ cacheutils_init(void)
 static void __attribute__((destructor))
 cacheutils_fini(void)
 {
+	cc_clear();
+	cindex_close();
+
+	if (vmcore.fd >= 0)
+		close(vmcore.fd);
+	vmcore.fd = -1;
+	free(vmcore.segs);
+	vmcore.segs = NULL;
+	vmcore.nr_segs = 0;
+	vmcore.method = COPY_NONE;
+	vmcore.initialized = FALSE;
 }